@@ -0,0 +1,207 @@
+/* Simple Osmocom System Monitor (osysmon): leaves of the value tree by path */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+
+#include <talloc.h>
+#include <osmocom/core/utils.h>
+
+#include "value_node.h"
+#include "leaf_table.h"
+
+#define LEAF_TABLE_MIN_BUCKETS	256
+#define LEAF_PATH_MAX		512
+
+static uint32_t path_hash(const char *path)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *path; path++) {
+		h ^= (uint8_t)*path;
+		h *= 16777619;
+	}
+	return h;
+}
+
+struct leaf_table *leaf_table_alloc(void *ctx)
+{
+	struct leaf_table *lt = talloc_zero(ctx, struct leaf_table);
+
+	OSMO_ASSERT(lt);
+	lt->num_buckets = LEAF_TABLE_MIN_BUCKETS;
+	lt->buckets = talloc_zero_array(lt, struct leaf *, lt->num_buckets);
+	OSMO_ASSERT(lt->buckets);
+	INIT_LLIST_HEAD(&lt->leaves);
+	INIT_LLIST_HEAD(&lt->changed);
+	INIT_LLIST_HEAD(&lt->removed);
+	return lt;
+}
+
+struct leaf *leaf_table_find(const struct leaf_table *lt, const char *path)
+{
+	uint32_t hash = path_hash(path);
+	struct leaf *l;
+
+	for (l = lt->buckets[hash & (lt->num_buckets - 1)]; l; l = l->hnext) {
+		if (l->hash == hash && !strcmp(l->path, path))
+			return l;
+	}
+	return NULL;
+}
+
+/* keep the load factor below 1 */
+static void leaf_table_grow(struct leaf_table *lt)
+{
+	unsigned int num = lt->num_buckets * 2, i;
+	struct leaf **buckets, *l, *next;
+
+	buckets = talloc_zero_array(lt, struct leaf *, num);
+	OSMO_ASSERT(buckets);
+	for (i = 0; i < lt->num_buckets; i++) {
+		for (l = lt->buckets[i]; l; l = next) {
+			next = l->hnext;
+			l->hnext = buckets[l->hash & (num - 1)];
+			buckets[l->hash & (num - 1)] = l;
+		}
+	}
+	talloc_free(lt->buckets);
+	lt->buckets = buckets;
+	lt->num_buckets = num;
+}
+
+static void leaf_table_unhash(struct leaf_table *lt, struct leaf *leaf)
+{
+	struct leaf **pl;
+
+	for (pl = &lt->buckets[leaf->hash & (lt->num_buckets - 1)]; *pl; pl = &(*pl)->hnext) {
+		if (*pl == leaf) {
+			*pl = leaf->hnext;
+			break;
+		}
+	}
+	lt->num_leaves--;
+}
+
+/* Set the value of a leaf, adding it at the end if new. Between
+ * leaf_table_begin() and leaf_table_end(), for tables not fed from a value
+ * tree. */
+struct leaf *leaf_table_set(struct leaf_table *lt, const char *path, const char *value)
+{
+	struct leaf *l = leaf_table_find(lt, path);
+
+	if (!l) {
+		if (lt->num_leaves >= lt->num_buckets)
+			leaf_table_grow(lt);
+		l = talloc_zero(lt, struct leaf);
+		OSMO_ASSERT(l);
+		INIT_LLIST_HEAD(&l->changed);
+		l->path = talloc_strdup(l, path);
+		l->hash = path_hash(path);
+		l->hnext = lt->buckets[l->hash & (lt->num_buckets - 1)];
+		lt->buckets[l->hash & (lt->num_buckets - 1)] = l;
+		lt->num_leaves++;
+		llist_add_tail(&l->list, &lt->leaves);
+	}
+
+	if (!l->value || strcmp(l->value, value)) {
+		osmo_talloc_replace_string(l, &l->value, value);
+		if (llist_empty(&l->changed))
+			llist_add_tail(&l->changed, &lt->changed);
+	}
+	l->gen = lt->gen;
+	return l;
+}
+
+/* Remove a leaf, it goes to the removed list */
+void leaf_table_remove(struct leaf_table *lt, struct leaf *l)
+{
+	leaf_table_unhash(lt, l);
+	if (!llist_empty(&l->changed))
+		llist_del_init(&l->changed);
+	llist_move_tail(&l->list, &lt->removed);
+}
+
+static void leaf_table_walk(struct leaf_table *lt, const struct value_node *node, char *path, size_t len)
+{
+	const struct value_node *vn;
+	struct leaf *l;
+	size_t name_len;
+
+	llist_for_each_entry(vn, &node->children, list) {
+		name_len = strlen(vn->name);
+		if (len + name_len + 2 > LEAF_PATH_MAX)
+			continue;
+		if (len)
+			path[len] = '/';
+		memcpy(path + len + !!len, vn->name, name_len + 1);
+		if (vn->value) {
+			/* moving every visited leaf to the end leaves the list
+			 * in tree order */
+			l = leaf_table_set(lt, path, vn->value);
+			llist_move_tail(&l->list, &lt->leaves);
+		} else {
+			leaf_table_walk(lt, vn, path, len + !!len + name_len);
+		}
+	}
+}
+
+/* Start an update, emptying the changed and removed lists of the last one */
+void leaf_table_begin(struct leaf_table *lt)
+{
+	struct leaf *l, *l2;
+
+	llist_for_each_entry_safe(l, l2, &lt->removed, list) {
+		llist_del(&l->list);
+		talloc_free(l);
+	}
+	llist_for_each_entry_safe(l, l2, &lt->changed, changed)
+		llist_del_init(&l->changed);
+	lt->gen++;
+}
+
+/* Remove the leaves that weren't set since leaf_table_begin() */
+void leaf_table_end(struct leaf_table *lt)
+{
+	struct leaf *l, *l2;
+
+	llist_for_each_entry_safe(l, l2, &lt->leaves, list) {
+		if (l->gen != lt->gen)
+			leaf_table_remove(lt, l);
+	}
+}
+
+/* Match the leaves against a new tree, filling the changed and removed lists */
+void leaf_table_update(struct leaf_table *lt, const struct value_node *root)
+{
+	char path[LEAF_PATH_MAX];
+
+	leaf_table_begin(lt);
+	path[0] = '\0';
+	leaf_table_walk(lt, root, path, 0);
+	leaf_table_end(lt);
+}
+
+/* the number of values like "12", "-3.5%" or "1560 kB" (as 1560), see
+ * value_number() */
+bool leaf_number(const struct leaf *l, double *val)
+{
+	size_t len;
+
+	return value_number(l->value, val, &len) != NULL;
+}
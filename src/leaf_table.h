@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <osmocom/core/linuxlist.h>
+
+struct value_node;
+
+/* The leaves of the value tree by their path ("netdev/eth0/rx-bytes"), kept
+ * across ticks, to tell what changed since the previous tree */
+struct leaf {
+	/* in leaf_table.leaves (in tree order) or leaf_table.removed */
+	struct llist_head list;
+	/* in leaf_table.changed if new or changed with the last update */
+	struct llist_head changed;
+	/* hash bucket chain */
+	struct leaf *hnext;
+	uint32_t hash;
+	char *path;
+	char *value;
+	/* generation of the last update that saw this leaf */
+	uint32_t gen;
+	/* recorded samples, see osysmon_history.c */
+	struct history_ring *history;
+	/* series id in the on-disk store, 0 if not known yet, see osysmon_tsdb.c */
+	uint32_t tsdb_id;
+	/* changed, but not sent yet, see osysmon_statsd.c */
+	bool statsd_pending;
+};
+
+struct leaf_table {
+	struct leaf **buckets;
+	unsigned int num_buckets;
+	unsigned int num_leaves;
+	uint32_t gen;
+	struct llist_head leaves;
+	/* new or changed with the last update */
+	struct llist_head changed;
+	/* gone with the last update, freed with the next one */
+	struct llist_head removed;
+};
+
+struct leaf_table *leaf_table_alloc(void *ctx);
+void leaf_table_update(struct leaf_table *lt, const struct value_node *root);
+void leaf_table_begin(struct leaf_table *lt);
+struct leaf *leaf_table_set(struct leaf_table *lt, const char *path, const char *value);
+void leaf_table_end(struct leaf_table *lt);
+void leaf_table_remove(struct leaf_table *lt, struct leaf *l);
+struct leaf *leaf_table_find(const struct leaf_table *lt, const char *path);
+bool leaf_number(const struct leaf *l, double *val);
@@ -0,0 +1,121 @@
+/* Print the shared memory snapshot written by osmo-sysmon */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osysmon_shm.h"
+
+static void exit_help(void)
+{
+	printf("Usage:\n");
+	printf("\tosmo-sysmon-shm FILE            print the whole tree\n");
+	printf("\tosmo-sysmon-shm FILE PATH       print one value, e.g. netdev/eth0/rx-bytes\n");
+	exit(2);
+}
+
+/* Printing may take long, so the snapshot is copied out first */
+static char *copy_snapshot(struct osysmon_shm_reader *r, struct osysmon_shm_reader *copy)
+{
+	const struct osysmon_shm_hdr *hdr;
+	size_t len;
+	uint32_t seq;
+	char *buf;
+	int tries;
+
+	for (tries = 0; tries < 100; tries++) {
+		hdr = osysmon_shm_begin(r, &seq);
+		if (!hdr) {
+			if (!(seq & 1))
+				return NULL;
+			continue;
+		}
+		len = (uint64_t)hdr->strings_off + hdr->strings_len;
+		if (len > r->map_size)
+			continue;
+		buf = malloc(len);
+		if (!buf)
+			return NULL;
+		memcpy(buf, r->map, len);
+		if (!osysmon_shm_retry(r, seq)) {
+			copy->fd = -1;
+			copy->map = (const uint8_t *)buf;
+			copy->map_size = len;
+			return buf;
+		}
+		free(buf);
+	}
+	return NULL;
+}
+
+static uint32_t print_node(const struct osysmon_shm_reader *r, const struct osysmon_shm_hdr *hdr,
+			   uint32_t idx, unsigned int indent)
+{
+	const struct osysmon_shm_node *node = osysmon_shm_node(r, hdr, idx);
+	uint32_t i, child;
+
+	if (!node)
+		return 1;
+	printf("%*s%s", indent, "", osysmon_shm_str(r, hdr, node->name));
+	if (node->value != OSYSMON_SHM_NONE) {
+		printf(": %s\n", osysmon_shm_str(r, hdr, node->value));
+		return 1;
+	}
+	printf("\n");
+	for (i = 0, child = idx + 1; i < node->num_children; i++)
+		child += print_node(r, hdr, child, indent + 2);
+	return node->subtree ? node->subtree : 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct osysmon_shm_reader r, copy;
+	char val[4096];
+	char *buf;
+	int rc;
+
+	if (argc < 2 || argc > 3)
+		exit_help();
+
+	rc = osysmon_shm_open(&r, argv[1]);
+	if (rc < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", argv[1], strerror(-rc));
+		exit(1);
+	}
+
+	if (argc == 3) {
+		rc = osysmon_shm_get(&r, argv[2], val, sizeof(val));
+		if (rc < 0) {
+			fprintf(stderr, "%s: %s\n", argv[2], strerror(-rc));
+			exit(1);
+		}
+		printf("%s\n", val);
+		exit(0);
+	}
+
+	buf = copy_snapshot(&r, &copy);
+	if (!buf) {
+		fprintf(stderr, "No snapshot in %s\n", argv[1]);
+		exit(1);
+	}
+	print_node(&copy, (const struct osysmon_shm_hdr *)buf, 0, 0);
+	free(buf);
+	osysmon_shm_close(&r);
+	exit(0);
+}
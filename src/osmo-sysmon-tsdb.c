@@ -0,0 +1,230 @@
+/* Export samples from the time series store written by osmo-sysmon */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <fnmatch.h>
+
+#include <talloc.h>
+
+#include "tsdb.h"
+
+struct block {
+	uint32_t index;
+	uint32_t seq;
+};
+
+static struct {
+	bool json;
+	int64_t start;
+	int64_t end;
+	const char *pattern;
+	/* path of each series, index is the id - 1 */
+	char **series;
+	uint32_t num_series;
+	uint64_t samples;
+} dump = {
+	.end = INT64_MAX,
+};
+
+static void exit_help(void)
+{
+	printf("Usage: osmo-sysmon-tsdb [-f csv|json] [-s START] [-e END] [-m PATTERN] FILE\n");
+	printf("\t-f csv|json   output format, CSV (default) or one JSON object per line\n");
+	printf("\t-s START      first sample, unix time in seconds, or seconds before now if negative\n");
+	printf("\t-e END        last sample, like START\n");
+	printf("\t-m PATTERN    only paths matching the shell pattern, e.g. 'netdev/*/rx-bytes'\n");
+	exit(2);
+}
+
+static int64_t parse_time(const char *str)
+{
+	char *end;
+	int64_t t = strtoll(str, &end, 10);
+
+	if (*end || end == str)
+		exit_help();
+	if (t < 0)
+		t += time(NULL);
+	return t * 1000;
+}
+
+static void load_catalog(const char *path)
+{
+	char *fname = talloc_asprintf(NULL, "%s.series", path);
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	FILE *f;
+
+	f = fopen(fname, "r");
+	if (!f) {
+		fprintf(stderr, "Cannot open %s: %s\n", fname, strerror(errno));
+		exit(1);
+	}
+	while ((len = getline(&line, &size, f)) > 0) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		dump.series = talloc_realloc(NULL, dump.series, char *, dump.num_series + 1);
+		dump.series[dump.num_series++] = talloc_strdup(dump.series, line);
+	}
+	free(line);
+	fclose(f);
+	talloc_free(fname);
+}
+
+static void print_quoted(const char *str, bool json)
+{
+	putchar('"');
+	for (; *str; str++) {
+		if (*str == '"')
+			fputs(json ? "\\\"" : "\"\"", stdout);
+		else if (json && *str == '\\')
+			fputs("\\\\", stdout);
+		else if (json && (unsigned char)*str < 0x20)
+			printf("\\u%04x", *str);
+		else
+			putchar(*str);
+	}
+	putchar('"');
+}
+
+static void print_sample(uint64_t ts, uint32_t id, double value, void *data)
+{
+	char name[32];
+	const char *path;
+
+	if ((int64_t)ts < dump.start || (int64_t)ts > dump.end)
+		return;
+	if (id && id <= dump.num_series) {
+		path = dump.series[id - 1];
+	} else {
+		snprintf(name, sizeof(name), "#%u", id);
+		path = name;
+	}
+	if (dump.pattern && fnmatch(dump.pattern, path, 0))
+		return;
+
+	if (dump.json) {
+		printf("{\"time\":%" PRIu64 ".%03u,\"path\":", ts / 1000, (unsigned int)(ts % 1000));
+		print_quoted(path, true);
+		if (isfinite(value))
+			printf(",\"value\":%.15g}\n", value);
+		else
+			printf(",\"value\":null}\n");
+	} else {
+		printf("%" PRIu64 ".%03u,", ts / 1000, (unsigned int)(ts % 1000));
+		print_quoted(path, false);
+		printf(",%.15g\n", value);
+	}
+	dump.samples++;
+}
+
+static int block_cmp(const void *a, const void *b)
+{
+	const struct block *ba = a, *bb = b;
+
+	return (int32_t)(ba->seq - bb->seq);
+}
+
+int main(int argc, char **argv)
+{
+	struct tsdb_file_hdr fh;
+	struct tsdb_block_hdr *hdr;
+	struct tsdb_codec *codec;
+	struct block *blocks;
+	uint32_t i, num = 0;
+	uint8_t *buf;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "f:s:e:m:h")) != -1) {
+		switch (opt) {
+		case 'f':
+			if (!strcmp(optarg, "json"))
+				dump.json = true;
+			else if (strcmp(optarg, "csv"))
+				exit_help();
+			break;
+		case 's':
+			dump.start = parse_time(optarg);
+			break;
+		case 'e':
+			/* including the whole second */
+			dump.end = parse_time(optarg) + 999;
+			break;
+		case 'm':
+			dump.pattern = optarg;
+			break;
+		default:
+			exit_help();
+		}
+	}
+	if (optind != argc - 1)
+		exit_help();
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", argv[optind], strerror(errno));
+		exit(1);
+	}
+	if (pread(fd, &fh, sizeof(fh), 0) != sizeof(fh) || fh.magic != TSDB_FILE_MAGIC ||
+	    fh.version != TSDB_VERSION || fh.block_size <= sizeof(*hdr)) {
+		fprintf(stderr, "%s is no osmo-sysmon time series store\n", argv[optind]);
+		exit(1);
+	}
+	load_catalog(argv[optind]);
+
+	/* the ring starts anywhere, order the blocks by sequence number */
+	buf = talloc_size(NULL, fh.block_size);
+	blocks = talloc_array(NULL, struct block, fh.num_blocks);
+	hdr = (struct tsdb_block_hdr *)buf;
+	for (i = 1; i < fh.num_blocks; i++) {
+		if (pread(fd, hdr, sizeof(*hdr), (off_t)i * fh.block_size) != sizeof(*hdr))
+			break;
+		if (hdr->magic != TSDB_BLOCK_MAGIC || !hdr->num_ticks)
+			continue;
+		if ((int64_t)hdr->last_ts < dump.start || (int64_t)hdr->first_ts > dump.end)
+			continue;
+		blocks[num].index = i;
+		blocks[num].seq = hdr->seq;
+		num++;
+	}
+	qsort(blocks, num, sizeof(*blocks), block_cmp);
+
+	if (!dump.json)
+		printf("time,path,value\n");
+	codec = tsdb_codec_alloc(NULL);
+	for (i = 0; i < num; i++) {
+		if (pread(fd, buf, fh.block_size, (off_t)blocks[i].index * fh.block_size) != fh.block_size)
+			continue;
+		if (tsdb_decode_block(codec, hdr, buf + sizeof(*hdr), (fh.block_size - sizeof(*hdr)) * 8,
+				      print_sample, NULL) < 0)
+			fprintf(stderr, "Block %u is corrupt, skipping the rest of it\n", blocks[i].index);
+	}
+
+	close(fd);
+	fprintf(stderr, "%" PRIu64 " samples from %u blocks\n", dump.samples, num);
+	exit(0);
+}
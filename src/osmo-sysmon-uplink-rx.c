@@ -0,0 +1,246 @@
+/* Receive the values sent by the uplink of osmo-sysmon instances */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Prints one line per record:
+ *
+ *   SITE SEQ TIME TYPE = PATH VALUE
+ *   SITE SEQ TIME TYPE - PATH
+ *
+ * TYPE is "key" or "delta", with ",spool" appended for values sent from the
+ * spool after an outage. Every frame is acknowledged once printed. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <talloc.h>
+
+#include "uplink.h"
+
+#define MAX_CONNS	1024
+
+struct conn {
+	int fd;
+	char *site;
+	/* header and payload of the frame being received */
+	uint8_t *buf;
+	size_t len;
+};
+
+static struct {
+	struct pollfd pfd[MAX_CONNS + 1];
+	struct conn *conns[MAX_CONNS + 1];
+	unsigned int num;
+} rx;
+
+struct frame {
+	struct conn *conn;
+	const struct uplink_hdr *hdr;
+};
+
+static void exit_help(void)
+{
+	printf("Usage: osmo-sysmon-uplink-rx [-l ADDR] [-p PORT]\n");
+	printf("\t-l ADDR   address to listen on (default: any)\n");
+	printf("\t-p PORT   TCP port to listen on (default: 2830)\n");
+	exit(2);
+}
+
+static int listen_tcp(const char *addr, const char *port)
+{
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+	};
+	struct addrinfo *res;
+	int fd, one = 1, rc;
+
+	rc = getaddrinfo(addr, port, &hints, &res);
+	if (rc) {
+		fprintf(stderr, "Cannot resolve %s: %s\n", addr ? addr : "", gai_strerror(rc));
+		exit(1);
+	}
+	fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+	if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+	    bind(fd, res->ai_addr, res->ai_addrlen) < 0 || listen(fd, 16) < 0) {
+		fprintf(stderr, "Cannot listen on port %s: %s\n", port, strerror(errno));
+		exit(1);
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static void print_record(const char *path, const char *value, void *data)
+{
+	const struct frame *fr = data;
+
+	printf("%s %" PRIu64 " %" PRIu64 ".%03u %s%s ", fr->conn->site, fr->hdr->seq, fr->hdr->timestamp / 1000,
+	       (unsigned int)(fr->hdr->timestamp % 1000), fr->hdr->type == UPLINK_KEY ? "key" : "delta",
+	       fr->hdr->flags & UPLINK_F_SPOOL ? ",spool" : "");
+	if (value)
+		printf("= %s %s\n", path, value);
+	else
+		printf("- %s\n", path);
+}
+
+static int handle_frame(struct conn *conn, const struct uplink_hdr *hdr, const uint8_t *payload)
+{
+	struct uplink_hdr ack = {
+		.type = UPLINK_ACK,
+		.flags = hdr->flags & UPLINK_F_SPOOL,
+		.seq = hdr->seq,
+	};
+	struct frame fr = { .conn = conn, .hdr = hdr };
+	uint8_t buf[UPLINK_HDR_LEN];
+	uint8_t *raw;
+	int len;
+
+	switch (hdr->type) {
+	case UPLINK_HELLO:
+		talloc_free(conn->site);
+		conn->site = talloc_strndup(conn, (const char *)payload, hdr->len);
+		return 0;
+	case UPLINK_KEY:
+	case UPLINK_DELTA:
+		if (!conn->site)
+			return -EINVAL;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	len = uplink_decompress(conn, hdr, payload, &raw);
+	if (len < 0)
+		return len;
+	if (uplink_parse_records(raw, len, print_record, &fr) < 0)
+		fprintf(stderr, "%s: frame %" PRIu64 " is corrupt\n", conn->site, hdr->seq);
+	if (raw != payload)
+		talloc_free(raw);
+	fflush(stdout);
+
+	/* the ack is tiny, a full socket buffer means a stuck sender */
+	uplink_hdr_encode(buf, &ack);
+	if (write(conn->fd, buf, sizeof(buf)) != sizeof(buf))
+		return -EIO;
+	return 0;
+}
+
+/* Read the header, then the payload, of one frame at a time */
+static int conn_read(struct conn *conn)
+{
+	struct uplink_hdr hdr;
+	size_t want = UPLINK_HDR_LEN;
+	ssize_t rc;
+	int err;
+
+	if (conn->len >= UPLINK_HDR_LEN) {
+		uplink_hdr_decode(&hdr, conn->buf);
+		want += hdr.len;
+	}
+	rc = read(conn->fd, conn->buf + conn->len, want - conn->len);
+	if (rc <= 0)
+		return -EIO;
+	conn->len += rc;
+	if (conn->len < want)
+		return 0;
+
+	if (uplink_hdr_decode(&hdr, conn->buf) < 0)
+		return -EINVAL;
+	if (conn->len < UPLINK_HDR_LEN + hdr.len) {
+		conn->buf = talloc_realloc_size(conn, conn->buf, UPLINK_HDR_LEN + hdr.len);
+		return conn->buf ? 0 : -ENOMEM;
+	}
+	err = handle_frame(conn, &hdr, conn->buf + UPLINK_HDR_LEN);
+	conn->len = 0;
+	return err;
+}
+
+static void conn_close(unsigned int i)
+{
+	if (rx.conns[i]->site)
+		fprintf(stderr, "%s disconnected\n", rx.conns[i]->site);
+	close(rx.pfd[i].fd);
+	talloc_free(rx.conns[i]);
+	rx.num--;
+	rx.pfd[i] = rx.pfd[rx.num];
+	rx.conns[i] = rx.conns[rx.num];
+}
+
+int main(int argc, char **argv)
+{
+	const char *addr = NULL, *port = "2830";
+	struct conn *conn;
+	unsigned int i;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "l:p:h")) != -1) {
+		switch (opt) {
+		case 'l':
+			addr = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		default:
+			exit_help();
+		}
+	}
+	if (optind != argc)
+		exit_help();
+
+	rx.pfd[0].fd = listen_tcp(addr, port);
+	rx.pfd[0].events = POLLIN;
+	rx.num = 1;
+
+	while (1) {
+		if (poll(rx.pfd, rx.num, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll: %s\n", strerror(errno));
+			exit(1);
+		}
+		/* backwards, closing moves the last one to i */
+		for (i = rx.num - 1; i > 0; i--) {
+			if (rx.pfd[i].revents && conn_read(rx.conns[i]) < 0)
+				conn_close(i);
+		}
+		if (rx.pfd[0].revents & POLLIN) {
+			fd = accept(rx.pfd[0].fd, NULL, NULL);
+			if (fd < 0)
+				continue;
+			if (rx.num > MAX_CONNS) {
+				close(fd);
+				continue;
+			}
+			conn = talloc_zero(NULL, struct conn);
+			conn->fd = fd;
+			conn->buf = talloc_size(conn, UPLINK_HDR_LEN);
+			rx.conns[rx.num] = conn;
+			rx.pfd[rx.num].fd = fd;
+			rx.pfd[rx.num].events = POLLIN;
+			rx.num++;
+		}
+	}
+}
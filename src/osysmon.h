@@ -15,16 +15,26 @@ struct osysmon_state {
 	struct rtnl_client_state *rcs;
 	/* list of 'struct osysmon_cmd' */
 	struct llist_head shellcmds;
+	/* list of 'struct osysmon_shellcmd_stream' */
+	struct llist_head shellcmd_streams;
 	/* list of 'struct ctrl client' */
 	struct llist_head ctrl_clients;
 	/* list of 'struct openvpn_client' */
 	struct llist_head openvpn_clients;
+	/* list of 'struct ovpn_status_file' */
+	struct llist_head openvpn_status_files;
 	/* list of 'struct netdev' */
 	struct llist_head netdevs;
 	/* list of 'struct osysmon_file' */
 	struct llist_head files;
+	/* list of 'struct osysmon_process' */
+	struct llist_head processes;
+	/* list of 'struct osysmon_cgroup' */
+	struct llist_head cgroups;
 	/* list of ping contexts */
 	struct ping_state *pings;
+	/* leaves of the last tree by path, allocated by the modules needing it */
+	struct leaf_table *leaves;
 };
 
 extern struct osysmon_state *g_oss;
@@ -37,6 +47,7 @@ enum osysmon_vty_node {
 	NETDEV_NODE,
 	OPENVPN_NODE,
 	PING_NODE,
+	OPENVPN_STATUS_NODE,
 };
 
 int osysmon_ctrl_go_parent(struct vty *vty);
@@ -50,14 +61,55 @@ int osysmon_rtnl_poll(struct value_node *parent);
 int osysmon_sysinfo_init();
 int osysmon_sysinfo_poll(struct value_node *parent);
 
+int osysmon_cpu_init();
+int osysmon_cpu_poll(struct value_node *parent);
+
 int osysmon_ping_init();
 int osysmon_ping_poll(struct value_node *parent);
+bool osysmon_ping_busy(void);
 
 int osysmon_openvpn_init();
 int osysmon_openvpn_poll(struct value_node *parent);
 
+int osysmon_openvpn_status_go_parent(struct vty *vty);
+int osysmon_openvpn_status_init();
+int osysmon_openvpn_status_poll(struct value_node *parent);
+
 int osysmon_file_init();
 int osysmon_file_poll(struct value_node *parent);
 
+int osysmon_process_init();
+int osysmon_process_poll(struct value_node *parent);
+
+int osysmon_cgroup_init();
+int osysmon_cgroup_poll(struct value_node *parent);
+
+int osysmon_http_init();
+void osysmon_http_update(struct value_node *root);
+
+int osysmon_shm_init();
+void osysmon_shm_update(struct value_node *root);
+
+int osysmon_unix_init();
+void osysmon_unix_update(struct value_node *root);
+
+int osysmon_history_init();
+void osysmon_history_update(struct value_node *root);
+
+int osysmon_tsdb_init();
+int osysmon_tsdb_poll(struct value_node *parent);
+void osysmon_tsdb_update(struct value_node *root);
+
+int osysmon_statsd_init();
+void osysmon_statsd_update(struct value_node *root);
+
+int osysmon_uplink_init();
+int osysmon_uplink_poll(struct value_node *parent);
+void osysmon_uplink_update(struct value_node *root);
+
+int osysmon_aggregator_init();
+int osysmon_aggregator_poll(struct value_node *parent);
+
 int osysmon_shellcmd_init();
 int osysmon_shellcmd_poll(struct value_node *parent);
+bool osysmon_shellcmd_busy(void);
@@ -0,0 +1,673 @@
+/* Simple Osmocom System Monitor (osysmon): aggregator of remote instances */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Receives the frames of the uplink of remote instances (see uplink.h) and
+ * shows the last values of each site below "site/NAME", so that all the
+ * exporters serve the merged tree.
+ *
+ * Via TCP, a connection starts with a HELLO frame naming the site and every
+ * frame is acknowledged. Via UDP, which has no acks and no spool, every
+ * datagram holds a HELLO frame followed by KEY or DELTA frames.
+ *
+ * The leaves of a site are replaced by a KEY frame and updated by the DELTA
+ * frames following it. A DELTA frame not following the previous one, like
+ * after a lost datagram, is ignored until the next KEY frame. Frames from
+ * the spool of a site are older than the live ones, and only the last
+ * values are shown here: they are counted as "spooled" and dropped, but
+ * acknowledged like all frames, so that the sender deletes its spool
+ * instead of sending it again after every reconnect. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <osmocom/core/select.h>
+#include <osmocom/core/socket.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "leaf_table.h"
+#include "render.h"
+#include "uplink.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define AGG_MAX_CONNS			1000
+/* closed without frames for this long, the sender has a keyframe interval */
+#define AGG_CONN_TIMEOUT		3600
+#define AGG_MAX_SITE_NAME		64
+#define AGG_MAX_DEPTH			16
+/* datagrams per read event, to stay fair to the TCP connections */
+#define AGG_UDP_BURST			64
+#define AGG_DEFAULT_STALE_TIMEOUT	10
+/* any HELLO creates a site, even an unauthenticated datagram */
+#define AGG_DEFAULT_MAX_SITES		1000
+#define AGG_DEFAULT_SITE_EXPIRE		86400
+
+struct agg_site {
+	struct llist_head list;
+	char *name;
+	struct leaf_table *leaves;
+	/* the TCP connection feeding it, if any */
+	struct agg_conn *conn;
+	/* of the last frame applied */
+	uint64_t seq;
+	/* got a KEY frame, and all DELTA frames since */
+	bool synced;
+	/* CLOCK_MONOTONIC */
+	time_t last_update;
+};
+
+struct agg_conn {
+	struct llist_head list;
+	struct osmo_fd ofd;
+	struct osmo_timer_list timer;
+	struct agg_site *site;
+	/* header and payload of the frame being received */
+	uint8_t *buf;
+	size_t len;
+	/* ACK frames the socket didn't take yet */
+	struct render_buf *out;
+	size_t out_off;
+};
+
+static struct {
+	struct {
+		char *tcp_addr;
+		uint16_t tcp_port;
+		char *udp_addr;
+		uint16_t udp_port;
+		unsigned int stale_timeout;
+		unsigned int site_expire;
+		unsigned int max_sites;
+	} cfg;
+
+	struct osmo_fd tcp_ofd;
+	struct osmo_fd udp_ofd;
+	struct llist_head conns;
+	unsigned int num_conns;
+	/* by name */
+	struct llist_head sites;
+	unsigned int num_sites;
+
+	struct {
+		uint64_t frames;
+		uint64_t ignored;
+		uint64_t spooled;
+		/* HELLO of a new site beyond max_sites */
+		uint64_t rejected;
+		uint64_t errors;
+	} stats;
+} agg = {
+	.cfg = {
+		.stale_timeout = AGG_DEFAULT_STALE_TIMEOUT,
+		.site_expire = AGG_DEFAULT_SITE_EXPIRE,
+		.max_sites = AGG_DEFAULT_MAX_SITES,
+	},
+	.tcp_ofd = { .fd = -1 },
+	.udp_ofd = { .fd = -1 },
+	.conns = LLIST_HEAD_INIT(agg.conns),
+	.sites = LLIST_HEAD_INIT(agg.sites),
+};
+
+static time_t agg_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static struct agg_site *agg_site_get(const char *name, size_t len)
+{
+	struct agg_site *site, *s;
+
+	if (!len || len > AGG_MAX_SITE_NAME || memchr(name, '/', len) || memchr(name, '\0', len))
+		return NULL;
+	llist_for_each_entry(s, &agg.sites, list) {
+		int cmp = strncmp(s->name, name, len);
+		if (!cmp && !s->name[len])
+			return s;
+		if (cmp > 0)
+			break;
+	}
+
+	if (agg.num_sites >= agg.cfg.max_sites) {
+		agg.stats.rejected++;
+		return NULL;
+	}
+	site = talloc_zero(g_oss, struct agg_site);
+	OSMO_ASSERT(site);
+	site->name = talloc_strndup(site, name, len);
+	site->leaves = leaf_table_alloc(site);
+	site->last_update = agg_now();
+	/* before s, or at the end if none is greater */
+	llist_add_tail(&site->list, &s->list);
+	agg.num_sites++;
+	return site;
+}
+
+static void agg_site_del(struct agg_site *site)
+{
+	if (site->conn)
+		site->conn->site = NULL;
+	llist_del(&site->list);
+	agg.num_sites--;
+	talloc_free(site);
+}
+
+static void agg_record_cb(const char *path, const char *value, void *data)
+{
+	struct agg_site *site = data;
+	struct leaf *l;
+
+	if (value) {
+		leaf_table_set(site->leaves, path, value);
+		return;
+	}
+	l = leaf_table_find(site->leaves, path);
+	if (l)
+		leaf_table_remove(site->leaves, l);
+}
+
+static void agg_apply(struct agg_site *site, const struct uplink_hdr *hdr, const uint8_t *payload)
+{
+	uint8_t *raw;
+	int len, rc;
+
+	agg.stats.frames++;
+	if (hdr->flags & UPLINK_F_SPOOL) {
+		agg.stats.spooled++;
+		return;
+	}
+	if (hdr->type == UPLINK_DELTA && (!site->synced || hdr->seq != site->seq + 1)) {
+		site->synced = false;
+		agg.stats.ignored++;
+		return;
+	}
+
+	len = uplink_decompress(site, hdr, payload, &raw);
+	if (len < 0) {
+		site->synced = false;
+		agg.stats.errors++;
+		return;
+	}
+	leaf_table_begin(site->leaves);
+	rc = uplink_parse_records(raw, len, agg_record_cb, site);
+	if (hdr->type == UPLINK_KEY && rc == 0)
+		leaf_table_end(site->leaves);
+	if (raw != payload)
+		talloc_free(raw);
+
+	site->synced = rc == 0;
+	site->seq = hdr->seq;
+	site->last_update = agg_now();
+	if (rc < 0)
+		agg.stats.errors++;
+}
+
+/* TCP */
+
+static void agg_conn_close(struct agg_conn *conn)
+{
+	if (conn->site)
+		conn->site->conn = NULL;
+	osmo_timer_del(&conn->timer);
+	osmo_fd_unregister(&conn->ofd);
+	close(conn->ofd.fd);
+	llist_del(&conn->list);
+	agg.num_conns--;
+	talloc_free(conn);
+}
+
+static int agg_conn_write(struct agg_conn *conn)
+{
+	ssize_t rc;
+
+	while (conn->out_off < conn->out->len) {
+		rc = write(conn->ofd.fd, conn->out->data + conn->out_off, conn->out->len - conn->out_off);
+		if (rc < 0 && errno == EAGAIN)
+			break;
+		if (rc <= 0)
+			return -EIO;
+		conn->out_off += rc;
+	}
+	if (conn->out_off == conn->out->len) {
+		render_buf_reset(conn->out);
+		conn->out_off = 0;
+		conn->ofd.when &= ~BSC_FD_WRITE;
+	} else {
+		conn->ofd.when |= BSC_FD_WRITE;
+	}
+	return 0;
+}
+
+static int agg_conn_frame(struct agg_conn *conn, const struct uplink_hdr *hdr, const uint8_t *payload)
+{
+	struct uplink_hdr ack = {
+		.type = UPLINK_ACK,
+		.flags = hdr->flags & UPLINK_F_SPOOL,
+		.seq = hdr->seq,
+	};
+	struct agg_site *site;
+	uint8_t buf[UPLINK_HDR_LEN];
+
+	switch (hdr->type) {
+	case UPLINK_HELLO:
+		site = agg_site_get((const char *)payload, hdr->len);
+		if (!site)
+			return -EINVAL;
+		/* the site reconnected, the old connection is dead */
+		if (site->conn && site->conn != conn)
+			agg_conn_close(site->conn);
+		if (conn->site)
+			conn->site->conn = NULL;
+		site->conn = conn;
+		conn->site = site;
+		return 0;
+	case UPLINK_KEY:
+	case UPLINK_DELTA:
+		if (!conn->site)
+			return -EINVAL;
+		agg_apply(conn->site, hdr, payload);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* sent once all that was read is handled */
+	uplink_hdr_encode(buf, &ack);
+	render_buf_append(conn->out, buf, sizeof(buf));
+	return 0;
+}
+
+/* Read the header, then the payload, of frame after frame */
+static int agg_conn_read(struct agg_conn *conn)
+{
+	struct uplink_hdr hdr;
+	size_t want;
+	ssize_t rc;
+
+	while (1) {
+		want = UPLINK_HDR_LEN;
+		if (conn->len >= UPLINK_HDR_LEN) {
+			uplink_hdr_decode(&hdr, conn->buf);
+			want += hdr.len;
+		}
+		rc = read(conn->ofd.fd, conn->buf + conn->len, want - conn->len);
+		if (rc < 0 && errno == EAGAIN)
+			return 0;
+		if (rc <= 0)
+			return -EIO;
+		conn->len += rc;
+		if (conn->len < want)
+			continue;
+
+		if (uplink_hdr_decode(&hdr, conn->buf) < 0)
+			return -EINVAL;
+		if (conn->len < UPLINK_HDR_LEN + hdr.len) {
+			conn->buf = talloc_realloc_size(conn, conn->buf, UPLINK_HDR_LEN + hdr.len);
+			if (!conn->buf)
+				return -ENOMEM;
+			continue;
+		}
+		conn->len = 0;
+		if (agg_conn_frame(conn, &hdr, conn->buf + UPLINK_HDR_LEN) < 0)
+			return -EINVAL;
+		osmo_timer_schedule(&conn->timer, AGG_CONN_TIMEOUT, 0);
+	}
+}
+
+static int agg_conn_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct agg_conn *conn = ofd->data;
+
+	if ((what & BSC_FD_READ) && agg_conn_read(conn) < 0) {
+		agg_conn_close(conn);
+		return 0;
+	}
+	if (agg_conn_write(conn) < 0)
+		agg_conn_close(conn);
+	return 0;
+}
+
+static void agg_conn_timer_cb(void *data)
+{
+	agg_conn_close(data);
+}
+
+static int agg_accept_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct agg_conn *conn;
+	int fd;
+
+	fd = accept(ofd->fd, NULL, NULL);
+	if (fd < 0)
+		return 0;
+	if (agg.num_conns >= AGG_MAX_CONNS) {
+		close(fd);
+		return 0;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	conn = talloc_zero(g_oss, struct agg_conn);
+	OSMO_ASSERT(conn);
+	conn->buf = talloc_size(conn, UPLINK_HDR_LEN);
+	conn->out = render_buf_alloc(conn, 256);
+	conn->ofd.fd = fd;
+	conn->ofd.when = BSC_FD_READ;
+	conn->ofd.cb = agg_conn_cb;
+	conn->ofd.data = conn;
+	osmo_fd_register(&conn->ofd);
+	osmo_timer_setup(&conn->timer, agg_conn_timer_cb, conn);
+	osmo_timer_schedule(&conn->timer, AGG_CONN_TIMEOUT, 0);
+	llist_add_tail(&conn->list, &agg.conns);
+	agg.num_conns++;
+	return 0;
+}
+
+static void agg_tcp_close(void)
+{
+	struct agg_conn *conn, *conn2;
+
+	llist_for_each_entry_safe(conn, conn2, &agg.conns, list)
+		agg_conn_close(conn);
+	if (agg.tcp_ofd.fd >= 0) {
+		osmo_fd_unregister(&agg.tcp_ofd);
+		close(agg.tcp_ofd.fd);
+		agg.tcp_ofd.fd = -1;
+	}
+}
+
+/* UDP */
+
+static void agg_datagram(const uint8_t *buf, size_t len)
+{
+	struct agg_site *site = NULL;
+	struct uplink_hdr hdr;
+	size_t off = 0;
+
+	while (off + UPLINK_HDR_LEN <= len) {
+		if (uplink_hdr_decode(&hdr, buf + off) < 0 || off + UPLINK_HDR_LEN + hdr.len > len)
+			break;
+		if (hdr.type == UPLINK_HELLO)
+			site = agg_site_get((const char *)buf + off + UPLINK_HDR_LEN, hdr.len);
+		else if (site && (hdr.type == UPLINK_KEY || hdr.type == UPLINK_DELTA))
+			agg_apply(site, &hdr, buf + off + UPLINK_HDR_LEN);
+		off += UPLINK_HDR_LEN + hdr.len;
+	}
+	if (off != len)
+		agg.stats.errors++;
+}
+
+static int agg_udp_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	static uint8_t buf[65536];
+	ssize_t rc;
+	int i;
+
+	for (i = 0; i < AGG_UDP_BURST; i++) {
+		rc = recv(ofd->fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (rc < 0)
+			break;
+		agg_datagram(buf, rc);
+	}
+	return 0;
+}
+
+static void agg_udp_close(void)
+{
+	if (agg.udp_ofd.fd >= 0) {
+		osmo_fd_unregister(&agg.udp_ofd);
+		close(agg.udp_ofd.fd);
+		agg.udp_ofd.fd = -1;
+	}
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define AGG_STR "Merge the values sent by the uplink of other instances\n"
+#define AGG_TCP_STR AGG_STR "Listen via TCP\n"
+DEFUN(cfg_aggregator_tcp, cfg_aggregator_tcp_cmd,
+	"aggregator-tcp A.B.C.D <1-65535>",
+	AGG_TCP_STR "Local IP address\n" "Local TCP port\n")
+{
+	int rc;
+
+	agg_tcp_close();
+	agg.tcp_ofd.when = BSC_FD_READ;
+	agg.tcp_ofd.cb = agg_accept_cb;
+	rc = osmo_sock_init_ofd(&agg.tcp_ofd, AF_INET, SOCK_STREAM, IPPROTO_TCP, argv[0], atoi(argv[1]),
+				OSMO_SOCK_F_BIND);
+	if (rc < 0) {
+		agg.tcp_ofd.fd = -1;
+		vty_out(vty, "Cannot listen on %s:%s%s", argv[0], argv[1], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	osmo_talloc_replace_string(g_oss, &agg.cfg.tcp_addr, argv[0]);
+	agg.cfg.tcp_port = atoi(argv[1]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_aggregator_tcp, cfg_no_aggregator_tcp_cmd,
+	"no aggregator-tcp",
+	NO_STR AGG_TCP_STR)
+{
+	agg_tcp_close();
+	TALLOC_FREE(agg.cfg.tcp_addr);
+	return CMD_SUCCESS;
+}
+
+#define AGG_UDP_STR AGG_STR "Listen via UDP\n"
+DEFUN(cfg_aggregator_udp, cfg_aggregator_udp_cmd,
+	"aggregator-udp A.B.C.D <1-65535>",
+	AGG_UDP_STR "Local IP address\n" "Local UDP port\n")
+{
+	int rc;
+
+	agg_udp_close();
+	agg.udp_ofd.when = BSC_FD_READ;
+	agg.udp_ofd.cb = agg_udp_cb;
+	rc = osmo_sock_init_ofd(&agg.udp_ofd, AF_INET, SOCK_DGRAM, IPPROTO_UDP, argv[0], atoi(argv[1]),
+				OSMO_SOCK_F_BIND);
+	if (rc < 0) {
+		agg.udp_ofd.fd = -1;
+		vty_out(vty, "Cannot listen on %s:%s%s", argv[0], argv[1], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	osmo_talloc_replace_string(g_oss, &agg.cfg.udp_addr, argv[0]);
+	agg.cfg.udp_port = atoi(argv[1]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_aggregator_udp, cfg_no_aggregator_udp_cmd,
+	"no aggregator-udp",
+	NO_STR AGG_UDP_STR)
+{
+	agg_udp_close();
+	TALLOC_FREE(agg.cfg.udp_addr);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_aggregator_stale_timeout, cfg_aggregator_stale_timeout_cmd,
+	"aggregator-stale-timeout <1-3600>",
+	"Consider a site stale when nothing was received from it for this long\n"
+	"Timeout in seconds (default 10)\n")
+{
+	agg.cfg.stale_timeout = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_aggregator_site_expire, cfg_aggregator_site_expire_cmd,
+	"aggregator-site-expire <0-2592000>",
+	"Remove a site when nothing was received from it for this long\n"
+	"Time in seconds (default 86400), 0 to keep it forever\n")
+{
+	agg.cfg.site_expire = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_aggregator_max_sites, cfg_aggregator_max_sites_cmd,
+	"aggregator-max-sites <1-100000>",
+	"Ignore new sites beyond this number, until others expired\n"
+	"Number of sites (default 1000)\n")
+{
+	agg.cfg.max_sites = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+static void osysmon_aggregator_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_aggregator_tcp_cmd);
+	install_element(CONFIG_NODE, &cfg_no_aggregator_tcp_cmd);
+	install_element(CONFIG_NODE, &cfg_aggregator_udp_cmd);
+	install_element(CONFIG_NODE, &cfg_no_aggregator_udp_cmd);
+	install_element(CONFIG_NODE, &cfg_aggregator_stale_timeout_cmd);
+	install_element(CONFIG_NODE, &cfg_aggregator_site_expire_cmd);
+	install_element(CONFIG_NODE, &cfg_aggregator_max_sites_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+static struct value_node *child_find_or_add(struct value_node *parent, const char *name, size_t len)
+{
+	struct value_node *vn;
+
+	llist_for_each_entry(vn, &parent->children, list) {
+		if (!strncmp(vn->name, name, len) && !vn->name[len])
+			return vn;
+	}
+	return value_node_add(parent, talloc_strndup(parent, name, len), NULL);
+}
+
+/* The leaves are mostly in tree order, so the nodes of the previous path are
+ * kept to skip looking up the common part. */
+static void agg_site_tree(struct value_node *parent, const struct agg_site *site)
+{
+	struct value_node *nodes[AGG_MAX_DEPTH], *vn;
+	unsigned int depth = 0, d;
+	const char *p, *slash;
+	struct leaf *l;
+	size_t len;
+
+	llist_for_each_entry(l, &site->leaves->leaves, list) {
+		vn = parent;
+		p = l->path;
+		for (d = 0; (slash = strchr(p, '/')); d++) {
+			len = slash - p;
+			if (d == AGG_MAX_DEPTH)
+				break;
+			if (d < depth && !strncmp(nodes[d]->name, p, len) && !nodes[d]->name[len]) {
+				vn = nodes[d];
+			} else {
+				vn = child_find_or_add(vn, p, len);
+				/* a leaf of the same name */
+				if (!vn || vn->value)
+					break;
+				nodes[d] = vn;
+				depth = d + 1;
+			}
+			p = slash + 1;
+		}
+		if (slash) {
+			depth = 0;
+			continue;
+		}
+		/* the leaf outlives the tree, frames are handled between ticks */
+		value_node_add(vn, p, l->value);
+	}
+}
+
+/* called once on startup before config file parsing */
+int osysmon_aggregator_init()
+{
+	osysmon_aggregator_vty_init();
+	return 0;
+}
+
+int osysmon_aggregator_poll(struct value_node *parent)
+{
+	struct value_node *vn, *vn_state, *vn_sites;
+	struct agg_site *site, *site2;
+	unsigned int stale = 0, num = 0;
+	time_t now = agg_now(), age;
+	char buf[64];
+
+	if (agg.tcp_ofd.fd < 0 && agg.udp_ofd.fd < 0 && llist_empty(&agg.sites))
+		return 0;
+
+	vn = value_node_add(parent, "aggregator", NULL);
+	vn_sites = value_node_add(parent, "site", NULL);
+	if (!vn || !vn_sites)
+		return -ENOMEM;
+	vn_state = value_node_add(vn, "state", NULL);
+
+	llist_for_each_entry_safe(site, site2, &agg.sites, list) {
+		age = now - site->last_update;
+		if (agg.cfg.site_expire && age >= agg.cfg.site_expire && !site->conn) {
+			agg_site_del(site);
+			continue;
+		}
+		num++;
+		if (age >= agg.cfg.stale_timeout) {
+			stale++;
+			snprintf(buf, sizeof(buf), "stale for %ld s", (long)age);
+		} else if (!site->synced) {
+			snprintf(buf, sizeof(buf), "waiting for a key frame");
+		} else {
+			snprintf(buf, sizeof(buf), "up");
+		}
+		value_node_add(vn_state, site->name, buf);
+		agg_site_tree(value_node_add(vn_sites, site->name, NULL), site);
+	}
+
+	snprintf(buf, sizeof(buf), "%u", num);
+	value_node_add(vn, "sites", buf);
+	snprintf(buf, sizeof(buf), "%u", stale);
+	value_node_add(vn, "stale", buf);
+	snprintf(buf, sizeof(buf), "%u", agg.num_conns);
+	value_node_add(vn, "connections", buf);
+	snprintf(buf, sizeof(buf), "%" PRIu64, agg.stats.frames);
+	value_node_add(vn, "frames", buf);
+	snprintf(buf, sizeof(buf), "%" PRIu64, agg.stats.ignored);
+	value_node_add(vn, "ignored", buf);
+	snprintf(buf, sizeof(buf), "%" PRIu64, agg.stats.spooled);
+	value_node_add(vn, "spooled", buf);
+	snprintf(buf, sizeof(buf), "%" PRIu64, agg.stats.rejected);
+	value_node_add(vn, "rejected", buf);
+	snprintf(buf, sizeof(buf), "%" PRIu64, agg.stats.errors);
+	value_node_add(vn, "errors", buf);
+	return 0;
+}
@@ -0,0 +1,372 @@
+/* Simple Osmocom System Monitor (osysmon): cgroup v2 resource usage */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "pfile.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define CGROUP_ROOT		"/sys/fs/cgroup/"
+#define CGROUP_BUF_SIZE		512
+/* one line per block device */
+#define CGROUP_IO_BUF_SIZE	4096
+
+/* cumulative counters of one cgroup; a restarted unit gets a new cgroup with
+ * all counters starting from zero again */
+struct cgroup_counters {
+	bool valid;
+	struct timespec ts;
+	/* cpu.stat */
+	uint64_t usage_usec;
+	uint64_t nr_throttled;
+	uint64_t throttled_usec;
+	/* memory.events */
+	uint64_t high;
+	uint64_t max;
+	uint64_t oom;
+	uint64_t oom_kill;
+	/* io.stat, summed over all devices */
+	uint64_t rbytes;
+	uint64_t wbytes;
+	uint64_t rios;
+	uint64_t wios;
+	/* {cpu,memory,io}.pressure, total stall time in us */
+	uint64_t psi_some[3];
+	uint64_t psi_full[3];
+};
+
+static const char *cgroup_psi_names[3] = { "cpu", "memory", "io" };
+
+struct osysmon_cgroup {
+	struct llist_head list;
+	struct {
+		/* as configured, relative to CGROUP_ROOT or absolute */
+		const char *path;
+	} cfg;
+	/* last path component, e.g. osmo-bts.service */
+	const char *name;
+
+	struct pfile *cpu_stat;
+	struct pfile *memory_current;
+	struct pfile *memory_events;
+	struct pfile *io_stat;
+	struct pfile *psi[3];
+
+	struct cgroup_counters prev;
+};
+
+static struct osysmon_cgroup *osysmon_cgroup_find(const char *path)
+{
+	struct osysmon_cgroup *cg;
+
+	llist_for_each_entry(cg, &g_oss->cgroups, list) {
+		if (!strcmp(cg->cfg.path, path))
+			return cg;
+	}
+	return NULL;
+}
+
+static struct pfile *cgroup_pfile(struct osysmon_cgroup *cg, const char *dir, const char *file, size_t size)
+{
+	char *path = talloc_asprintf(cg, "%s/%s", dir, file);
+	struct pfile *pf = pfile_alloc(cg, path, size);
+
+	talloc_free(path);
+	return pf;
+}
+
+static struct osysmon_cgroup *osysmon_cgroup_find_name(const char *name)
+{
+	struct osysmon_cgroup *cg;
+
+	llist_for_each_entry(cg, &g_oss->cgroups, list) {
+		if (!strcmp(cg->name, name))
+			return cg;
+	}
+	return NULL;
+}
+
+/* Returns NULL if the path, or another one with the same last component
+ * (which names the value node), is configured already */
+static struct osysmon_cgroup *osysmon_cgroup_add(const char *path)
+{
+	struct osysmon_cgroup *cg;
+	const char *name;
+	char *dir;
+	size_t len;
+	int i;
+
+	if (osysmon_cgroup_find(path))
+		return NULL;
+
+	cg = talloc_zero(g_oss, struct osysmon_cgroup);
+	OSMO_ASSERT(cg);
+	cg->cfg.path = talloc_strdup(cg, path);
+
+	if (path[0] == '/')
+		dir = talloc_strdup(cg, path);
+	else
+		dir = talloc_asprintf(cg, CGROUP_ROOT "%s", path);
+	len = strlen(dir);
+	while (len > 1 && dir[len - 1] == '/')
+		dir[--len] = '\0';
+	name = strrchr(dir, '/');
+	cg->name = talloc_strdup(cg, name && name[1] ? name + 1 : dir);
+	if (osysmon_cgroup_find_name(cg->name)) {
+		talloc_free(cg);
+		return NULL;
+	}
+
+	/* the unit may not be running yet, the files are (re-)opened on the
+	 * next read */
+	cg->cpu_stat = cgroup_pfile(cg, dir, "cpu.stat", CGROUP_BUF_SIZE);
+	cg->memory_current = cgroup_pfile(cg, dir, "memory.current", CGROUP_BUF_SIZE);
+	cg->memory_events = cgroup_pfile(cg, dir, "memory.events", CGROUP_BUF_SIZE);
+	cg->io_stat = cgroup_pfile(cg, dir, "io.stat", CGROUP_IO_BUF_SIZE);
+	for (i = 0; i < ARRAY_SIZE(cg->psi); i++) {
+		char *file = talloc_asprintf(cg, "%s.pressure", cgroup_psi_names[i]);
+		cg->psi[i] = cgroup_pfile(cg, dir, file, CGROUP_BUF_SIZE);
+		talloc_free(file);
+	}
+	talloc_free(dir);
+
+	llist_add_tail(&cg->list, &g_oss->cgroups);
+	return cg;
+}
+
+static void osysmon_cgroup_destroy(struct osysmon_cgroup *cg)
+{
+	llist_del(&cg->list);
+	talloc_free(cg);
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define CGROUP_STR "Configure a cgroup (v2) to be monitored\n"
+#define CGROUP_PATH_STR "Path of the cgroup, relative to " CGROUP_ROOT " (e.g. system.slice/osmo-bts.service)\n"
+DEFUN(cfg_cgroup, cfg_cgroup_cmd,
+	"cgroup PATH",
+	CGROUP_STR CGROUP_PATH_STR)
+{
+	struct osysmon_cgroup *cg;
+	cg = osysmon_cgroup_add(argv[0]);
+	if (!cg) {
+		if (osysmon_cgroup_find(argv[0]))
+			vty_out(vty, "Couldn't add cgroup, it exists%s", VTY_NEWLINE);
+		else
+			vty_out(vty, "Couldn't add cgroup, another one with the same last path "
+				"component would report under the same name%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_cgroup, cfg_no_cgroup_cmd,
+	"no cgroup PATH",
+	NO_STR CGROUP_STR CGROUP_PATH_STR)
+{
+	struct osysmon_cgroup *cg;
+	cg = osysmon_cgroup_find(argv[0]);
+	if (!cg) {
+		vty_out(vty, "Cannot find cgroup '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	osysmon_cgroup_destroy(cg);
+	return CMD_SUCCESS;
+}
+
+static void osysmon_cgroup_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_cgroup_cmd);
+	install_element(CONFIG_NODE, &cfg_no_cgroup_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+static void add_u64(struct value_node *parent, const char *name, uint64_t val, const char *unit)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%llu%s", (unsigned long long)val, unit);
+	value_node_add(parent, name, buf);
+}
+
+static void add_rate(struct value_node *parent, const char *name, uint64_t delta, double interval,
+		     const char *fmt)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), fmt, delta / interval);
+	value_node_add(parent, name, buf);
+}
+
+/* "8:0 rbytes=1459200 wbytes=314773504 rios=192 wios=353 dbytes=0 dios=0" */
+static void parse_io_stat(const char *p, struct cgroup_counters *c)
+{
+	uint64_t v;
+
+	for (; p; p = pfile_next_line(p)) {
+		if (pfile_parse_u64(pfile_find_field(p, "rbytes="), &v))
+			c->rbytes += v;
+		if (pfile_parse_u64(pfile_find_field(p, "wbytes="), &v))
+			c->wbytes += v;
+		if (pfile_parse_u64(pfile_find_field(p, "rios="), &v))
+			c->rios += v;
+		if (pfile_parse_u64(pfile_find_field(p, "wios="), &v))
+			c->wios += v;
+	}
+}
+
+static void cgroup_poll(struct osysmon_cgroup *cg, struct value_node *parent)
+{
+	const struct cgroup_counters *prev = &cg->prev;
+	struct cgroup_counters cur = {};
+	struct value_node *vn, *vn_psi, *vn_res;
+	uint64_t memory = 0;
+	bool has_full[3] = {};
+	bool has_memory, has_events, has_io, has_psi[3];
+	double interval = 0;
+	char buf[16];
+	int i;
+
+	/* cpu.stat is there even without the cpu controller enabled, it
+	 * disappears with the cgroup, e.g. when the unit is stopped */
+	if (pfile_read(cg->cpu_stat) <= 0) {
+		cg->prev.valid = false;
+		value_node_add(parent, cg->name, "<NOTFOUND>");
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &cur.ts);
+	cur.valid = true;
+	pfile_parse_u64(pfile_find_key(cg->cpu_stat->buf, "usage_usec "), &cur.usage_usec);
+	pfile_parse_u64(pfile_find_key(cg->cpu_stat->buf, "nr_throttled "), &cur.nr_throttled);
+	pfile_parse_u64(pfile_find_key(cg->cpu_stat->buf, "throttled_usec "), &cur.throttled_usec);
+
+	/* the memory and io controllers may not be enabled for this cgroup */
+	has_memory = pfile_read(cg->memory_current) > 0 &&
+		     pfile_parse_u64(cg->memory_current->buf, &memory);
+	has_events = pfile_read(cg->memory_events) > 0;
+	if (has_events) {
+		pfile_parse_u64(pfile_find_key(cg->memory_events->buf, "high "), &cur.high);
+		pfile_parse_u64(pfile_find_key(cg->memory_events->buf, "max "), &cur.max);
+		pfile_parse_u64(pfile_find_key(cg->memory_events->buf, "oom "), &cur.oom);
+		pfile_parse_u64(pfile_find_key(cg->memory_events->buf, "oom_kill "), &cur.oom_kill);
+	}
+	has_io = pfile_read(cg->io_stat) >= 0;
+	if (has_io)
+		parse_io_stat(cg->io_stat->buf, &cur);
+	for (i = 0; i < ARRAY_SIZE(cg->psi); i++) {
+		has_psi[i] = pfile_read(cg->psi[i]) > 0 &&
+			     pfile_parse_u64(pfile_find_field(pfile_find_key(cg->psi[i]->buf, "some"), "total="),
+					     &cur.psi_some[i]);
+		if (has_psi[i])
+			has_full[i] = pfile_parse_u64(pfile_find_field(pfile_find_key(cg->psi[i]->buf, "full"),
+								       "total="), &cur.psi_full[i]);
+	}
+
+	vn = value_node_add(parent, cg->name, NULL);
+	if (!vn)
+		goto out;
+	if (has_memory)
+		add_u64(vn, "memory", memory / 1024, " kB");
+
+	/* a new cgroup by the same path: its counters started again */
+	if (!prev->valid || cur.usage_usec < prev->usage_usec)
+		goto out;
+	interval = (cur.ts.tv_sec - prev->ts.tv_sec) + (cur.ts.tv_nsec - prev->ts.tv_nsec) / 1e9;
+	if (interval <= 0)
+		goto out;
+
+	add_rate(vn, "cpu", cur.usage_usec - prev->usage_usec, interval * 1e4, "%.1f%%");
+	add_u64(vn, "throttled", cur.nr_throttled - prev->nr_throttled, "");
+	add_rate(vn, "throttled-time", cur.throttled_usec - prev->throttled_usec, interval * 1e4, "%.1f%%");
+
+	/* events since the last poll: "high" is memory.high throttling, "max"
+	 * allocations failing at memory.max before reclaim succeeded */
+	if (has_events && cur.oom_kill >= prev->oom_kill) {
+		add_u64(vn, "memory-high", cur.high - prev->high, "");
+		add_u64(vn, "memory-max", cur.max - prev->max, "");
+		add_u64(vn, "oom", cur.oom - prev->oom, "");
+		add_u64(vn, "oom-kill", cur.oom_kill - prev->oom_kill, "");
+	}
+
+	if (has_io && cur.rbytes >= prev->rbytes && cur.wbytes >= prev->wbytes) {
+		add_rate(vn, "io-read", cur.rbytes - prev->rbytes, interval, "%.0f B/s");
+		add_rate(vn, "io-write", cur.wbytes - prev->wbytes, interval, "%.0f B/s");
+		add_rate(vn, "io-read-ops", cur.rios - prev->rios, interval, "%.1f/s");
+		add_rate(vn, "io-write-ops", cur.wios - prev->wios, interval, "%.1f/s");
+	}
+
+	/* share of the interval tasks of this cgroup were stalled */
+	vn_psi = NULL;
+	for (i = 0; i < ARRAY_SIZE(cg->psi); i++) {
+		if (!has_psi[i] || cur.psi_some[i] < prev->psi_some[i])
+			continue;
+		if (!vn_psi)
+			vn_psi = value_node_add(vn, "pressure", NULL);
+		vn_res = value_node_add(vn_psi, cgroup_psi_names[i], NULL);
+		snprintf(buf, sizeof(buf), "%.1f%%", (cur.psi_some[i] - prev->psi_some[i]) / (interval * 1e4));
+		value_node_add(vn_res, "some", buf);
+		if (has_full[i] && cur.psi_full[i] >= prev->psi_full[i]) {
+			snprintf(buf, sizeof(buf), "%.1f%%",
+				 (cur.psi_full[i] - prev->psi_full[i]) / (interval * 1e4));
+			value_node_add(vn_res, "full", buf);
+		}
+	}
+
+out:
+	cg->prev = cur;
+}
+
+/* called once on startup before config file parsing */
+int osysmon_cgroup_init()
+{
+	osysmon_cgroup_vty_init();
+	return 0;
+}
+
+/* called periodically */
+int osysmon_cgroup_poll(struct value_node *parent)
+{
+	struct value_node *vn_cgroup;
+	struct osysmon_cgroup *cg;
+
+	if (llist_empty(&g_oss->cgroups))
+		return 0;
+
+	vn_cgroup = value_node_add(parent, "cgroup", NULL);
+
+	llist_for_each_entry(cg, &g_oss->cgroups, list)
+		cgroup_poll(cg, vn_cgroup);
+
+	return 0;
+}
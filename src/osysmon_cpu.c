@@ -0,0 +1,309 @@
+/* Simple Osmocom System Monitor (osysmon): per-core CPU utilization and PSI */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "pfile.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+/* /proc/stat has one ~100 byte line per core, plus interrupt counters */
+#define CPU_STAT_BUF_BASE	8192
+#define CPU_STAT_BUF_PER_CPU	256
+#define CPU_PSI_BUF_SIZE	256
+
+/* one "cpu" or "cpuN" line of /proc/stat, in USER_HZ */
+struct cpu_times {
+	bool valid;
+	uint64_t user;
+	uint64_t nice;
+	uint64_t system;
+	uint64_t idle;
+	uint64_t iowait;
+	uint64_t irq;
+	uint64_t softirq;
+	uint64_t steal;
+};
+
+/* one of /proc/pressure/{cpu,memory,io} */
+struct cpu_psi {
+	const char *name;
+	struct pfile *pf;
+	bool valid;
+	/* total stall time in us */
+	uint64_t some;
+	uint64_t full;
+	struct timespec ts;
+};
+
+static struct {
+	bool enabled;
+	struct pfile *stat;
+	/* [0] is the sum over all cores, [N+1] is cpuN */
+	struct cpu_times *times;
+	unsigned int num_times;
+	struct cpu_psi psi[3];
+} cpu = {
+	.psi = {
+		{ .name = "cpu" },
+		{ .name = "memory" },
+		{ .name = "io" },
+	},
+};
+
+static void cpu_enable(void)
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+	char path[64];
+	unsigned int i;
+
+	cpu.enabled = true;
+	if (cpu.stat)
+		return;
+
+	if (ncpu < 1)
+		ncpu = 1;
+	cpu.stat = pfile_alloc(g_oss, "/proc/stat", CPU_STAT_BUF_BASE + ncpu * CPU_STAT_BUF_PER_CPU);
+	cpu.num_times = ncpu + 1;
+	cpu.times = talloc_zero_array(g_oss, struct cpu_times, cpu.num_times);
+	OSMO_ASSERT(cpu.times);
+
+	for (i = 0; i < ARRAY_SIZE(cpu.psi); i++) {
+		snprintf(path, sizeof(path), "/proc/pressure/%s", cpu.psi[i].name);
+		cpu.psi[i].pf = pfile_alloc(g_oss, path, CPU_PSI_BUF_SIZE);
+	}
+}
+
+static void cpu_disable(void)
+{
+	unsigned int i;
+
+	cpu.enabled = false;
+	TALLOC_FREE(cpu.stat);
+	TALLOC_FREE(cpu.times);
+	cpu.num_times = 0;
+	for (i = 0; i < ARRAY_SIZE(cpu.psi); i++) {
+		TALLOC_FREE(cpu.psi[i].pf);
+		cpu.psi[i].valid = false;
+	}
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define CMD_STR "Display per-core CPU utilization and pressure stall information\n"
+DEFUN(cfg_cpu, cfg_cpu_cmd,
+	"cpu",
+	CMD_STR)
+{
+	cpu_enable();
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_cpu, cfg_no_cpu_cmd,
+	"no cpu",
+	NO_STR CMD_STR)
+{
+	cpu_disable();
+	return CMD_SUCCESS;
+}
+
+static void osysmon_cpu_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_cpu_cmd);
+	install_element(CONFIG_NODE, &cfg_no_cpu_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+static void add_percent(struct value_node *parent, const char *name, uint64_t part, uint64_t total)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%.1f%%", total ? part * 100.0 / total : 0.0);
+	value_node_add(parent, name, buf);
+}
+
+/* "cpu3 1234 0 567 89012 34 0 5 0 0 0" */
+static const char *parse_cpu_times(const char *p, struct cpu_times *t)
+{
+	p = pfile_parse_u64(p, &t->user);
+	p = pfile_parse_u64(p, &t->nice);
+	p = pfile_parse_u64(p, &t->system);
+	p = pfile_parse_u64(p, &t->idle);
+	p = pfile_parse_u64(p, &t->iowait);
+	p = pfile_parse_u64(p, &t->irq);
+	p = pfile_parse_u64(p, &t->softirq);
+	p = pfile_parse_u64(p, &t->steal);
+	return p;
+}
+
+/* per-CPU iowait is documented to go backwards at times */
+static uint64_t counter_delta(uint64_t cur, uint64_t prev)
+{
+	return cur > prev ? cur - prev : 0;
+}
+
+static void cpu_publish(struct value_node *parent, const char *name,
+			const struct cpu_times *prev, const struct cpu_times *cur)
+{
+	uint64_t user, system, iowait, steal, idle, total;
+	struct value_node *vn;
+
+	/* the counters of an offlined and re-onlined core may restart */
+	if (cur->idle < prev->idle || cur->user < prev->user)
+		return;
+
+	user = counter_delta(cur->user + cur->nice, prev->user + prev->nice);
+	system = counter_delta(cur->system + cur->irq + cur->softirq, prev->system + prev->irq + prev->softirq);
+	iowait = counter_delta(cur->iowait, prev->iowait);
+	steal = counter_delta(cur->steal, prev->steal);
+	idle = counter_delta(cur->idle, prev->idle);
+	total = user + system + iowait + steal + idle;
+
+	vn = value_node_add(parent, name, NULL);
+	if (!vn)
+		return;
+	add_percent(vn, "user", user, total);
+	add_percent(vn, "system", system, total);
+	add_percent(vn, "iowait", iowait, total);
+	add_percent(vn, "steal", steal, total);
+}
+
+static void cpu_poll_stat(struct value_node *parent)
+{
+	struct cpu_times cur, *prev;
+	const char *p, *name;
+	uint64_t n;
+	unsigned int idx;
+
+	if (pfile_read(cpu.stat) <= 0)
+		return;
+
+	for (p = pfile_find_key(cpu.stat->buf, "cpu"); p; p = pfile_find_key(pfile_next_line(p), "cpu")) {
+		if (*p == ' ') {
+			idx = 0;
+			name = "total";
+		} else {
+			p = pfile_parse_u64(p, &n);
+			if (!p)
+				continue;
+			idx = n + 1;
+			name = talloc_asprintf(parent, "cpu%u", idx - 1);
+		}
+
+		memset(&cur, 0, sizeof(cur));
+		if (!parse_cpu_times(p, &cur))
+			continue;
+		cur.valid = true;
+
+		/* cores hot-plugged after we started */
+		if (idx >= cpu.num_times) {
+			cpu.times = talloc_realloc(g_oss, cpu.times, struct cpu_times, idx + 1);
+			OSMO_ASSERT(cpu.times);
+			memset(&cpu.times[cpu.num_times], 0,
+			       (idx + 1 - cpu.num_times) * sizeof(struct cpu_times));
+			cpu.num_times = idx + 1;
+		}
+
+		prev = &cpu.times[idx];
+		if (prev->valid)
+			cpu_publish(parent, name, prev, &cur);
+		*prev = cur;
+	}
+}
+
+/* "some avg10=0.00 avg60=0.00 avg300=0.00 total=12345" */
+static bool parse_psi_total(const char *buf, const char *key, uint64_t *total)
+{
+	const char *p = pfile_find_field(pfile_find_key(buf, key), "total=");
+
+	return pfile_parse_u64(p, total) != NULL;
+}
+
+/* Percentage of the time since the last poll that tasks were stalled, from the
+ * total stall time. Unlike avg10 this covers exactly our polling interval. */
+static void cpu_poll_psi(struct cpu_psi *psi, struct value_node *parent)
+{
+	uint64_t some, full = 0;
+	struct timespec ts;
+	struct value_node *vn;
+	uint64_t interval_us;
+	bool has_full;
+
+	if (pfile_read(psi->pf) <= 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (!parse_psi_total(psi->pf->buf, "some", &some))
+		return;
+	/* there is no "full" for cpu before Linux 5.13 */
+	has_full = parse_psi_total(psi->pf->buf, "full", &full);
+
+	if (psi->valid && some >= psi->some && full >= psi->full) {
+		interval_us = (ts.tv_sec - psi->ts.tv_sec) * 1000000ULL +
+			      (ts.tv_nsec - psi->ts.tv_nsec) / 1000;
+		vn = value_node_add(parent, psi->name, NULL);
+		add_percent(vn, "some", some - psi->some, interval_us);
+		if (has_full)
+			add_percent(vn, "full", full - psi->full, interval_us);
+	}
+
+	psi->some = some;
+	psi->full = full;
+	psi->ts = ts;
+	psi->valid = true;
+}
+
+/* called once on startup before config file parsing */
+int osysmon_cpu_init()
+{
+	osysmon_cpu_vty_init();
+	return 0;
+}
+
+/* called periodically */
+int osysmon_cpu_poll(struct value_node *parent)
+{
+	struct value_node *vn_cpu, *vn_psi;
+	unsigned int i;
+
+	if (!cpu.enabled)
+		return 0;
+
+	vn_cpu = value_node_add(parent, "cpu", NULL);
+	cpu_poll_stat(vn_cpu);
+
+	vn_psi = value_node_add(vn_cpu, "pressure", NULL);
+	for (i = 0; i < ARRAY_SIZE(cpu.psi); i++)
+		cpu_poll_psi(&cpu.psi[i], vn_psi);
+
+	return 0;
+}
@@ -16,9 +16,28 @@
  *  GNU General Public License for more details.
  */
 
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/inotify.h>
 #include <sys/sysinfo.h>
+#include <linux/magic.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
 
+#include <osmocom/core/select.h>
+#include <osmocom/core/utils.h>
 #include <osmocom/vty/vty.h>
 #include <osmocom/vty/command.h>
 
@@ -29,14 +48,108 @@
  * Data model
  ***********************************************************************/
 
+/* size of the per-file read buffer, i.e. the longest first line we report */
+#define FILE_BUF_SIZE 512
+/* read buffer size for parsed files: /proc/vmstat is ~5k on recent kernels */
+#define FILE_PARSE_BUF_SIZE 16384
+/* maximum number of values we publish from a parsed file */
+#define FILE_MAX_FIELDS 512
+/* maximum number of columns of a table */
+#define FILE_MAX_COLUMNS 64
+
+enum osysmon_file_parse {
+	/* publish the first line as value of the file */
+	OSYSMON_FILE_PARSE_NONE,
+	/* "key: value", "key=value" or "key value" lines, e.g. /proc/meminfo */
+	OSYSMON_FILE_PARSE_KEY_VALUE,
+	/* header row followed by data rows, e.g. /proc/net/snmp */
+	OSYSMON_FILE_PARSE_TABLE,
+};
+
+/* one value parsed from a file, pointing into the read buffer */
+struct osysmon_file_field {
+	/* row name in table mode, NULL otherwise */
+	const char *row;
+	const char *key;
+	const char *value;
+};
+
+/* check every this many polls whether the path still refers to the file we
+ * have open, so a replaced (e.g. renamed-over) file is noticed */
+#define FILE_REVALIDATE_INTERVAL 10
+
+enum osysmon_file_mode {
+	/* re-read on every poll (pseudo-filesystems, no inotify available) */
+	OSYSMON_FILE_POLL,
+	/* re-read only after inotify reported a change */
+	OSYSMON_FILE_INOTIFY,
+};
+
+static const struct value_string osysmon_file_mode_names[] = {
+	{ OSYSMON_FILE_POLL,	"poll" },
+	{ OSYSMON_FILE_INOTIFY,	"inotify" },
+	{ 0, NULL }
+};
+
 struct osysmon_file {
 	struct llist_head list;
 	struct {
 		const char *name;
 		const char *path;
+		enum osysmon_file_parse parse;
+		/* allow-list of keys to publish (sorted), all if empty */
+		char **keys;
+		unsigned int num_keys;
 	} cfg;
+	/* last path component, to match directory events against */
+	const char *base;
+	enum osysmon_file_mode mode;
+	/* inotify watches on the file itself and on its directory */
+	int file_wd;
+	int dir_wd;
+	/* contents changed since the last read, of->buf is out of date */
+	bool dirty;
+	/* needs to be re-read in the current poll cycle */
+	bool pending;
+	/* result of the last read: first line in of->buf, or -errno */
+	ssize_t len;
+	unsigned int events;
+	unsigned int reads;
+	/* kept open across polls and re-read with pread() at offset 0 */
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	/* the file doesn't support pread() (pipe, ...), re-open it every time */
+	bool no_pread;
+	unsigned int polls_since_check;
+	char *buf;
+	size_t buf_size;
+	/* values parsed from buf in key-value/table mode */
+	struct osysmon_file_field *fields;
+	unsigned int num_fields;
+	/* index of fd and buf in the io_uring registered file/buffer tables */
+	unsigned int slot;
 };
 
+static struct osmo_fd file_inotify_ofd = { .fd = -1 };
+
+/* I/O statistics of the last poll cycle */
+static struct {
+#ifdef HAVE_LIBURING
+	struct io_uring ring;
+	bool ring_init;
+	/* buffers and fds of all files are registered with the ring */
+	bool ready;
+	/* io_uring isn't available (old kernel, seccomp, ...), don't try again */
+	bool failed;
+#endif
+	unsigned int syscalls;
+	unsigned long collect_us;
+} file_io;
+
+static void file_uring_update_fd(struct osysmon_file *of);
+static void file_uring_invalidate(void);
+
 static struct osysmon_file *osysmon_file_find(const char *name)
 {
 	struct osysmon_file *of;
@@ -48,7 +161,151 @@ static struct osysmon_file *osysmon_file_find(const char *name)
 	return NULL;
 }
 
-static struct osysmon_file *osysmon_file_add(const char *name, const char *path)
+/* File systems whose contents change without inotify ever hearing about it:
+ * kernel pseudo-filesystems and network file systems */
+static bool fs_is_pseudo(unsigned long f_type)
+{
+	switch (f_type) {
+	case PROC_SUPER_MAGIC:
+	case SYSFS_MAGIC:
+	case DEBUGFS_MAGIC:
+	case SECURITYFS_MAGIC:
+	case CGROUP_SUPER_MAGIC:
+	case CGROUP2_SUPER_MAGIC:
+	case PSTOREFS_MAGIC:
+	case FUSE_SUPER_MAGIC:
+	case NFS_SUPER_MAGIC:
+	case SMB_SUPER_MAGIC:
+#ifdef TRACEFS_MAGIC
+	case TRACEFS_MAGIC:
+#endif
+#ifdef CIFS_SUPER_MAGIC
+	case CIFS_SUPER_MAGIC:
+#endif
+#ifdef EFIVARFS_MAGIC
+	case EFIVARFS_MAGIC:
+#endif
+#ifdef BPF_FS_MAGIC
+	case BPF_FS_MAGIC:
+#endif
+		return true;
+	default:
+		return false;
+	}
+}
+
+static void osysmon_file_close(struct osysmon_file *of)
+{
+	if (of->fd < 0)
+		return;
+	file_io.syscalls++;
+	close(of->fd);
+	of->fd = -1;
+	file_uring_update_fd(of);
+}
+
+/* Remove an inotify watch unless another file-watcher still uses it */
+static void file_rm_watch(struct osysmon_file *of, int *wd)
+{
+	struct osysmon_file *other;
+
+	if (*wd < 0)
+		return;
+	llist_for_each_entry(other, &g_oss->files, list) {
+		if (other == of)
+			continue;
+		if (other->file_wd == *wd || other->dir_wd == *wd) {
+			*wd = -1;
+			return;
+		}
+	}
+	inotify_rm_watch(file_inotify_ofd.fd, *wd);
+	*wd = -1;
+}
+
+/* Give up on inotify for this file and re-read it on every poll */
+static void osysmon_file_unwatch(struct osysmon_file *of)
+{
+	file_rm_watch(of, &of->file_wd);
+	file_rm_watch(of, &of->dir_wd);
+	of->mode = OSYSMON_FILE_POLL;
+	of->dirty = true;
+}
+
+static int file_inotify_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct osysmon_file *of;
+	ssize_t len;
+	char *p;
+
+	while ((len = read(ofd->fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			llist_for_each_entry(of, &g_oss->files, list) {
+				if (of->mode != OSYSMON_FILE_INOTIFY)
+					continue;
+				if (ev->mask & IN_Q_OVERFLOW) {
+					/* events were lost, re-read everything */
+					of->dirty = true;
+				} else if (ev->wd == of->file_wd) {
+					of->events++;
+					of->dirty = true;
+					/* the path no longer refers to the file we have open */
+					if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF))
+						osysmon_file_close(of);
+					if (ev->mask & IN_IGNORED)
+						of->file_wd = -1;
+				} else if (ev->wd == of->dir_wd) {
+					if (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF | IN_IGNORED)) {
+						/* the directory is gone, we'd miss the file re-appearing */
+						osysmon_file_unwatch(of);
+					} else if (ev->len && !strcmp(ev->name, of->base)) {
+						/* created, deleted or renamed over */
+						of->events++;
+						of->dirty = true;
+						osysmon_file_close(of);
+					}
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/* Set up a watch on the directory of the file. The file itself is watched
+ * whenever it is (re-)opened, as it may not exist yet. */
+static void osysmon_file_watch(struct osysmon_file *of)
+{
+	struct statfs sfs;
+	char *dir, *dname;
+
+	of->mode = OSYSMON_FILE_POLL;
+
+	if (file_inotify_ofd.fd < 0) {
+		file_inotify_ofd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (file_inotify_ofd.fd < 0)
+			return;
+		file_inotify_ofd.when = BSC_FD_READ;
+		file_inotify_ofd.cb = file_inotify_cb;
+		osmo_fd_register(&file_inotify_ofd);
+	}
+
+	dir = talloc_strdup(of, of->cfg.path);
+	dname = dirname(dir);
+	if (statfs(dname, &sfs) == 0 && !fs_is_pseudo(sfs.f_type)) {
+		of->dir_wd = inotify_add_watch(file_inotify_ofd.fd, dname,
+					       IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+					       IN_MOVE_SELF | IN_DELETE_SELF);
+		if (of->dir_wd >= 0)
+			of->mode = OSYSMON_FILE_INOTIFY;
+	}
+	talloc_free(dir);
+}
+
+static struct osysmon_file *osysmon_file_add(const char *name, const char *path,
+					     enum osysmon_file_parse parse)
 {
 	struct osysmon_file *of;
 
@@ -59,37 +316,519 @@ static struct osysmon_file *osysmon_file_add(const char *name, const char *path)
 	OSMO_ASSERT(of);
 	of->cfg.name = talloc_strdup(of, name);
 	of->cfg.path = talloc_strdup(of, path);
+	of->base = strrchr(of->cfg.path, '/');
+	of->base = of->base ? of->base + 1 : of->cfg.path;
+	of->fd = -1;
+	of->file_wd = -1;
+	of->dir_wd = -1;
+	of->dirty = true;
+	of->cfg.parse = parse;
+	if (parse == OSYSMON_FILE_PARSE_NONE) {
+		of->buf_size = FILE_BUF_SIZE;
+	} else {
+		of->buf_size = FILE_PARSE_BUF_SIZE;
+		of->fields = talloc_array(of, struct osysmon_file_field, FILE_MAX_FIELDS);
+		OSMO_ASSERT(of->fields);
+	}
+	of->buf = talloc_size(of, of->buf_size);
+	OSMO_ASSERT(of->buf);
+	osysmon_file_watch(of);
 	llist_add_tail(&of->list, &g_oss->files);
+	file_uring_invalidate();
 	return of;
 }
 
+static int osysmon_file_open(struct osysmon_file *of)
+{
+	struct statfs sfs;
+	struct stat st;
+
+	/* watch before opening, so no modification in between goes unnoticed */
+	if (of->mode == OSYSMON_FILE_INOTIFY) {
+		file_io.syscalls++;
+		of->file_wd = inotify_add_watch(file_inotify_ofd.fd, of->cfg.path,
+						IN_MODIFY | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+	}
+
+	/* open() and fstat() */
+	file_io.syscalls += 2;
+	of->fd = open(of->cfg.path, O_RDONLY | O_CLOEXEC);
+	if (of->fd < 0)
+		return -errno;
+	file_uring_update_fd(of);
+	if (fstat(of->fd, &st) == 0) {
+		of->dev = st.st_dev;
+		of->ino = st.st_ino;
+	} else
+		st.st_mode = 0;
+	of->polls_since_check = 0;
+
+	/* e.g. a symlink from a regular directory into /sys, or a fifo */
+	if (of->mode == OSYSMON_FILE_INOTIFY &&
+	    (!S_ISREG(st.st_mode) || fstatfs(of->fd, &sfs) < 0 || fs_is_pseudo(sfs.f_type)))
+		osysmon_file_unwatch(of);
+	return 0;
+}
+
 static void osysmon_file_destroy(struct osysmon_file *of)
 {
+	osysmon_file_close(of);
 	llist_del(&of->list);
+	file_rm_watch(of, &of->file_wd);
+	file_rm_watch(of, &of->dir_wd);
+	file_uring_invalidate();
 	talloc_free(of);
 }
 
-static void osysmon_file_read(struct osysmon_file *of, struct value_node *parent)
+/* Has the path been removed or replaced by a different file since we opened it? */
+static bool osysmon_file_replaced(struct osysmon_file *of)
 {
-	char buf[512];
-	char *s, *nl;
-	FILE *f;
+	struct stat st;
 
-	f = fopen(of->cfg.path, "r");
-	if (!f) {
-		value_node_add(parent, of->cfg.name, "<NOTFOUND>");
+	if (++of->polls_since_check < FILE_REVALIDATE_INTERVAL)
+		return false;
+	of->polls_since_check = 0;
+
+	file_io.syscalls++;
+	if (stat(of->cfg.path, &st) < 0)
+		return true;
+	return st.st_dev != of->dev || st.st_ino != of->ino;
+}
+
+/* Make sure of->fd refers to the file at the configured path */
+static int osysmon_file_prepare(struct osysmon_file *of)
+{
+	/* in inotify mode, directory events tell us about replacement */
+	if (of->fd >= 0 && (of->no_pread ||
+			    (of->mode == OSYSMON_FILE_POLL && osysmon_file_replaced(of))))
+		osysmon_file_close(of);
+
+	if (of->fd < 0 && osysmon_file_open(of) < 0)
+		return -errno;
+	return 0;
+}
+
+/* Read the file contents into of->buf with a single pread() on the cached fd.
+ * Returns the number of bytes read, or a negative value on error. */
+static ssize_t osysmon_file_pread(struct osysmon_file *of)
+{
+	ssize_t rc;
+
+	rc = osysmon_file_prepare(of);
+	if (rc < 0)
+		return rc;
+
+	file_io.syscalls++;
+	if (of->no_pread)
+		return read(of->fd, of->buf, of->buf_size - 1);
+
+	rc = pread(of->fd, of->buf, of->buf_size - 1, 0);
+	if (rc >= 0)
+		return rc;
+
+	file_io.syscalls++;
+	switch (errno) {
+	case ESPIPE:
+		of->no_pread = true;
+		return read(of->fd, of->buf, of->buf_size - 1);
+	case ESTALE:
+	case ENOENT:
+	case ENODEV:
+		/* the file went away underneath us, try to open it again */
+		osysmon_file_close(of);
+		if (osysmon_file_open(of) < 0)
+			return -errno;
+		return pread(of->fd, of->buf, of->buf_size - 1, 0);
+	default:
+		return -errno;
+	}
+}
+
+static int cmp_str(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* compare a key from the allow-list against "row/key", or "key" if there is no row */
+static int cmp_key(const void *a, const void *b)
+{
+	const char *k = *(const char **)b;
+	const struct osysmon_file_field *f = a;
+	size_t rlen;
+	int rc;
+
+	if (f->row) {
+		rlen = strlen(f->row);
+		rc = strncmp(f->row, k, rlen);
+		if (rc)
+			return rc;
+		if (k[rlen] != '/')
+			return '/' - (unsigned char)k[rlen];
+		k += rlen + 1;
+	}
+	return strcmp(f->key, k);
+}
+
+static bool osysmon_file_key_wanted(const struct osysmon_file *of, const struct osysmon_file_field *f)
+{
+	if (!of->cfg.num_keys)
+		return true;
+	if (bsearch(f, of->cfg.keys, of->cfg.num_keys, sizeof(char *), cmp_key))
+		return true;
+	/* in table mode, the row name selects the entire row */
+	return f->row && bsearch(&f->row, of->cfg.keys, of->cfg.num_keys, sizeof(char *), cmp_str);
+}
+
+static void osysmon_file_add_field(struct osysmon_file *of, const char *row,
+				   const char *key, const char *value)
+{
+	struct osysmon_file_field *f;
+
+	if (of->num_fields >= FILE_MAX_FIELDS)
 		return;
+	f = &of->fields[of->num_fields];
+	f->row = row;
+	f->key = key;
+	f->value = value;
+	if (*key && osysmon_file_key_wanted(of, f))
+		of->num_fields++;
+}
+
+/* Cut the next line out of the buffer, NUL-terminating it in place */
+static char *next_line(char **pos)
+{
+	char *line = *pos, *nl;
+
+	if (!**pos)
+		return NULL;
+	nl = strchr(line, '\n');
+	if (nl) {
+		*nl = '\0';
+		*pos = nl + 1;
+	} else
+		*pos = line + strlen(line);
+	return line;
+}
+
+/* Cut the next whitespace-separated token out of a line, NUL-terminating it in place */
+static char *next_token(char **pos)
+{
+	char *tok = *pos + strspn(*pos, " \t");
+
+	if (!*tok)
+		return NULL;
+	*pos = tok + strcspn(tok, " \t");
+	if (**pos)
+		*(*pos)++ = '\0';
+	return tok;
+}
+
+static char *strip_colon(char *tok)
+{
+	size_t len = strlen(tok);
+	if (len && tok[len-1] == ':')
+		tok[len-1] = '\0';
+	return tok;
+}
+
+/* "MemAvailable:   123456 kB", "key=value" or "nr_free_pages 1234" */
+static void parse_key_value(struct osysmon_file *of, char *pos)
+{
+	char *line, *key, *value, *end;
+
+	while ((line = next_line(&pos))) {
+		key = line + strspn(line, " \t");
+		value = key + strcspn(key, ":= \t");
+		if (*value)
+			*value++ = '\0';
+		value += strspn(value, ":= \t");
+		end = value + strlen(value);
+		while (end > value && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+			*--end = '\0';
+		osysmon_file_add_field(of, NULL, key, value);
 	}
-	s = fgets(buf, sizeof(buf), f);
-	fclose(f);
-	if (s == NULL) {
+}
+
+/* A header row naming the columns, followed by data rows whose first column
+ * names the row. If a row starts with the same name as the header row, it is
+ * the only data row for that header and the next row is a new header:
+ *   Udp: InDatagrams NoPorts InErrors ...
+ *   Udp: 1234 5 0 ... */
+static void parse_table(struct osysmon_file *of, char *pos)
+{
+	const char *hdr[FILE_MAX_COLUMNS];
+	unsigned int num_hdr = 0, i;
+	char *line, *row, *tok;
+
+	while ((line = next_line(&pos))) {
+		row = next_token(&line);
+		if (!row)
+			continue;
+		row = strip_colon(row);
+		if (!num_hdr) {
+			hdr[num_hdr++] = row;
+			while (num_hdr < FILE_MAX_COLUMNS && (tok = next_token(&line)))
+				hdr[num_hdr++] = tok;
+			continue;
+		}
+		for (i = 1; i < num_hdr && (tok = next_token(&line)); i++)
+			osysmon_file_add_field(of, row, hdr[i], tok);
+		if (!strcmp(row, hdr[0]))
+			num_hdr = 0;
+	}
+}
+
+static void osysmon_file_parse(struct osysmon_file *of)
+{
+	char *end;
+
+	of->num_fields = 0;
+	/* don't publish the fragment of a line cut off at the end of the buffer */
+	if (of->len == of->buf_size - 1 && of->buf[of->len - 1] != '\n') {
+		end = strrchr(of->buf, '\n');
+		if (end)
+			end[1] = '\0';
+	}
+
+	switch (of->cfg.parse) {
+	case OSYSMON_FILE_PARSE_KEY_VALUE:
+		parse_key_value(of, of->buf);
+		break;
+	case OSYSMON_FILE_PARSE_TABLE:
+		parse_table(of, of->buf);
+		break;
+	default:
+		break;
+	}
+}
+
+static void osysmon_file_publish(struct osysmon_file *of, struct value_node *parent)
+{
+	struct value_node *vn_file, *vn_row;
+	const struct osysmon_file_field *f;
+	unsigned int i;
+
+	vn_file = value_node_add(parent, of->cfg.name, NULL);
+	if (!vn_file)
+		return;
+
+	for (i = 0; i < of->num_fields; i++) {
+		f = &of->fields[i];
+		vn_row = f->row ? value_node_find_or_add(vn_file, f->row) : vn_file;
+		if (vn_row)
+			value_node_add(vn_row, f->key, f->value);
+	}
+}
+
+/* Process the result of a read into of->buf */
+static void osysmon_file_update(struct osysmon_file *of, ssize_t len)
+{
+	char *nl;
+
+	of->len = len;
+	of->pending = false;
+	if (len < 0) {
+		osysmon_file_close(of);
+	} else if (of->cfg.parse != OSYSMON_FILE_PARSE_NONE) {
+		of->buf[len] = '\0';
+		osysmon_file_parse(of);
+	} else {
+		of->buf[len] = '\0';
+		/* only the first line is reported */
+		nl = strchr(of->buf, '\n');
+		if (nl)
+			*nl = '\0';
+	}
+}
+
+static void osysmon_file_read(struct osysmon_file *of, struct value_node *parent)
+{
+	if (of->len < 0)
+		value_node_add(parent, of->cfg.name, "<NOTFOUND>");
+	else if (of->len == 0)
 		value_node_add(parent, of->cfg.name, "<EMPTY>");
+	else if (of->cfg.parse != OSYSMON_FILE_PARSE_NONE)
+		osysmon_file_publish(of, parent);
+	else
+		value_node_add(parent, of->cfg.name, of->buf);
+}
+
+static void osysmon_file_stats(struct osysmon_file *of, struct value_node *parent)
+{
+	struct value_node *vn = value_node_add(parent, of->cfg.name, NULL);
+	char buf[32];
+
+	value_node_add(vn, "mode", get_value_string(osysmon_file_mode_names, of->mode));
+	snprintf(buf, sizeof(buf), "%u", of->events);
+	value_node_add(vn, "events", buf);
+	snprintf(buf, sizeof(buf), "%u", of->reads);
+	value_node_add(vn, "reads", buf);
+}
+
+/***********************************************************************
+ * io_uring
+ ***********************************************************************/
+
+#ifdef HAVE_LIBURING
+/* Size the ring for all files and register their buffers and fds with it,
+ * so the reads don't need to look up the fd or map the buffer each time */
+static bool file_uring_setup(void)
+{
+	struct osysmon_file *of;
+	struct iovec *iov;
+	unsigned int n = 0;
+	int *fds;
+	int rc;
+
+	if (file_io.failed)
+		return false;
+	if (file_io.ready)
+		return true;
+
+	llist_for_each_entry(of, &g_oss->files, list)
+		of->slot = n++;
+
+	if (file_io.ring_init)
+		io_uring_queue_exit(&file_io.ring);
+	rc = io_uring_queue_init(n, &file_io.ring, 0);
+	file_io.ring_init = rc == 0;
+	if (rc < 0)
+		goto fail;
+
+	iov = talloc_array(NULL, struct iovec, n);
+	fds = talloc_array(NULL, int, n);
+	OSMO_ASSERT(iov && fds);
+	llist_for_each_entry(of, &g_oss->files, list) {
+		iov[of->slot].iov_base = of->buf;
+		iov[of->slot].iov_len = of->buf_size;
+		fds[of->slot] = of->fd;
+	}
+	rc = io_uring_register_buffers(&file_io.ring, iov, n);
+	if (rc == 0)
+		rc = io_uring_register_files(&file_io.ring, fds, n);
+	talloc_free(iov);
+	talloc_free(fds);
+	if (rc < 0)
+		goto fail;
+
+	file_io.ready = true;
+	return true;
+
+fail:
+	if (file_io.ring_init)
+		io_uring_queue_exit(&file_io.ring);
+	file_io.ring_init = false;
+	file_io.failed = true;
+	return false;
+}
+
+/* Submit the reads of all pending files as one batch and harvest the results.
+ * Files that can't be read this way are left pending for the pread() path. */
+static void file_uring_collect(void)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	struct osysmon_file *of;
+	unsigned int queued = 0;
+	int rc;
+
+	if (!file_uring_setup())
 		return;
+
+	llist_for_each_entry(of, &g_oss->files, list) {
+		if (!of->pending || of->no_pread)
+			continue;
+		rc = osysmon_file_prepare(of);
+		if (rc < 0) {
+			osysmon_file_update(of, rc);
+			continue;
+		}
+		if (!file_io.ready)
+			continue;
+		sqe = io_uring_get_sqe(&file_io.ring);
+		if (!sqe)
+			break;
+		io_uring_prep_read_fixed(sqe, of->slot, of->buf, of->buf_size - 1, 0, of->slot);
+		sqe->flags |= IOSQE_FIXED_FILE;
+		io_uring_sqe_set_data(sqe, of);
+		queued++;
+	}
+	if (!queued)
+		return;
+
+	file_io.syscalls++;
+	rc = io_uring_submit_and_wait(&file_io.ring, queued);
+	if (rc < 0) {
+		/* leave the remaining files to the pread() path from now on */
+		io_uring_queue_exit(&file_io.ring);
+		file_io.ring_init = false;
+		file_io.ready = false;
+		file_io.failed = true;
+		return;
+	}
+
+	while (queued && io_uring_peek_cqe(&file_io.ring, &cqe) == 0) {
+		of = io_uring_cqe_get_data(cqe);
+		/* on error, pread() sorts out re-opening */
+		if (cqe->res >= 0)
+			osysmon_file_update(of, cqe->res);
+		io_uring_cqe_seen(&file_io.ring, cqe);
+		queued--;
+	}
+}
+
+/* Keep the registered file table in sync when a file is (re-)opened or closed */
+static void file_uring_update_fd(struct osysmon_file *of)
+{
+	if (!file_io.ready)
+		return;
+	file_io.syscalls++;
+	if (io_uring_register_files_update(&file_io.ring, of->slot, &of->fd, 1) < 0)
+		file_io.ready = false;
+}
+
+/* The set of files changed, re-register at the next poll */
+static void file_uring_invalidate(void)
+{
+	file_io.ready = false;
+}
+
+static const char *file_io_backend(void)
+{
+	return file_io.ready ? "io_uring" : "pread";
+}
+#else
+static void file_uring_update_fd(struct osysmon_file *of) {}
+static void file_uring_invalidate(void) {}
+
+static const char *file_io_backend(void)
+{
+	return "pread";
+}
+#endif
+
+/* Re-read all files whose cached contents are out of date */
+static void osysmon_file_collect(void)
+{
+	struct osysmon_file *of;
+
+	llist_for_each_entry(of, &g_oss->files, list) {
+		/* serve the cached value until inotify reports a change */
+		of->pending = of->mode == OSYSMON_FILE_POLL || of->dirty;
+		if (of->pending) {
+			of->dirty = false;
+			of->reads++;
+		}
+	}
+
+#ifdef HAVE_LIBURING
+	file_uring_collect();
+#endif
+
+	llist_for_each_entry(of, &g_oss->files, list) {
+		if (of->pending)
+			osysmon_file_update(of, osysmon_file_pread(of));
 	}
-	buf[sizeof(buf)-1] = '\0';
-	while ((nl = strrchr(buf, '\n')))
-		*nl = '\0';
-	value_node_add(parent, of->cfg.name, buf);
 }
 
 /***********************************************************************
@@ -102,14 +841,55 @@ DEFUN(cfg_file, cfg_file_cmd,
 	FILE_STR "Name of this file-watcher\n" "Path of file in filesystem\n")
 {
 	struct osysmon_file *of;
-	of = osysmon_file_add(argv[0], argv[1]);
+	of = osysmon_file_add(argv[0], argv[1], OSYSMON_FILE_PARSE_NONE);
+	if (!of) {
+		vty_out(vty, "Couldn't add file-watcher, maybe it exists?%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+#define FILE_PARSE_STR "Parse the file into one value per key\n" \
+	"Lines of 'key: value', 'key=value' or 'key value'\n" \
+	"Header row naming the columns, followed by data rows\n"
+
+DEFUN(cfg_file_parse_keys, cfg_file_parse_keys_cmd,
+	"file NAME PATH parse (key-value|table) .KEYS",
+	FILE_STR "Name of this file-watcher\n" "Path of file in filesystem\n"
+	FILE_PARSE_STR
+	"Only publish these keys ('ROW/COLUMN' or 'ROW' in table mode)\n")
+{
+	enum osysmon_file_parse parse;
+	struct osysmon_file *of;
+	int i;
+
+	if (!strcmp(argv[2], "table"))
+		parse = OSYSMON_FILE_PARSE_TABLE;
+	else
+		parse = OSYSMON_FILE_PARSE_KEY_VALUE;
+
+	of = osysmon_file_add(argv[0], argv[1], parse);
 	if (!of) {
 		vty_out(vty, "Couldn't add file-watcher, maybe it exists?%s", VTY_NEWLINE);
 		return CMD_WARNING;
 	}
+
+	/* sorted, so matching a key is a binary search */
+	if (argc > 3) {
+		of->cfg.keys = talloc_array(of, char *, argc - 3);
+		OSMO_ASSERT(of->cfg.keys);
+		for (i = 3; i < argc; i++)
+			of->cfg.keys[of->cfg.num_keys++] = talloc_strdup(of, argv[i]);
+		qsort(of->cfg.keys, of->cfg.num_keys, sizeof(char *), cmp_str);
+	}
 	return CMD_SUCCESS;
 }
 
+ALIAS(cfg_file_parse_keys, cfg_file_parse_cmd,
+	"file NAME PATH parse (key-value|table)",
+	FILE_STR "Name of this file-watcher\n" "Path of file in filesystem\n"
+	FILE_PARSE_STR)
+
 DEFUN(cfg_no_file, cfg_no_file_cmd,
 	"no file NAME",
 	NO_STR FILE_STR "Name of this file-watcher\n")
@@ -128,6 +908,8 @@ DEFUN(cfg_no_file, cfg_no_file_cmd,
 static void osysmon_file_vty_init(void)
 {
 	install_element(CONFIG_NODE, &cfg_file_cmd);
+	install_element(CONFIG_NODE, &cfg_file_parse_cmd);
+	install_element(CONFIG_NODE, &cfg_file_parse_keys_cmd);
 	install_element(CONFIG_NODE, &cfg_no_file_cmd);
 }
 
@@ -145,16 +927,34 @@ int osysmon_file_init()
 /* called periodically */
 int osysmon_file_poll(struct value_node *parent)
 {
-	struct value_node *vn_file;
+	struct value_node *vn_file, *vn_stats, *vn_files;
 	struct osysmon_file *of;
+	struct timespec start, end;
+	char buf[32];
 
 	if (llist_empty(&g_oss->files))
 		return 0;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	file_io.syscalls = 0;
+	osysmon_file_collect();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	file_io.collect_us = (end.tv_sec - start.tv_sec) * 1000000 +
+			     (end.tv_nsec - start.tv_nsec) / 1000;
+
 	vn_file = value_node_add(parent, "file", NULL);
+	vn_stats = value_node_add(parent, "file-stats", NULL);
+	value_node_add(vn_stats, "backend", file_io_backend());
+	snprintf(buf, sizeof(buf), "%u", file_io.syscalls);
+	value_node_add(vn_stats, "syscalls", buf);
+	snprintf(buf, sizeof(buf), "%lu us", file_io.collect_us);
+	value_node_add(vn_stats, "collect-time", buf);
+	vn_files = value_node_add(vn_stats, "files", NULL);
 
-	llist_for_each_entry(of, &g_oss->files, list)
+	llist_for_each_entry(of, &g_oss->files, list) {
 		osysmon_file_read(of, vn_file);
+		osysmon_file_stats(of, vn_files);
+	}
 
 	return 0;
 }
@@ -0,0 +1,639 @@
+/* Simple Osmocom System Monitor (osysmon): in-memory history of values */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Every numeric leaf gets a ring buffer of its last N samples. Rings of
+ * leaves that vanished (e.g. a crashed process) are kept, as they're the
+ * most interesting ones after an outage, until their memory is needed for
+ * new leaves.
+ *
+ * Optionally, each ring also has rollups of 1 minute and 1 hour buckets
+ * (min/max/sum/count/last), each tier a ring of its own length. They're
+ * updated with every sample in constant time, and answer queries over long
+ * windows from a few buckets. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "leaf_table.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define HISTORY_DEFAULT_MAX_MEMORY	1024
+#define HISTORY_SPARKLINE_WIDTH		60
+/* longer windows are answered from the rollups, if there are any */
+#define HISTORY_RAW_MAX_WINDOW		900
+
+struct history_sample {
+	/* CLOCK_REALTIME seconds */
+	uint32_t time;
+	double value;
+};
+
+enum history_tier {
+	HISTORY_MINUTE,
+	HISTORY_HOUR,
+	_NUM_HISTORY_TIERS
+};
+
+static const struct value_string history_tier_names[] = {
+	{ HISTORY_MINUTE, "minute" },
+	{ HISTORY_HOUR, "hour" },
+	{ 0, NULL }
+};
+
+static const unsigned int history_tier_secs[] = {
+	[HISTORY_MINUTE] = 60,
+	[HISTORY_HOUR] = 3600,
+};
+
+struct history_bucket {
+	/* CLOCK_REALTIME seconds, a multiple of the tier's bucket length */
+	uint32_t start;
+	uint32_t count;
+	double min;
+	double max;
+	double last;
+	double sum;
+};
+
+struct history_rollup {
+	/* in the allocation of the ring, after the samples */
+	struct history_bucket *buckets;
+	unsigned int size;
+	unsigned int head;
+	unsigned int count;
+};
+
+struct history_ring {
+	/* in history.rings or history.vanished */
+	struct llist_head list;
+	char *path;
+	/* NULL once the leaf vanished */
+	struct leaf *leaf;
+	unsigned int size;
+	unsigned int head;
+	unsigned int count;
+	struct history_rollup rollups[_NUM_HISTORY_TIERS];
+	struct history_sample samples[0];
+};
+
+static struct {
+	/* samples per leaf, 0 if disabled */
+	unsigned int samples;
+	/* buckets per leaf and tier, 0 if disabled */
+	unsigned int buckets[_NUM_HISTORY_TIERS];
+	/* in bytes */
+	size_t max_memory;
+	size_t memory;
+	/* numeric leaves without history, for lack of memory */
+	unsigned int dropped;
+	struct llist_head rings;
+	/* rings of vanished leaves, in the order they vanished */
+	struct llist_head vanished;
+} history = {
+	.max_memory = HISTORY_DEFAULT_MAX_MEMORY * 1024,
+	.rings = LLIST_HEAD_INIT(history.rings),
+	.vanished = LLIST_HEAD_INIT(history.vanished),
+};
+
+/* marks leaves we couldn't afford a ring for, so we don't retry every tick */
+static struct history_ring history_none;
+
+static size_t ring_memory(unsigned int samples)
+{
+	size_t mem = sizeof(struct history_ring) + samples * sizeof(struct history_sample);
+	int t;
+
+	for (t = 0; t < _NUM_HISTORY_TIERS; t++)
+		mem += history.buckets[t] * sizeof(struct history_bucket);
+	return mem;
+}
+
+static void ring_free(struct history_ring *ring)
+{
+	if (ring->leaf)
+		ring->leaf->history = NULL;
+	llist_del(&ring->list);
+	history.memory -= ring_memory(ring->size);
+	talloc_free(ring);
+}
+
+static void history_reset(void)
+{
+	struct history_ring *ring, *ring2;
+	struct leaf *l;
+
+	llist_for_each_entry_safe(ring, ring2, &history.rings, list)
+		ring_free(ring);
+	llist_for_each_entry_safe(ring, ring2, &history.vanished, list)
+		ring_free(ring);
+	if (g_oss->leaves) {
+		llist_for_each_entry(l, &g_oss->leaves->leaves, list)
+			l->history = NULL;
+	}
+	history.dropped = 0;
+}
+
+static struct history_ring *ring_alloc(struct leaf *l)
+{
+	size_t mem = ring_memory(history.samples);
+	struct history_ring *ring, *ring2;
+	struct history_bucket *buckets;
+	int t;
+
+	/* the leaf is back, e.g. a restarted process */
+	llist_for_each_entry(ring, &history.vanished, list) {
+		if (!strcmp(ring->path, l->path)) {
+			ring->leaf = l;
+			llist_move_tail(&ring->list, &history.rings);
+			return ring;
+		}
+	}
+
+	/* make room by dropping the history of the leaves which vanished
+	 * first */
+	llist_for_each_entry_safe(ring, ring2, &history.vanished, list) {
+		if (history.memory + mem <= history.max_memory)
+			break;
+		ring_free(ring);
+	}
+	if (history.memory + mem > history.max_memory) {
+		history.dropped++;
+		return &history_none;
+	}
+
+	ring = talloc_zero_size(g_oss, mem);
+	OSMO_ASSERT(ring);
+	ring->path = talloc_strdup(ring, l->path);
+	ring->leaf = l;
+	ring->size = history.samples;
+	buckets = (struct history_bucket *)&ring->samples[ring->size];
+	for (t = 0; t < _NUM_HISTORY_TIERS; t++) {
+		ring->rollups[t].buckets = buckets;
+		ring->rollups[t].size = history.buckets[t];
+		buckets += history.buckets[t];
+	}
+	llist_add_tail(&ring->list, &history.rings);
+	history.memory += mem;
+	return ring;
+}
+
+static struct history_ring *ring_find(const char *path)
+{
+	struct history_ring *ring;
+	struct leaf *l;
+
+	l = g_oss->leaves ? leaf_table_find(g_oss->leaves, path) : NULL;
+	if (l && l->history && l->history != &history_none)
+		return l->history;
+	llist_for_each_entry(ring, &history.vanished, list) {
+		if (!strcmp(ring->path, path))
+			return ring;
+	}
+	return NULL;
+}
+
+/* i-th most recent sample */
+static const struct history_sample *ring_get(const struct history_ring *ring, unsigned int i)
+{
+	return &ring->samples[(ring->head + ring->size - 1 - i) % ring->size];
+}
+
+/* i-th most recent bucket */
+static struct history_bucket *rollup_get(const struct history_rollup *r, unsigned int i)
+{
+	return &r->buckets[(r->head + r->size - 1 - i) % r->size];
+}
+
+static void rollup_add(struct history_rollup *r, enum history_tier tier, uint32_t time, double val)
+{
+	uint32_t start = time - time % history_tier_secs[tier];
+	struct history_bucket *b;
+
+	if (!r->size)
+		return;
+	b = rollup_get(r, 0);
+	if (!r->count || b->start != start) {
+		b = &r->buckets[r->head];
+		r->head = (r->head + 1) % r->size;
+		if (r->count < r->size)
+			r->count++;
+		b->start = start;
+		b->count = 0;
+		b->min = b->max = val;
+		b->sum = 0;
+	}
+	b->min = OSMO_MIN(b->min, val);
+	b->max = OSMO_MAX(b->max, val);
+	b->sum += val;
+	b->last = val;
+	b->count++;
+}
+
+struct history_agg {
+	double min;
+	double max;
+	double sum;
+	unsigned int count;
+};
+
+static void agg_add(struct history_agg *agg, double min, double max, double sum, unsigned int count)
+{
+	if (!agg->count) {
+		agg->min = min;
+		agg->max = max;
+	}
+	agg->min = OSMO_MIN(agg->min, min);
+	agg->max = OSMO_MAX(agg->max, max);
+	agg->sum += sum;
+	agg->count += count;
+}
+
+/* Oldest time covered by the raw samples (tier -1) or a tier */
+static bool source_oldest(const struct history_ring *ring, int tier, uint32_t *oldest)
+{
+	const struct history_rollup *r;
+
+	if (tier < 0) {
+		*oldest = ring_get(ring, ring->count - 1)->time;
+		return true;
+	}
+	r = &ring->rollups[tier];
+	if (!r->count)
+		return false;
+	*oldest = rollup_get(r, r->count - 1)->start;
+	return true;
+}
+
+/* Aggregate the window of secs up to now from the raw samples, if it's a
+ * short window, or else the finest tier reaching back far enough. Returns
+ * the source (tier, -1 for the raw samples); *complete is false if none
+ * reaches back far enough, the one reaching back furthest is used then. */
+static int history_aggregate(const struct history_ring *ring, uint32_t now, unsigned int secs,
+			     struct history_agg *agg, bool *complete)
+{
+	uint32_t since = now - secs, oldest, furthest = UINT32_MAX;
+	const struct history_sample *s;
+	const struct history_bucket *b;
+	const struct history_rollup *r;
+	int tier, src = -1, rollups = 0;
+	unsigned int i;
+
+	for (tier = 0; tier < _NUM_HISTORY_TIERS; tier++)
+		rollups += !!ring->rollups[tier].count;
+
+	*complete = false;
+	for (tier = -1; tier < _NUM_HISTORY_TIERS; tier++) {
+		if (tier < 0 && secs > HISTORY_RAW_MAX_WINDOW && rollups)
+			continue;
+		if (!source_oldest(ring, tier, &oldest))
+			continue;
+		if (oldest <= since) {
+			src = tier;
+			*complete = true;
+			break;
+		}
+		if (oldest < furthest) {
+			furthest = oldest;
+			src = tier;
+		}
+	}
+
+	memset(agg, 0, sizeof(*agg));
+	if (src < 0) {
+		for (i = 0; i < ring->count; i++) {
+			s = ring_get(ring, i);
+			if (now - s->time >= secs)
+				break;
+			agg_add(agg, s->value, s->value, s->value, 1);
+		}
+		return src;
+	}
+
+	/* in whole buckets, the oldest one may reach back further */
+	r = &ring->rollups[src];
+	for (i = 0; i < r->count; i++) {
+		b = rollup_get(r, i);
+		if (b->start + history_tier_secs[src] <= since)
+			break;
+		agg_add(agg, b->min, b->max, b->sum, b->count);
+	}
+	return src;
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define HISTORY_STR "Record the recent values of all numeric leaves\n"
+DEFUN(cfg_history, cfg_history_cmd,
+	"history <2-86400>",
+	HISTORY_STR "Number of samples (ticks) to keep per leaf\n")
+{
+	unsigned int samples = atoi(argv[0]);
+
+	if (samples != history.samples) {
+		history_reset();
+		history.samples = samples;
+	}
+	if (!g_oss->leaves)
+		g_oss->leaves = leaf_table_alloc(g_oss);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_history, cfg_no_history_cmd,
+	"no history",
+	NO_STR HISTORY_STR)
+{
+	history_reset();
+	history.samples = 0;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_history_max_memory, cfg_history_max_memory_cmd,
+	"history-max-memory <16-1048576>",
+	"Limit the memory used for the history of all leaves together\n"
+	"Limit in KiB (default 1024)\n")
+{
+	history_reset();
+	history.max_memory = atoi(argv[0]) * 1024;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_history_rollup, cfg_history_rollup_cmd,
+	"history-rollup (minute|hour) <0-8760>",
+	"Keep rollups (min/max/sum/count/last) of all leaves with history\n"
+	"Rollups per 1 minute\n" "Rollups per 1 hour\n"
+	"Number of buckets to keep per leaf, 0 to disable (default)\n")
+{
+	int tier = get_string_value(history_tier_names, argv[0]);
+	unsigned int buckets = atoi(argv[1]);
+
+	if (buckets != history.buckets[tier]) {
+		history_reset();
+		history.buckets[tier] = buckets;
+	}
+	return CMD_SUCCESS;
+}
+
+#define SHOW_HISTORY_STR SHOW_STR "Recent values of a leaf\n" \
+	"Path of the leaf, e.g. netdev/eth0/rx-bytes\n"
+
+static struct history_ring *vty_ring_find(struct vty *vty, const char *path)
+{
+	struct history_ring *ring = ring_find(path);
+
+	if (!ring || !ring->count) {
+		vty_out(vty, "%% No history for '%s'%s", path, VTY_NEWLINE);
+		return NULL;
+	}
+	return ring;
+}
+
+DEFUN(show_history_overview, show_history_overview_cmd,
+	"show history",
+	SHOW_STR "Memory usage of the history\n")
+{
+	struct history_ring *ring;
+	unsigned int active = 0, vanished = 0;
+
+	if (!history.samples) {
+		vty_out(vty, "History is disabled%s", VTY_NEWLINE);
+		return CMD_SUCCESS;
+	}
+	llist_for_each_entry(ring, &history.rings, list)
+		active++;
+	llist_for_each_entry(ring, &history.vanished, list)
+		vanished++;
+	vty_out(vty, "%u samples per leaf, %u leaves, %u vanished, %u without history%s",
+		history.samples, active, vanished, history.dropped, VTY_NEWLINE);
+	vty_out(vty, "Rollups: %u minutes, %u hours per leaf%s", history.buckets[HISTORY_MINUTE],
+		history.buckets[HISTORY_HOUR], VTY_NEWLINE);
+	vty_out(vty, "Memory: %zu of %zu KiB%s", history.memory / 1024, history.max_memory / 1024,
+		VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_history, show_history_cmd,
+	"show history PATH [<1-86400>]",
+	SHOW_HISTORY_STR "Number of samples to show (default 10)\n")
+{
+	const struct history_sample *s;
+	struct history_ring *ring;
+	unsigned int i, num = argc > 1 ? atoi(argv[1]) : 10;
+	char tbuf[32];
+	time_t t;
+
+	ring = vty_ring_find(vty, argv[0]);
+	if (!ring)
+		return CMD_WARNING;
+	if (num > ring->count)
+		num = ring->count;
+
+	/* oldest first, like a log */
+	for (i = num; i > 0; i--) {
+		s = ring_get(ring, i - 1);
+		t = s->time;
+		strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		vty_out(vty, "%s %.15g%s", tbuf, s->value, VTY_NEWLINE);
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_history_summary, show_history_summary_cmd,
+	"show history PATH summary",
+	SHOW_HISTORY_STR "Minimum, maximum and average over the last minute up to the last week\n")
+{
+	static const struct {
+		unsigned int secs;
+		const char *name;
+	} windows[] = {
+		{ 60, "1 min" },
+		{ 300, "5 min" },
+		{ 900, "15 min" },
+		{ 3600, "1 h" },
+		{ 86400, "24 h" },
+		{ 604800, "7 d" },
+	};
+	struct history_ring *ring;
+	struct history_agg agg;
+	unsigned int w;
+	bool complete;
+	uint32_t now;
+	int src;
+
+	ring = vty_ring_find(vty, argv[0]);
+	if (!ring)
+		return CMD_WARNING;
+
+	now = ring_get(ring, 0)->time;
+	vty_out(vty, "%-8s %12s %12s %12s %8s %s%s", "window", "min", "max", "avg", "samples", "from",
+		VTY_NEWLINE);
+	for (w = 0; w < ARRAY_SIZE(windows); w++) {
+		src = history_aggregate(ring, now, windows[w].secs, &agg, &complete);
+		vty_out(vty, "%-8s %12.15g %12.15g %12.15g %8u %s%s", windows[w].name, agg.min, agg.max,
+			agg.count ? agg.sum / agg.count : 0.0, agg.count,
+			src < 0 ? "samples" : get_value_string(history_tier_names, src), VTY_NEWLINE);
+		/* the history doesn't go back any further */
+		if (!complete)
+			break;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_history_rollup, show_history_rollup_cmd,
+	"show history PATH (minute|hour) [<1-8760>]",
+	SHOW_HISTORY_STR "Rollups per 1 minute\n" "Rollups per 1 hour\n"
+	"Number of buckets to show (default 10)\n")
+{
+	int tier = get_string_value(history_tier_names, argv[1]);
+	unsigned int i, num = argc > 2 ? atoi(argv[2]) : 10;
+	const struct history_bucket *b;
+	struct history_rollup *r;
+	struct history_ring *ring;
+	char tbuf[32];
+	time_t t;
+
+	ring = vty_ring_find(vty, argv[0]);
+	if (!ring)
+		return CMD_WARNING;
+	r = &ring->rollups[tier];
+	if (!r->count) {
+		vty_out(vty, "%% No %s rollups for '%s'%s", argv[1], argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	if (num > r->count)
+		num = r->count;
+
+	vty_out(vty, "%-19s %12s %12s %12s %12s %8s%s", "start", "min", "max", "avg", "last", "samples",
+		VTY_NEWLINE);
+	for (i = num; i > 0; i--) {
+		b = rollup_get(r, i - 1);
+		t = b->start;
+		strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+		vty_out(vty, "%-19s %12.15g %12.15g %12.15g %12.15g %8u%s", tbuf, b->min, b->max, b->sum / b->count,
+			b->last, b->count, VTY_NEWLINE);
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_history_sparkline, show_history_sparkline_cmd,
+	"show history PATH sparkline",
+	SHOW_HISTORY_STR "The last 60 samples as sparkline\n")
+{
+	static const char *bars[] = { "▁", "▂", "▃", "▄", "▅", "▆", "▇", "█" };
+	struct history_ring *ring;
+	unsigned int i, num, level;
+	double min, max, v;
+	char line[HISTORY_SPARKLINE_WIDTH * 3 + 1];
+
+	ring = vty_ring_find(vty, argv[0]);
+	if (!ring)
+		return CMD_WARNING;
+
+	num = OSMO_MIN(ring->count, HISTORY_SPARKLINE_WIDTH);
+	min = max = ring_get(ring, 0)->value;
+	for (i = 0; i < num; i++) {
+		v = ring_get(ring, i)->value;
+		min = OSMO_MIN(min, v);
+		max = OSMO_MAX(max, v);
+	}
+
+	line[0] = '\0';
+	for (i = num; i > 0; i--) {
+		v = ring_get(ring, i - 1)->value;
+		level = max > min ? (v - min) * (ARRAY_SIZE(bars) - 1) / (max - min) + 0.5 : 0;
+		strcat(line, bars[level]);
+	}
+	vty_out(vty, "%s  [%.15g .. %.15g]%s", line, min, max, VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+static void osysmon_history_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_history_cmd);
+	install_element(CONFIG_NODE, &cfg_no_history_cmd);
+	install_element(CONFIG_NODE, &cfg_history_max_memory_cmd);
+	install_element(CONFIG_NODE, &cfg_history_rollup_cmd);
+	install_element_ve(&show_history_overview_cmd);
+	install_element_ve(&show_history_cmd);
+	install_element_ve(&show_history_summary_cmd);
+	install_element_ve(&show_history_rollup_cmd);
+	install_element_ve(&show_history_sparkline_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+/* called once on startup before config file parsing */
+int osysmon_history_init()
+{
+	osysmon_history_vty_init();
+	return 0;
+}
+
+/* called with every completed tree, after g_oss->leaves was updated */
+void osysmon_history_update(struct value_node *root)
+{
+	struct history_ring *ring;
+	struct timespec ts;
+	struct leaf *l;
+	double val;
+	int t;
+
+	if (!history.samples)
+		return;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	/* these are freed with the next update */
+	llist_for_each_entry(l, &g_oss->leaves->removed, list) {
+		ring = l->history;
+		l->history = NULL;
+		if (!ring || ring == &history_none)
+			continue;
+		ring->leaf = NULL;
+		llist_move_tail(&ring->list, &history.vanished);
+	}
+
+	llist_for_each_entry(l, &g_oss->leaves->leaves, list) {
+		if (l->history == &history_none || !leaf_number(l, &val))
+			continue;
+		if (!l->history)
+			l->history = ring_alloc(l);
+		ring = l->history;
+		if (ring == &history_none)
+			continue;
+		ring->samples[ring->head].time = ts.tv_sec;
+		ring->samples[ring->head].value = val;
+		ring->head = (ring->head + 1) % ring->size;
+		if (ring->count < ring->size)
+			ring->count++;
+		for (t = 0; t < _NUM_HISTORY_TIERS; t++)
+			rollup_add(&ring->rollups[t], t, ts.tv_sec, val);
+	}
+}
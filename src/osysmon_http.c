@@ -0,0 +1,371 @@
+/* Simple Osmocom System Monitor (osysmon): OpenMetrics HTTP endpoint */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Serves the last completed tree as /metrics. Scrapes never trigger a poll:
+ * the response body is rendered at most once per tick (only if a leaf was
+ * added, changed or removed, see leaf_table.h) and gzip'ed at most once per
+ * rendering. */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include <osmocom/core/select.h>
+#include <osmocom/core/socket.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "render.h"
+#include "leaf_table.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define HTTP_REQ_MAX		4096
+#define HTTP_MAX_CONNS		32
+#define HTTP_CONN_TIMEOUT	10
+#define HTTP_BODY_BUF_SIZE	16384
+#define HTTP_CONTENT_TYPE	"application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct http_conn {
+	struct llist_head list;
+	struct osmo_fd ofd;
+	struct osmo_timer_list timer;
+	char req[HTTP_REQ_MAX];
+	size_t req_len;
+	/* what couldn't be sent right away */
+	struct render_buf *out;
+	size_t out_off;
+};
+
+static struct {
+	struct {
+		char *addr;
+		uint16_t port;
+	} cfg;
+	struct osmo_fd listen_ofd;
+	struct llist_head conns;
+	unsigned int num_conns;
+
+	/* the response cache */
+	bool valid;
+	struct render_buf *body;
+	struct render_buf *body_gz;
+	bool gz_valid;
+} http = {
+	.listen_ofd = { .fd = -1 },
+	.conns = LLIST_HEAD_INIT(http.conns),
+};
+
+static void http_conn_close(struct http_conn *conn)
+{
+	osmo_timer_del(&conn->timer);
+	osmo_fd_unregister(&conn->ofd);
+	close(conn->ofd.fd);
+	llist_del(&conn->list);
+	http.num_conns--;
+	talloc_free(conn);
+}
+
+static void http_close_all(void)
+{
+	struct http_conn *conn, *conn2;
+
+	llist_for_each_entry_safe(conn, conn2, &http.conns, list)
+		http_conn_close(conn);
+	if (http.listen_ofd.fd >= 0) {
+		osmo_fd_unregister(&http.listen_ofd);
+		close(http.listen_ofd.fd);
+		http.listen_ofd.fd = -1;
+	}
+	/* not kept up to date without a listener */
+	http.valid = false;
+}
+
+static int http_accept_cb(struct osmo_fd *ofd, unsigned int what);
+
+static int http_listen(const char *addr, uint16_t port)
+{
+	int rc;
+
+	http_close_all();
+	http.listen_ofd.when = BSC_FD_READ;
+	http.listen_ofd.cb = http_accept_cb;
+	rc = osmo_sock_init_ofd(&http.listen_ofd, AF_INET, SOCK_STREAM, IPPROTO_TCP, addr, port,
+				OSMO_SOCK_F_BIND);
+	if (rc < 0) {
+		http.listen_ofd.fd = -1;
+		return rc;
+	}
+
+	osmo_talloc_replace_string(g_oss, &http.cfg.addr, addr);
+	http.cfg.port = port;
+	if (!http.body) {
+		http.body = render_buf_alloc(g_oss, HTTP_BODY_BUF_SIZE);
+		http.body_gz = render_buf_alloc(g_oss, HTTP_BODY_BUF_SIZE);
+	}
+	return 0;
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define HTTP_STR "Serve the values in OpenMetrics format on http://ADDR:PORT/metrics\n"
+DEFUN(cfg_http_server, cfg_http_server_cmd,
+	"http-server A.B.C.D <1-65535>",
+	HTTP_STR "Local IP address to listen on (0.0.0.0 for all)\n" "TCP port to listen on\n")
+{
+	/* tells which ticks changed anything, see osysmon_http_update() */
+	if (!g_oss->leaves)
+		g_oss->leaves = leaf_table_alloc(g_oss);
+
+	if (http_listen(argv[0], atoi(argv[1])) < 0) {
+		vty_out(vty, "Cannot listen on %s:%s: %s%s", argv[0], argv[1], strerror(errno),
+			VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_http_server, cfg_no_http_server_cmd,
+	"no http-server",
+	NO_STR HTTP_STR)
+{
+	http_close_all();
+	TALLOC_FREE(http.cfg.addr);
+	return CMD_SUCCESS;
+}
+
+static void osysmon_http_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_http_server_cmd);
+	install_element(CONFIG_NODE, &cfg_no_http_server_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+/* Send header and body, keep what the socket didn't take */
+static void http_send(struct http_conn *conn, const char *hdr, size_t hdr_len,
+		      const char *body, size_t body_len)
+{
+	struct iovec iov[2] = {
+		{ .iov_base = (void *)hdr, .iov_len = hdr_len },
+		{ .iov_base = (void *)body, .iov_len = body_len },
+	};
+	ssize_t rc;
+
+	rc = writev(conn->ofd.fd, iov, body_len ? 2 : 1);
+	if (rc < 0) {
+		if (errno != EAGAIN) {
+			http_conn_close(conn);
+			return;
+		}
+		rc = 0;
+	}
+	if (rc == hdr_len + body_len) {
+		http_conn_close(conn);
+		return;
+	}
+
+	/* slow client: the cache may be rebuilt before it is done */
+	conn->out = render_buf_alloc(conn, hdr_len + body_len + 1);
+	if (rc < hdr_len) {
+		render_buf_append(conn->out, hdr + rc, hdr_len - rc);
+		render_buf_append(conn->out, body, body_len);
+	} else {
+		render_buf_append(conn->out, body + (rc - hdr_len), body_len - (rc - hdr_len));
+	}
+	conn->ofd.when = BSC_FD_WRITE;
+}
+
+static void http_respond_error(struct http_conn *conn, const char *status)
+{
+	char hdr[256];
+	int len;
+
+	len = snprintf(hdr, sizeof(hdr),
+		       "HTTP/1.1 %s\r\n"
+		       "Content-Length: 0\r\n"
+		       "Connection: close\r\n\r\n", status);
+	http_send(conn, hdr, len, NULL, 0);
+}
+
+static bool http_accepts_gzip(const char *req)
+{
+	const char *line;
+
+	for (line = strstr(req, "\r\n"); line; line = strstr(line, "\r\n")) {
+		line += 2;
+		if (!strncasecmp(line, "Accept-Encoding:", 16)) {
+			const char *eol = strstr(line, "\r\n");
+			const char *gz = strstr(line, "gzip");
+			return gz && (!eol || gz < eol);
+		}
+	}
+	return false;
+}
+
+static void http_handle_request(struct http_conn *conn)
+{
+	const struct render_buf *body = http.body;
+	const char *path, *encoding = "";
+	char hdr[256];
+	size_t path_len;
+	bool head;
+	int len;
+
+	head = !strncmp(conn->req, "HEAD ", 5);
+	if (!head && strncmp(conn->req, "GET ", 4)) {
+		http_respond_error(conn, "405 Method Not Allowed");
+		return;
+	}
+	path = strchr(conn->req, ' ') + 1;
+	path_len = strcspn(path, " ?");
+	if (path_len != 8 || strncmp(path, "/metrics", 8)) {
+		http_respond_error(conn, "404 Not Found");
+		return;
+	}
+	/* nothing polled yet */
+	if (!http.valid) {
+		http_respond_error(conn, "503 Service Unavailable");
+		return;
+	}
+
+	if (http_accepts_gzip(conn->req)) {
+		if (!http.gz_valid)
+			http.gz_valid = render_gzip(http.body_gz, http.body) == 0;
+		if (http.gz_valid) {
+			body = http.body_gz;
+			encoding = "Content-Encoding: gzip\r\n";
+		}
+	}
+
+	len = snprintf(hdr, sizeof(hdr),
+		       "HTTP/1.1 200 OK\r\n"
+		       "Content-Type: " HTTP_CONTENT_TYPE "\r\n"
+		       "%s"
+		       "Content-Length: %zu\r\n"
+		       "Connection: close\r\n\r\n", encoding, body->len);
+	http_send(conn, hdr, len, body->data, head ? 0 : body->len);
+}
+
+static int http_conn_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct http_conn *conn = ofd->data;
+	ssize_t rc;
+
+	if (what & BSC_FD_WRITE) {
+		rc = write(ofd->fd, conn->out->data + conn->out_off, conn->out->len - conn->out_off);
+		if (rc < 0 && errno == EAGAIN)
+			return 0;
+		if (rc <= 0) {
+			http_conn_close(conn);
+			return 0;
+		}
+		conn->out_off += rc;
+		if (conn->out_off == conn->out->len)
+			http_conn_close(conn);
+		return 0;
+	}
+
+	rc = read(ofd->fd, conn->req + conn->req_len, sizeof(conn->req) - 1 - conn->req_len);
+	if (rc < 0 && errno == EAGAIN)
+		return 0;
+	if (rc <= 0) {
+		http_conn_close(conn);
+		return 0;
+	}
+	conn->req_len += rc;
+	conn->req[conn->req_len] = '\0';
+
+	if (strstr(conn->req, "\r\n\r\n")) {
+		/* we only ever answer one request per connection */
+		http_handle_request(conn);
+		return 0;
+	}
+	if (conn->req_len == sizeof(conn->req) - 1)
+		http_respond_error(conn, "431 Request Header Fields Too Large");
+	return 0;
+}
+
+static void http_conn_timer_cb(void *data)
+{
+	http_conn_close(data);
+}
+
+static int http_accept_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct http_conn *conn;
+	int fd;
+
+	fd = accept(ofd->fd, NULL, NULL);
+	if (fd < 0)
+		return 0;
+	if (http.num_conns >= HTTP_MAX_CONNS) {
+		close(fd);
+		return 0;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	conn = talloc_zero(g_oss, struct http_conn);
+	OSMO_ASSERT(conn);
+	conn->ofd.fd = fd;
+	conn->ofd.when = BSC_FD_READ;
+	conn->ofd.cb = http_conn_cb;
+	conn->ofd.data = conn;
+	osmo_fd_register(&conn->ofd);
+	osmo_timer_setup(&conn->timer, http_conn_timer_cb, conn);
+	osmo_timer_schedule(&conn->timer, HTTP_CONN_TIMEOUT, 0);
+	llist_add_tail(&conn->list, &http.conns);
+	http.num_conns++;
+	return 0;
+}
+
+/* called once on startup before config file parsing */
+int osysmon_http_init()
+{
+	osysmon_http_vty_init();
+	return 0;
+}
+
+/* called with every completed tree, after g_oss->leaves was updated */
+void osysmon_http_update(struct value_node *root)
+{
+	if (http.listen_ofd.fd < 0)
+		return;
+
+	if (http.valid && llist_empty(&g_oss->leaves->changed) && llist_empty(&g_oss->leaves->removed))
+		return;
+
+	render_openmetrics(http.body, root);
+	http.valid = true;
+	http.gz_valid = false;
+}
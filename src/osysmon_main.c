@@ -26,11 +26,15 @@
 #include "config.h"
 #include "osysmon.h"
 #include "value_node.h"
+#include "render.h"
+#include "leaf_table.h"
 
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/logging.h>
 #include <osmocom/core/application.h>
 #include <osmocom/core/timer.h>
+#include <osmocom/vty/telnet_interface.h>
+#include <osmocom/vty/command.h>
 
 static struct log_info log_info = {};
 
@@ -40,6 +44,8 @@ static int osysmon_go_parent(struct vty *vty)
 	case CTRL_CLIENT_NODE:
 	case CTRL_CLIENT_GETVAR_NODE:
 		return osysmon_ctrl_go_parent(vty);
+	case OPENVPN_STATUS_NODE:
+		return osysmon_openvpn_status_go_parent(vty);
 	}
 	return vty->node;
 }
@@ -68,30 +74,28 @@ static struct vty_app_info vty_info = {
 
 struct osysmon_state *g_oss;
 
+/* telnet VTY for the "show" commands, off unless configured; bind address
+ * from "line vty" */
+static uint16_t vty_telnet_port;
 
-static void print_node(struct value_node *node, unsigned int indent)
+#define VTY_TELNET_STR "Accept telnet connections to the VTY, without authentication\n"
+DEFUN(cfg_vty_telnet_port, cfg_vty_telnet_port_cmd,
+	"vty-telnet-port <1-65535>",
+	VTY_TELNET_STR "TCP port\n")
 {
-	unsigned int i;
-
-	if (node->value) {
-		for (i = 0; i < indent; i++)
-			fputc(' ', stdout);
-		printf("%s: %s\n", node->name, node->value);
-	} else {
-		struct value_node *vn;
-		for (i = 0; i < indent; i++)
-			fputc(' ', stdout);
-		printf("%s\n", node->name);
-		llist_for_each_entry(vn, &node->children, list)
-			print_node(vn, indent+2);
-	}
+	vty_telnet_port = atoi(argv[0]);
+	return CMD_SUCCESS;
 }
 
-static void display_update(struct value_node *root)
+DEFUN(cfg_no_vty_telnet_port, cfg_no_vty_telnet_port_cmd,
+	"no vty-telnet-port",
+	NO_STR VTY_TELNET_STR)
 {
-	print_node(root, 0);
+	vty_telnet_port = 0;
+	return CMD_SUCCESS;
 }
 
+
 static void signal_handler(int signal)
 {
 	fprintf(stderr, "Signal %u received", signal);
@@ -121,22 +125,25 @@ static void print_help()
 	printf("  -T --timestamp             Prefix every log line with a timestamp.\n");
 	printf("  -e --log-level number      Set a global loglevel.\n");
 	printf("  -V --version               Print the version of osmo-sysmon.\n");
+	printf("  -O --output (text|json|cbor)  Output format on stdout (default: text).\n");
 }
 
 static struct {
 	const char *config_file;
 	bool daemonize;
 	bool oneshot;
+	enum render_format output;
 } cmdline_opts = {
 	.config_file = "osmo-sysmon.cfg",
 	.daemonize = false,
 	.oneshot = false,
+	.output = RENDER_TEXT,
 };
 
 static void handle_options(int argc, char **argv)
 {
 	while (1) {
-		int option_index = 0, c;
+		int option_index = 0, c, rc;
 		static struct option long_options[] = {
 			{"help", 0, 0, 'h'},
 			{"oneshot", 0, 0, 'o'},
@@ -147,10 +154,11 @@ static void handle_options(int argc, char **argv)
 			{"log-level", 1, 0, 'e'},
 			{"timestamp", 0, 0, 'T'},
 			{"version", 0, 0, 'V' },
+			{"output", 1, 0, 'O' },
 			{0, 0, 0, 0}
 		};
 
-		c = getopt_long(argc, argv, "hoc:d:Dse:TV",
+		c = getopt_long(argc, argv, "hoc:d:Dse:TVO:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -185,6 +193,14 @@ static void handle_options(int argc, char **argv)
 			print_version(1);
 			exit(0);
 			break;
+		case 'O':
+			rc = get_string_value(render_format_names, optarg);
+			if (rc < 0) {
+				fprintf(stderr, "Unknown output format '%s'\n", optarg);
+				exit(2);
+			}
+			cmdline_opts.output = rc;
+			break;
 		default:
 			/* catch unknown options *as well as* missing arguments. */
 			fprintf(stderr, "Error in command line options. Exiting.\n");
@@ -199,6 +215,17 @@ static void handle_options(int argc, char **argv)
 	}
 }
 
+static struct render_buf *display_buf;
+
+static void display_update(struct value_node *root)
+{
+	if (!display_buf)
+		display_buf = render_buf_alloc(g_oss, 4096);
+	render_tree(display_buf, cmdline_opts.output, root);
+	fwrite(display_buf->data, 1, display_buf->len, stdout);
+	fflush(stdout);
+}
+
 static struct osmo_timer_list print_timer;
 int ping_init;
 
@@ -206,7 +233,9 @@ static void print_nodes(__attribute__((unused)) void *data)
 {
 	struct value_node *root = value_node_add(NULL, "root", NULL);
 	osysmon_openvpn_poll(root);
+	osysmon_openvpn_status_poll(root);
 	osysmon_sysinfo_poll(root);
+	osysmon_cpu_poll(root);
 	osysmon_ctrl_poll(root);
 	osysmon_rtnl_poll(root);
 
@@ -214,9 +243,24 @@ static void print_nodes(__attribute__((unused)) void *data)
 		osysmon_ping_poll(root);
 
 	osysmon_file_poll(root);
+	osysmon_process_poll(root);
+	osysmon_cgroup_poll(root);
+	osysmon_tsdb_poll(root);
+	osysmon_uplink_poll(root);
+	osysmon_aggregator_poll(root);
 	osysmon_shellcmd_poll(root);
 
+	if (g_oss->leaves)
+		leaf_table_update(g_oss->leaves, root);
+
 	display_update(root);
+	osysmon_http_update(root);
+	osysmon_shm_update(root);
+	osysmon_unix_update(root);
+	osysmon_statsd_update(root);
+	osysmon_uplink_update(root);
+	osysmon_history_update(root);
+	osysmon_tsdb_update(root);
 	value_node_del(root);
 
 	if (cmdline_opts.oneshot)
@@ -233,20 +277,38 @@ int main(int argc, char **argv)
 
 	g_oss = talloc_zero(NULL, struct osysmon_state);
 	INIT_LLIST_HEAD(&g_oss->shellcmds);
+	INIT_LLIST_HEAD(&g_oss->shellcmd_streams);
 	INIT_LLIST_HEAD(&g_oss->ctrl_clients);
 	INIT_LLIST_HEAD(&g_oss->openvpn_clients);
+	INIT_LLIST_HEAD(&g_oss->openvpn_status_files);
 	INIT_LLIST_HEAD(&g_oss->netdevs);
 	INIT_LLIST_HEAD(&g_oss->files);
+	INIT_LLIST_HEAD(&g_oss->processes);
+	INIT_LLIST_HEAD(&g_oss->cgroups);
 
 	vty_init(&vty_info);
+	install_element(CONFIG_NODE, &cfg_vty_telnet_port_cmd);
+	install_element(CONFIG_NODE, &cfg_no_vty_telnet_port_cmd);
 	handle_options(argc, argv);
 	osysmon_sysinfo_init();
+	osysmon_cpu_init();
 	osysmon_shellcmd_init();
 	osysmon_ctrl_init();
 	osysmon_openvpn_init();
+	osysmon_openvpn_status_init();
 	osysmon_rtnl_init();
 	ping_init = osysmon_ping_init();
 	osysmon_file_init();
+	osysmon_process_init();
+	osysmon_cgroup_init();
+	osysmon_http_init();
+	osysmon_shm_init();
+	osysmon_unix_init();
+	osysmon_history_init();
+	osysmon_tsdb_init();
+	osysmon_statsd_init();
+	osysmon_uplink_init();
+	osysmon_aggregator_init();
 
 	signal(SIGUSR1, &signal_handler);
 	signal(SIGUSR2, &signal_handler);
@@ -259,6 +321,14 @@ int main(int argc, char **argv)
 		exit(2);
 	}
 
+	/* only for the "show" commands, the values are collected without it */
+	if (!cmdline_opts.oneshot && vty_telnet_port) {
+		rc = telnet_init_dynif(g_oss, NULL, vty_get_bind_addr(), vty_telnet_port);
+		if (rc < 0)
+			fprintf(stderr, "Cannot bind the VTY telnet interface to port %u, continuing without\n",
+				vty_telnet_port);
+	}
+
 	if (cmdline_opts.daemonize) {
 		rc = osmo_daemonize();
 		if (rc < 0) {
@@ -267,6 +337,12 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* shell commands and pings run asynchronously, wait for their first results */
+	if (cmdline_opts.oneshot) {
+		while (osysmon_shellcmd_busy() || (ping_init == 0 && osysmon_ping_busy()))
+			osmo_select_main(0);
+	}
+
 	osmo_timer_setup(&print_timer, print_nodes, NULL);
 	osmo_timer_schedule(&print_timer, 0, 0);
 
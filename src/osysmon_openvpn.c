@@ -21,6 +21,9 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/socket.h>
 
 #include <osmocom/core/utils.h>
 #include <osmocom/vty/vty.h>
@@ -36,11 +39,102 @@
  * Data model
  ***********************************************************************/
 
-#define OVPN_LOG(ctx, vpn, fmt, args...)				\
-	fprintf(stderr, "OpenVPN [%s]: " fmt, make_authority(ctx, vpn->cfg), ##args)
+/* the authority is allocated per message, so not from any long-lived context */
+#define OVPN_LOG(vpn, fmt, args...) do {					\
+		char *_authority = make_authority(NULL, (vpn)->cfg);		\
+		fprintf(stderr, "OpenVPN [%s]: " fmt, _authority, ##args);	\
+		talloc_free(_authority);					\
+	} while (0)
+
+/* size of the persistent per-client receive buffer, i.e. the longest line we accept */
+#define OVPN_RX_BUF_SIZE 4096
+
+/* interval of the >BYTECOUNT: notifications we subscribe to, in seconds */
+#define OVPN_BYTECOUNT_INTERVAL 5
+
+/* max number of csv/tab separated fields in a line we parse */
+#define MAX_RESP_COMPONENTS 16
+
+/* commands we send, the replies come in the same order */
+enum ovpn_cmd {
+	/* "SUCCESS: ...", then the state history up to "END" */
+	OVPN_CMD_STATE_ON_ALL,
+	/* "SUCCESS: ..." */
+	OVPN_CMD_BYTECOUNT,
+	/* a table up to "END", or "ERROR: ..." */
+	OVPN_CMD_STATUS,
+};
+
+/* replies outstanding at most: the above, "status" only once at a time */
+#define OVPN_MAX_CMDS 8
+
+/* multi-line response currently being received */
+enum ovpn_resp {
+	OVPN_RESP_NONE,
+	/* "status 3" in server mode: TITLE / HEADER / CLIENT_LIST / ROUTING_TABLE ... END */
+	OVPN_RESP_STATUS,
+	/* "status" in client mode: OpenVPN STATISTICS ... END */
+	OVPN_RESP_STATISTICS,
+};
+
+/* columns of a CLIENT_LIST row we are interested in */
+enum ovpn_col {
+	OVPN_COL_COMMON_NAME,
+	OVPN_COL_REAL_ADDR,
+	OVPN_COL_VIRT_ADDR,
+	OVPN_COL_BYTES_IN,
+	OVPN_COL_BYTES_OUT,
+	OVPN_COL_CONNECTED_SINCE,
+	/* optional, OpenVPN 2.4+ only */
+	OVPN_COL_CLIENT_ID,
+	_OVPN_COL_MAX
+};
+
+static const struct value_string ovpn_col_names[] = {
+	{ OVPN_COL_COMMON_NAME,		"Common Name" },
+	{ OVPN_COL_REAL_ADDR,		"Real Address" },
+	{ OVPN_COL_VIRT_ADDR,		"Virtual Address" },
+	{ OVPN_COL_BYTES_IN,		"Bytes Received" },
+	{ OVPN_COL_BYTES_OUT,		"Bytes Sent" },
+	{ OVPN_COL_CONNECTED_SINCE,	"Connected Since" },
+	{ OVPN_COL_CLIENT_ID,		"Client ID" },
+	{ 0, NULL }
+};
+
+/* CLIENT_LIST layout of OpenVPN 2.4+, used until we have seen a HEADER line */
+static const int ovpn_col_default[_OVPN_COL_MAX] = {
+	[OVPN_COL_COMMON_NAME] = 1,
+	[OVPN_COL_REAL_ADDR] = 2,
+	[OVPN_COL_VIRT_ADDR] = 3,
+	[OVPN_COL_BYTES_IN] = 5,
+	[OVPN_COL_BYTES_OUT] = 6,
+	[OVPN_COL_CONNECTED_SINCE] = 7,
+	[OVPN_COL_CLIENT_ID] = 10,
+};
+
+/* byte counters from >BYTECOUNT: notifications and the rates derived from them */
+struct openvpn_bytecount {
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	/* bytes per second over the last notification interval */
+	uint64_t rate_in;
+	uint64_t rate_out;
+	/* CLOCK_MONOTONIC time of the last update */
+	struct timespec last;
+};
 
-/* max number of csv in response */
-#define MAX_RESP_COMPONENTS 6
+/* a client connected to the OpenVPN server we monitor (CLIENT_LIST row) */
+struct openvpn_peer {
+	/* links to openvpn_client.peers */
+	struct llist_head list;
+	char *common_name;
+	char *real_addr;
+	char *virt_addr;
+	char *connected_since;
+	/* management interface client id, -1 if unknown */
+	int64_t cid;
+	struct openvpn_bytecount bc;
+};
 
 /* a single OpenVPN management interface client */
 struct openvpn_client {
@@ -52,8 +146,119 @@ struct openvpn_client {
 	struct host_cfg *rem_cfg;
 	char *tun_ip;
 	bool connected;
+
+	/* persistent receive buffer, holds a partial line between reads */
+	struct msgb *rx;
+	/* an overlong line was dropped, skip until its end */
+	bool rx_discard;
+	enum ovpn_resp resp;
+	/* field index of each CLIENT_LIST column, learned from the HEADER line */
+	int col[_OVPN_COL_MAX];
+
+	/* peers of the last complete "status" reply, and of the one being received */
+	struct llist_head peers;
+	struct llist_head peers_rx;
+	unsigned int num_routes;
+	unsigned int num_routes_rx;
+	/* commands sent, oldest first, whose replies are outstanding */
+	enum ovpn_cmd cmds[OVPN_MAX_CMDS];
+	unsigned int num_cmds;
+	/* the server sends per-client >BYTECOUNT_CLI: notifications */
+	bool have_bytecount_cli;
+	/* client mode: traffic counters from OpenVPN STATISTICS / >BYTECOUNT: */
+	bool have_stats;
+	struct openvpn_bytecount bc;
 };
 
+static void openvpn_client_cmd(struct openvpn_client *vpn, enum ovpn_cmd type, const char *cmd)
+{
+	struct msgb *msg;
+
+	if (vpn->num_cmds == ARRAY_SIZE(vpn->cmds)) {
+		OVPN_LOG(vpn, "too many commands without reply, not sending '%s'\n", cmd);
+		return;
+	}
+	msg = msgb_alloc(128, "OpenVPN cmd");
+	if (!msg) {
+		OVPN_LOG(vpn, "unable to allocate message for '%s'\n", cmd);
+		return;
+	}
+	msgb_printf(msg, "%s\n", cmd);
+	osmo_stream_cli_send(vpn->mgmt, msg);
+	vpn->cmds[vpn->num_cmds++] = type;
+}
+
+static bool openvpn_client_cmd_pending(const struct openvpn_client *vpn, enum ovpn_cmd type)
+{
+	unsigned int i;
+
+	for (i = 0; i < vpn->num_cmds; i++) {
+		if (vpn->cmds[i] == type)
+			return true;
+	}
+	return false;
+}
+
+/* The oldest command got its (complete) reply */
+static void openvpn_client_cmd_done(struct openvpn_client *vpn)
+{
+	if (!vpn->num_cmds)
+		return;
+	vpn->num_cmds--;
+	memmove(vpn->cmds, vpn->cmds + 1, vpn->num_cmds * sizeof(vpn->cmds[0]));
+}
+
+/* (Re-)fetch the client list, once something indicates it has changed */
+static void openvpn_client_request_status(struct openvpn_client *vpn)
+{
+	if (!vpn->connected || openvpn_client_cmd_pending(vpn, OVPN_CMD_STATUS))
+		return;
+	openvpn_client_cmd(vpn, OVPN_CMD_STATUS, "status 3");
+}
+
+static void bytecount_update(struct openvpn_bytecount *bc, uint64_t bytes_in, uint64_t bytes_out)
+{
+	struct timespec now;
+	uint64_t elapsed_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (bc->last.tv_sec || bc->last.tv_nsec) {
+		elapsed_ms = (now.tv_sec - bc->last.tv_sec) * 1000 + (now.tv_nsec - bc->last.tv_nsec) / 1000000;
+		if (elapsed_ms && bytes_in >= bc->bytes_in && bytes_out >= bc->bytes_out) {
+			bc->rate_in = (bytes_in - bc->bytes_in) * 1000 / elapsed_ms;
+			bc->rate_out = (bytes_out - bc->bytes_out) * 1000 / elapsed_ms;
+		}
+	}
+	bc->bytes_in = bytes_in;
+	bc->bytes_out = bytes_out;
+	bc->last = now;
+}
+
+/* Split a line in place at 'sep', keeping empty fields. Returns the number of fields. */
+static unsigned int split_fields(char *line, char sep, char **fields, unsigned int max)
+{
+	unsigned int n = 0;
+	char *p = line;
+
+	while (n < max) {
+		fields[n++] = p;
+		p = strchr(p, sep);
+		if (!p)
+			break;
+		*p++ = '\0';
+	}
+	return n;
+}
+
+static void peers_free(struct llist_head *peers)
+{
+	struct openvpn_peer *peer, *peer2;
+	llist_for_each_entry_safe(peer, peer2, peers, list) {
+		llist_del(&peer->list);
+		talloc_free(peer);
+	}
+}
+
 /*
  * The string format is documented in https://openvpn.net/community-resources/management-interface/
  * Conversation loop looks like this (non-null terminated strings):
@@ -61,62 +266,295 @@ struct openvpn_client {
  * SRV -> CLI: "1552674378,CONNECTED,SUCCESS,10.8.0.11,144.76.43.77,1194,," {0x0d, 0xa} "END" {0x0d, 0xa}
  * More or less comma-separated fields are returned depending on OpenVPN version.
  * v2.1.3: Sends only up to field 4 incl, eg: "1552674378,CONNECTED,SUCCESS,10.8.0.11,144.76.43.77" {0x0d, 0xa} "END" {0x0d, 0xa}
+ * The same format is used by real-time ">STATE:" notifications.
  */
-static char *parse_state(struct msgb *msg, struct openvpn_client *vpn)
+static void parse_state(struct openvpn_client *vpn, char *line)
 {
-	char tmp[128], buf[128];
-	char *tok;
-	unsigned int i;
-	uint8_t *m = msgb_data(msg);
-	unsigned int truncated_len = OSMO_MIN(sizeof(tmp) - 1, msgb_length(msg));
-
-	if (msgb_length(msg) > truncated_len)
-		OVPN_LOG(msg, vpn, "received message too long (%d >= %u), truncating...\n", msgb_length(msg), truncated_len);
-
-	if (msgb_length(msg) > 0) {
-		if (!isdigit(m[0])) /* skip OpenVPN greetings and alike */
-			return NULL;
-	} else {
-		OVPN_LOG(msg, vpn, "received message is empty, ignoring...\n");
-		return NULL;
-	}
-
-	memcpy(tmp, m, truncated_len);
-	tmp[truncated_len] = '\0';
+	char *tok[MAX_RESP_COMPONENTS];
+	char buf[128];
+	unsigned int i, n;
 
-	/* Only interested in first line; Remove return carriage, line feed + new line string "END" */
-	for (i = 0; i < truncated_len; i++) {
-		if (!isprint(tmp[i])) {
-			tmp[i] = '\0';
-			break;
-		}
-	}
-
-	for (tok = strtok(tmp, ","), i = 0; tok && i < MAX_RESP_COMPONENTS; tok = strtok(NULL, ",")) {
+	n = split_fields(line, ',', tok, ARRAY_SIZE(tok));
+	for (i = 1; i < n; i++) {
 		/* Parse csv string and pick interesting tokens while ignoring the rest. */
-		switch (i++) {
+		if (!tok[i][0])
+			continue;
+		switch (i) {
 		/* case 0: unix/date time, not needed */
 		case 1:
-			update_name(vpn->rem_cfg, tok);
+			update_name(vpn->rem_cfg, tok[i]);
 			break;
 		case 2:
-			snprintf(buf, sizeof(buf), "%s (%s)", vpn->rem_cfg->name, tok);
+			snprintf(buf, sizeof(buf), "%s (%s)", vpn->rem_cfg->name, tok[i]);
 			update_name(vpn->rem_cfg, buf);
 			break;
 		case 3:
-			osmo_talloc_replace_string(vpn->rem_cfg, &vpn->tun_ip, tok);
+			osmo_talloc_replace_string(vpn->rem_cfg, &vpn->tun_ip, tok[i]);
 			break;
 		case 4:
-			update_host(vpn->rem_cfg, tok);
+			update_host(vpn->rem_cfg, tok[i]);
 			break;
 		case 5:
-			vpn->rem_cfg->remote_port = atoi(tok);
+			vpn->rem_cfg->remote_port = atoi(tok[i]);
 			break;
 		}
 	}
+}
+
+/* "HEADER\tCLIENT_LIST\tCommon Name\tReal Address\t..." */
+static void parse_status_header(struct openvpn_client *vpn, char **tok, unsigned int n)
+{
+	unsigned int i;
+	int col;
+
+	if (n < 2 || strcmp(tok[1], "CLIENT_LIST"))
+		return;
+
+	for (i = 2; i < n; i++) {
+		col = get_string_value(ovpn_col_names, tok[i]);
+		/* row fields start with "CLIENT_LIST", header fields with "HEADER" in front of it */
+		if (col >= 0)
+			vpn->col[col] = i - 1;
+	}
+}
+
+/* "CLIENT_LIST\tcn\t1.2.3.4:1194\t10.8.0.6\t\t2342\t4223\tThu Jan  1 00:00:00 1970\t0\t..." */
+static void parse_status_client(struct openvpn_client *vpn, char **tok, unsigned int n)
+{
+	struct openvpn_peer *peer;
+	unsigned int i;
+
+	for (i = 0; i < OVPN_COL_CLIENT_ID; i++) {
+		if (vpn->col[i] >= n)
+			return;
+	}
+
+	peer = talloc_zero(vpn, struct openvpn_peer);
+	if (!peer)
+		return;
+
+	peer->common_name = talloc_strdup(peer, tok[vpn->col[OVPN_COL_COMMON_NAME]]);
+	peer->real_addr = talloc_strdup(peer, tok[vpn->col[OVPN_COL_REAL_ADDR]]);
+	peer->virt_addr = talloc_strdup(peer, tok[vpn->col[OVPN_COL_VIRT_ADDR]]);
+	peer->connected_since = talloc_strdup(peer, tok[vpn->col[OVPN_COL_CONNECTED_SINCE]]);
+	peer->bc.bytes_in = strtoull(tok[vpn->col[OVPN_COL_BYTES_IN]], NULL, 10);
+	peer->bc.bytes_out = strtoull(tok[vpn->col[OVPN_COL_BYTES_OUT]], NULL, 10);
+	clock_gettime(CLOCK_MONOTONIC, &peer->bc.last);
+	if (vpn->col[OVPN_COL_CLIENT_ID] < n)
+		peer->cid = strtoll(tok[vpn->col[OVPN_COL_CLIENT_ID]], NULL, 10);
+	else
+		peer->cid = -1;
+	llist_add_tail(&peer->list, &vpn->peers_rx);
+}
+
+static void parse_status(struct openvpn_client *vpn, char *line)
+{
+	char *tok[MAX_RESP_COMPONENTS];
+	unsigned int n;
+
+	n = split_fields(line, '\t', tok, ARRAY_SIZE(tok));
+	if (!strcmp(tok[0], "HEADER"))
+		parse_status_header(vpn, tok, n);
+	else if (!strcmp(tok[0], "CLIENT_LIST"))
+		parse_status_client(vpn, tok, n);
+	else if (!strcmp(tok[0], "ROUTING_TABLE"))
+		vpn->num_routes_rx++;
+	/* TIME, GLOBAL_STATS: not needed */
+}
+
+/* client mode: "TCP/UDP read bytes,1234" */
+static void parse_statistics(struct openvpn_client *vpn, char *line)
+{
+	char *tok[2];
+
+	if (split_fields(line, ',', tok, ARRAY_SIZE(tok)) != 2)
+		return;
+
+	if (!strcmp(tok[0], "TCP/UDP read bytes"))
+		vpn->bc.bytes_in = strtoull(tok[1], NULL, 10);
+	else if (!strcmp(tok[0], "TCP/UDP write bytes"))
+		vpn->bc.bytes_out = strtoull(tok[1], NULL, 10);
+	else
+		return;
+	vpn->have_stats = true;
+}
+
+static struct openvpn_peer *peer_find_by_cid(struct llist_head *peers, int64_t cid)
+{
+	struct openvpn_peer *peer;
+	llist_for_each_entry(peer, peers, list) {
+		if (peer->cid == cid)
+			return peer;
+	}
 	return NULL;
 }
 
+/* client mode: ">BYTECOUNT:in,out" */
+static void parse_bytecount(struct openvpn_client *vpn, char *line)
+{
+	char *tok[2];
+
+	if (split_fields(line, ',', tok, ARRAY_SIZE(tok)) != 2)
+		return;
+	bytecount_update(&vpn->bc, strtoull(tok[0], NULL, 10), strtoull(tok[1], NULL, 10));
+	vpn->have_stats = true;
+}
+
+/* server mode: ">BYTECOUNT_CLI:cid,in,out" */
+static void parse_bytecount_cli(struct openvpn_client *vpn, char *line)
+{
+	struct openvpn_peer *peer;
+	char *tok[3];
+
+	if (split_fields(line, ',', tok, ARRAY_SIZE(tok)) != 3)
+		return;
+
+	vpn->have_bytecount_cli = true;
+	peer = peer_find_by_cid(&vpn->peers, strtoll(tok[0], NULL, 10));
+	if (!peer) {
+		/* a client we don't know about yet has connected */
+		openvpn_client_request_status(vpn);
+		return;
+	}
+	bytecount_update(&peer->bc, strtoull(tok[1], NULL, 10), strtoull(tok[2], NULL, 10));
+}
+
+/* ">STATE:...", ">INFO:...", ">BYTECOUNT:..." etc., may arrive at any time */
+static void parse_notification(struct openvpn_client *vpn, char *line)
+{
+	if (!strncmp(line, "STATE:", 6))
+		parse_state(vpn, line + 6);
+	else if (!strncmp(line, "BYTECOUNT:", 10))
+		parse_bytecount(vpn, line + 10);
+	else if (!strncmp(line, "BYTECOUNT_CLI:", 14))
+		parse_bytecount_cli(vpn, line + 14);
+	else if (!strncmp(line, "CLIENT:ESTABLISHED", 18) || !strncmp(line, "CLIENT:DISCONNECT", 17))
+		openvpn_client_request_status(vpn);
+	/* INFO, LOG, HOLD...: not needed */
+}
+
+/* A multi-line response is complete: make its result visible */
+static void parse_end(struct openvpn_client *vpn)
+{
+	struct openvpn_peer *peer, *old;
+
+	if (vpn->resp == OVPN_RESP_STATUS) {
+		/* keep the rates of clients we already knew; the counters and
+		 * their time are the ones of the table, which confirms that
+		 * the client is still there */
+		llist_for_each_entry(peer, &vpn->peers_rx, list) {
+			if (peer->cid < 0)
+				continue;
+			old = peer_find_by_cid(&vpn->peers, peer->cid);
+			if (old) {
+				peer->bc.rate_in = old->bc.rate_in;
+				peer->bc.rate_out = old->bc.rate_out;
+			}
+		}
+		peers_free(&vpn->peers);
+		llist_splice_init(&vpn->peers_rx, &vpn->peers);
+		vpn->num_routes = vpn->num_routes_rx;
+	}
+	/* also ends the state history of "state on all" */
+	openvpn_client_cmd_done(vpn);
+	vpn->resp = OVPN_RESP_NONE;
+}
+
+static void parse_line(struct openvpn_client *vpn, char *line)
+{
+	if (line[0] == '>') {
+		parse_notification(vpn, line + 1);
+		return;
+	}
+
+	if (!strcmp(line, "END")) {
+		parse_end(vpn);
+		return;
+	}
+
+	switch (vpn->resp) {
+	case OVPN_RESP_STATUS:
+		parse_status(vpn, line);
+		return;
+	case OVPN_RESP_STATISTICS:
+		parse_statistics(vpn, line);
+		return;
+	case OVPN_RESP_NONE:
+		break;
+	}
+
+	if (isdigit(line[0])) {
+		parse_state(vpn, line);
+	} else if (!strncmp(line, "TITLE\t", 6)) {
+		peers_free(&vpn->peers_rx);
+		vpn->num_routes_rx = 0;
+		vpn->resp = OVPN_RESP_STATUS;
+	} else if (!strcmp(line, "OpenVPN STATISTICS")) {
+		vpn->resp = OVPN_RESP_STATISTICS;
+	} else if (!strncmp(line, "ERROR:", 6)) {
+		/* e.g. 'status 3' failing, without a table to end it */
+		openvpn_client_cmd_done(vpn);
+	} else if (!strncmp(line, "SUCCESS:", 8)) {
+		/* the state history of "state on all" follows */
+		if (!vpn->num_cmds || vpn->cmds[0] != OVPN_CMD_STATE_ON_ALL)
+			openvpn_client_cmd_done(vpn);
+	}
+}
+
+/* Consume all complete lines from the receive buffer, parsing them in place */
+static void parse_rx_buf(struct openvpn_client *vpn)
+{
+	struct msgb *rx = vpn->rx;
+	char *line, *nl;
+	unsigned int len;
+
+	while ((nl = memchr(msgb_data(rx), '\n', msgb_length(rx)))) {
+		line = (char *)msgb_data(rx);
+		len = nl - line;
+		*nl = '\0';
+		if (len && line[len - 1] == '\r')
+			line[len - 1] = '\0';
+
+		if (vpn->rx_discard)
+			vpn->rx_discard = false;
+		else
+			parse_line(vpn, line);
+
+		msgb_pull(rx, len + 1);
+	}
+
+	len = msgb_length(rx);
+	if (!len) {
+		msgb_reset(rx);
+	} else if (!msgb_tailroom(rx)) {
+		if (msgb_data(rx) == rx->_data) {
+			OVPN_LOG(vpn, "line exceeds %u bytes, dropping it\n", OVPN_RX_BUF_SIZE);
+			vpn->rx_discard = true;
+			msgb_reset(rx);
+		} else {
+			/* move the partial line to the start of the buffer */
+			memmove(rx->_data, msgb_data(rx), len);
+			msgb_reset(rx);
+			msgb_put(rx, len);
+		}
+	}
+}
+
+static void openvpn_client_reset(struct openvpn_client *vpn)
+{
+	msgb_reset(vpn->rx);
+	vpn->rx_discard = false;
+	vpn->resp = OVPN_RESP_NONE;
+	memcpy(vpn->col, ovpn_col_default, sizeof(vpn->col));
+	peers_free(&vpn->peers);
+	peers_free(&vpn->peers_rx);
+	vpn->num_routes = 0;
+	vpn->num_cmds = 0;
+	vpn->have_bytecount_cli = false;
+	vpn->have_stats = false;
+	memset(&vpn->bc, 0, sizeof(vpn->bc));
+}
+
 static struct openvpn_client *openvpn_client_find_or_make(const struct osysmon_state *os,
 							  const char *host, uint16_t port)
 {
@@ -139,6 +577,7 @@ static int disconnect_cb(struct osmo_stream_cli *conn)
 	talloc_free(vpn->rem_cfg->remote_host);
 	vpn->tun_ip = NULL;
 	vpn->rem_cfg->remote_host = NULL;
+	openvpn_client_reset(vpn);
 
 	return 0;
 }
@@ -147,29 +586,43 @@ static int connect_cb(struct osmo_stream_cli *conn)
 {
 	struct openvpn_client *vpn = osmo_stream_cli_get_data(conn);
 
+	char cmd[32];
+
 	update_name(vpn->rem_cfg, "connected to openvpn management socket");
 	vpn->connected = true;
+	openvpn_client_reset(vpn);
+
+	/* Subscribe to state changes and traffic counters instead of polling for them:
+	 * "state on all" also replays the state history, the last entry is the current one */
+	openvpn_client_cmd(vpn, OVPN_CMD_STATE_ON_ALL, "state on all");
+	snprintf(cmd, sizeof(cmd), "bytecount %u", OVPN_BYTECOUNT_INTERVAL);
+	openvpn_client_cmd(vpn, OVPN_CMD_BYTECOUNT, cmd);
+	openvpn_client_request_status(vpn);
 
 	return 0;
 }
 
+/* Read straight into the tail of the persistent receive buffer: a "status"
+ * reply of a busy server spans many segments, lines are reassembled there. */
 static int read_cb(struct osmo_stream_cli *conn)
 {
 	int bytes;
 	struct openvpn_client *vpn = osmo_stream_cli_get_data(conn);
-	struct msgb *msg = msgb_alloc(1024, "OpenVPN");
-	if (!msg) {
-		OVPN_LOG(conn, vpn, "unable to allocate message in callback\n");
+	struct msgb *rx = vpn->rx;
+
+	bytes = recv(osmo_stream_cli_get_ofd(conn)->fd, msgb_data(rx) + msgb_length(rx),
+		     msgb_tailroom(rx), 0);
+	if (bytes < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (bytes <= 0) {
+		if (bytes < 0)
+			OVPN_LOG(vpn, "read on openvpn management socket failed (%d)\n", errno);
+		osmo_stream_cli_reconnect(conn);
 		return 0;
 	}
 
-	bytes = osmo_stream_cli_recv(conn, msg);
-	if (bytes < 0)
-		OVPN_LOG(msg, vpn, "read on openvpn management socket failed (%d)\n", bytes);
-	else
-		parse_state(msg, vpn);
-
-	msgb_free(msg);
+	msgb_put(rx, bytes);
+	parse_rx_buf(vpn);
 
 	return 0;
 }
@@ -185,6 +638,9 @@ static bool openvpn_client_create(struct osysmon_state *os, const char *name, co
 		return false;
 
 	vpn->connected = false;
+	INIT_LLIST_HEAD(&vpn->peers);
+	INIT_LLIST_HEAD(&vpn->peers_rx);
+	memcpy(vpn->col, ovpn_col_default, sizeof(vpn->col));
 
 	vpn->cfg = host_cfg_alloc(vpn, name, host, port);
 	if (!vpn->cfg)
@@ -194,9 +650,13 @@ static bool openvpn_client_create(struct osysmon_state *os, const char *name, co
 	if (!vpn->rem_cfg)
 		goto dealloc;
 
+	vpn->rx = msgb_alloc(OVPN_RX_BUF_SIZE, "OpenVPN");
+	if (!vpn->rx)
+		goto dealloc;
+
 	vpn->mgmt = make_tcp_client(vpn->cfg);
 	if (!vpn->mgmt)	{
-		OVPN_LOG(vpn->rem_cfg, vpn, "failed to create TCP client\n");
+		OVPN_LOG(vpn, "failed to create TCP client\n");
 		goto dealloc;
 	}
 
@@ -207,7 +667,7 @@ static bool openvpn_client_create(struct osysmon_state *os, const char *name, co
 	osmo_stream_cli_set_disconnect_cb(vpn->mgmt, disconnect_cb);
 
 	if (osmo_stream_cli_open(vpn->mgmt) < 0) {
-		OVPN_LOG(vpn->rem_cfg, vpn, "failed to connect to management socket\n");
+		OVPN_LOG(vpn, "failed to connect to management socket\n");
 		goto dealloc;
 	}
 
@@ -217,6 +677,8 @@ static bool openvpn_client_create(struct osysmon_state *os, const char *name, co
 	return true;
 
 dealloc:
+	if (vpn->rx)
+		msgb_free(vpn->rx);
 	talloc_free(vpn);
 	return false;
 }
@@ -227,6 +689,7 @@ static void openvpn_client_destroy(struct openvpn_client *vpn)
 		return;
 
 	osmo_stream_cli_destroy(vpn->mgmt);
+	msgb_free(vpn->rx);
 	llist_del(&vpn->list);
 	talloc_free(vpn);
 }
@@ -273,15 +736,70 @@ DEFUN(cfg_no_openvpn, cfg_no_openvpn_cmd,
  * Runtime Code
  ***********************************************************************/
 
+static void add_bytecount(struct value_node *parent, const struct openvpn_bytecount *bc)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%" PRIu64, bc->bytes_in);
+	value_node_add(parent, "bytes-in", buf);
+	snprintf(buf, sizeof(buf), "%" PRIu64, bc->bytes_out);
+	value_node_add(parent, "bytes-out", buf);
+	if (bc->last.tv_sec || bc->last.tv_nsec) {
+		snprintf(buf, sizeof(buf), "%" PRIu64 " B/s", bc->rate_in);
+		value_node_add(parent, "rate-in", buf);
+		snprintf(buf, sizeof(buf), "%" PRIu64 " B/s", bc->rate_out);
+		value_node_add(parent, "rate-out", buf);
+	}
+}
+
+/* A client whose >BYTECOUNT_CLI: notifications stopped has most likely disconnected */
+static bool peers_stale(struct openvpn_client *vpn)
+{
+	struct openvpn_peer *peer;
+	struct timespec now;
+
+	if (!vpn->have_bytecount_cli)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	llist_for_each_entry(peer, &vpn->peers, list) {
+		if (peer->cid >= 0 && now.tv_sec - peer->bc.last.tv_sec > 3 * OVPN_BYTECOUNT_INTERVAL)
+			return true;
+	}
+	return false;
+}
+
+static void openvpn_peers_poll(struct openvpn_client *vpn, struct value_node *vn_host)
+{
+	struct value_node *vn_clients, *vn_peer;
+	struct openvpn_peer *peer;
+	char buf[32];
+
+	vn_clients = value_node_add(vn_host, "clients", NULL);
+	llist_for_each_entry(peer, &vpn->peers, list) {
+		vn_peer = value_node_add(vn_clients, peer->common_name, NULL);
+		/* same common name connected more than once (duplicate-cn) */
+		if (!vn_peer)
+			vn_peer = value_node_add(vn_clients, talloc_asprintf(vn_clients, "%s@%s",
+							peer->common_name, peer->real_addr), NULL);
+		if (!vn_peer)
+			continue;
+		value_node_add(vn_peer, "real-address", peer->real_addr);
+		value_node_add(vn_peer, "virtual-address", peer->virt_addr);
+		add_bytecount(vn_peer, &peer->bc);
+		value_node_add(vn_peer, "connected-since", peer->connected_since);
+	}
+
+	snprintf(buf, sizeof(buf), "%u", vpn->num_routes);
+	value_node_add(vn_host, "routes", buf);
+}
+
+/* Everything is kept up to date by notifications from the management interface,
+ * no commands are sent from here unless the client list went stale. */
 static int openvpn_client_poll(struct openvpn_client *vpn, struct value_node *parent)
 {
 	char *remote = make_authority(parent, vpn->rem_cfg);
 	struct value_node *vn_host = value_node_find_or_add(parent, make_authority(parent, vpn->cfg));
-	struct msgb *msg = msgb_alloc(128, "state");
-	if (!msg) {
-		value_node_add(vn_host, "msgb", "memory allocation failure");
-		return 0;
-	}
 
 	if (vpn->rem_cfg->name)
 		value_node_add(vn_host, "status", vpn->rem_cfg->name);
@@ -292,10 +810,14 @@ static int openvpn_client_poll(struct openvpn_client *vpn, struct value_node *pa
 	if (remote)
 		value_node_add(vn_host, "remote", remote);
 
-	if (vpn->connected) { /* re-trigger state command */
-		msgb_printf(msg, "state\n");
-		osmo_stream_cli_send(vpn->mgmt, msg);
-	}
+	if (vpn->have_stats)
+		add_bytecount(vn_host, &vpn->bc);
+
+	if (!llist_empty(&vpn->peers) || vpn->num_routes)
+		openvpn_peers_poll(vpn, vn_host);
+
+	if (peers_stale(vpn))
+		openvpn_client_request_status(vpn);
 
 	return 0;
 }
@@ -0,0 +1,760 @@
+/* Simple Osmocom System Monitor (osysmon): Support for OpenVPN status files */
+
+/* (C) 2015-2019 by sysmocom - s.f.m.c. GmbH.
+ * Author: Harald Welte
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* This replaces contrib/openvpn-status-export.pl: the status file written by
+ * an OpenVPN server ("status FILE" with the default status-version 1) is
+ * re-parsed whenever inotify reports a change, the source IP of each client is
+ * classified into a configured peer group, and the result is published in the
+ * value tree and optionally as JSON file. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <arpa/inet.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/select.h>
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+/* a configured netblock belonging to a peer group */
+struct ovpn_netblock {
+	/* links to ovpn_status_file.netblocks */
+	struct llist_head list;
+	const char *group;
+	uint32_t addr;
+	uint8_t prefix_len;
+};
+
+/* binary trie for longest-prefix-match of IPv4 source addresses */
+struct lpm_node {
+	struct lpm_node *child[2];
+	/* peer group of the prefix ending here, if any */
+	const char *group;
+};
+
+/* a client from the CLIENT LIST section of the status file */
+struct ovpn_status_client {
+	/* links to ovpn_status_file.clients */
+	struct llist_head list;
+	char *name;
+	char *srcip;
+	uint16_t srcport;
+	uint64_t bytes_rx;
+	uint64_t bytes_tx;
+	char *connected_since;
+	const char *group;
+	/* generation of the last parse this client was seen in */
+	unsigned int gen;
+};
+
+struct ovpn_status_file {
+	/* links to osysmon_state.openvpn_status_files */
+	struct llist_head list;
+	struct {
+		const char *path;
+		const char *json_path;
+	} cfg;
+	/* list of 'struct ovpn_netblock' */
+	struct llist_head netblocks;
+	/* compiled from 'netblocks', NULL if it needs to be rebuilt */
+	struct lpm_node *trie;
+
+	/* inotify watch on the directory containing the file */
+	int wd;
+	/* file changed since we last parsed it */
+	bool dirty;
+	bool found;
+	/* re-used read buffer */
+	char *buf;
+	size_t buf_size;
+	unsigned int gen;
+	char *updated;
+	/* list of 'struct ovpn_status_client' */
+	struct llist_head clients;
+};
+
+static struct osmo_fd inotify_ofd = { .fd = -1 };
+
+static struct ovpn_status_file *ovpn_status_file_find(const char *path)
+{
+	struct ovpn_status_file *osf;
+	llist_for_each_entry(osf, &g_oss->openvpn_status_files, list) {
+		if (!strcmp(osf->cfg.path, path))
+			return osf;
+	}
+	return NULL;
+}
+
+/***********************************************************************
+ * Longest prefix match
+ ***********************************************************************/
+
+static void lpm_insert(struct lpm_node *root, uint32_t addr, uint8_t prefix_len, const char *group)
+{
+	struct lpm_node *n = root;
+	unsigned int i, bit;
+
+	for (i = 0; i < prefix_len; i++) {
+		bit = (addr >> (31 - i)) & 1;
+		if (!n->child[bit])
+			n->child[bit] = talloc_zero(root, struct lpm_node);
+		n = n->child[bit];
+	}
+	n->group = group;
+}
+
+/* Walk the address bits down the trie, remembering the most specific group seen */
+static const char *lpm_lookup(const struct lpm_node *n, uint32_t addr)
+{
+	const char *group = NULL;
+	unsigned int i = 0;
+
+	while (n) {
+		if (n->group)
+			group = n->group;
+		if (i == 32)
+			break;
+		n = n->child[(addr >> (31 - i++)) & 1];
+	}
+	return group;
+}
+
+static struct lpm_node *lpm_compile(struct ovpn_status_file *osf)
+{
+	struct lpm_node *root = talloc_zero(osf, struct lpm_node);
+	struct ovpn_netblock *nb;
+
+	llist_for_each_entry(nb, &osf->netblocks, list)
+		lpm_insert(root, nb->addr, nb->prefix_len, nb->group);
+	return root;
+}
+
+static const char *classify_srcip(struct ovpn_status_file *osf, const char *srcip)
+{
+	struct in_addr ia;
+
+	if (inet_pton(AF_INET, srcip, &ia) != 1)
+		return NULL;
+	if (!osf->trie)
+		osf->trie = lpm_compile(osf);
+	return lpm_lookup(osf->trie, ntohl(ia.s_addr));
+}
+
+/***********************************************************************
+ * Status file parsing
+ ***********************************************************************/
+
+static struct ovpn_status_client *client_find(struct ovpn_status_file *osf, const char *name,
+					      const char *srcip, uint16_t srcport)
+{
+	struct ovpn_status_client *cl;
+	llist_for_each_entry(cl, &osf->clients, list) {
+		if (cl->srcport == srcport && !strcmp(cl->srcip, srcip) && !strcmp(cl->name, name))
+			return cl;
+	}
+	return NULL;
+}
+
+/* "name,1.2.3.4:1194,bytes_rx,bytes_tx,connected since" */
+static void parse_client(struct ovpn_status_file *osf, char *line)
+{
+	char *tok[5], *port;
+	struct ovpn_status_client *cl;
+	unsigned int n = 0;
+	char *p = line;
+
+	while (n < ARRAY_SIZE(tok)) {
+		tok[n++] = p;
+		/* the last field (date) is taken as-is */
+		if (n == ARRAY_SIZE(tok))
+			break;
+		p = strchr(p, ',');
+		if (!p)
+			return;
+		*p++ = '\0';
+	}
+
+	port = strrchr(tok[1], ':');
+	if (!port)
+		return;
+	*port++ = '\0';
+
+	cl = client_find(osf, tok[0], tok[1], atoi(port));
+	if (!cl) {
+		cl = talloc_zero(osf, struct ovpn_status_client);
+		if (!cl)
+			return;
+		cl->name = talloc_strdup(cl, tok[0]);
+		cl->srcip = talloc_strdup(cl, tok[1]);
+		cl->srcport = atoi(port);
+		cl->group = classify_srcip(osf, cl->srcip);
+		llist_add_tail(&cl->list, &osf->clients);
+	}
+	cl->bytes_rx = strtoull(tok[2], NULL, 10);
+	cl->bytes_tx = strtoull(tok[3], NULL, 10);
+	if (!cl->connected_since || strcmp(cl->connected_since, tok[4]))
+		osmo_talloc_replace_string(cl, &cl->connected_since, tok[4]);
+	cl->gen = osf->gen;
+}
+
+/* Parse the buffer in place; clients are updated where they already existed */
+static void parse_status(struct ovpn_status_file *osf, char *buf)
+{
+	struct ovpn_status_client *cl, *cl2;
+	bool in_client_list = false;
+	char *line, *nl;
+
+	osf->gen++;
+
+	for (line = buf; line; line = nl) {
+		nl = strchr(line, '\n');
+		if (nl)
+			*nl++ = '\0';
+		if (*line && line[strlen(line) - 1] == '\r')
+			line[strlen(line) - 1] = '\0';
+
+		if (!strcmp(line, "OpenVPN CLIENT LIST")) {
+			in_client_list = true;
+		} else if (!strcmp(line, "ROUTING TABLE") || !strcmp(line, "GLOBAL STATS") ||
+			   !strcmp(line, "END")) {
+			in_client_list = false;
+		} else if (in_client_list) {
+			if (!strncmp(line, "Updated,", 8)) {
+				osmo_talloc_replace_string(osf, &osf->updated, line + 8);
+			} else if (!strncmp(line, "Common Name,", 12)) {
+				/* column header */
+			} else {
+				parse_client(osf, line);
+			}
+		}
+	}
+
+	/* drop clients that have disconnected */
+	llist_for_each_entry_safe(cl, cl2, &osf->clients, list) {
+		if (cl->gen != osf->gen) {
+			llist_del(&cl->list);
+			talloc_free(cl);
+		}
+	}
+}
+
+/* OpenVPN truncates the file and rewrites it in place, the END line tells
+ * that it's complete */
+static bool status_complete(const char *buf)
+{
+	const char *p;
+
+	for (p = buf; (p = strstr(p, "END")); p += 3) {
+		if ((p == buf || p[-1] == '\n') && (!p[3] || p[3] == '\n' || p[3] == '\r'))
+			return true;
+	}
+	return false;
+}
+
+/* Returns -EAGAIN for a file OpenVPN is still writing, keeping the clients
+ * of the previous one */
+static int read_status(struct ovpn_status_file *osf)
+{
+	struct stat st;
+	ssize_t len = 0, rc;
+	int fd;
+
+	fd = open(osf->cfg.path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0)
+		st.st_size = 0;
+	if (!osf->buf || st.st_size + 1 > osf->buf_size) {
+		osf->buf_size = st.st_size + 4096;
+		osf->buf = talloc_realloc_size(osf, osf->buf, osf->buf_size);
+		OSMO_ASSERT(osf->buf);
+	}
+
+	while (len < osf->buf_size - 1) {
+		rc = pread(fd, osf->buf + len, osf->buf_size - 1 - len, len);
+		if (rc <= 0)
+			break;
+		len += rc;
+	}
+	close(fd);
+	osf->buf[len] = '\0';
+
+	if (!status_complete(osf->buf))
+		return -EAGAIN;
+	parse_status(osf, osf->buf);
+	return 0;
+}
+
+/***********************************************************************
+ * JSON export, same format as the old openvpn-status-export.pl
+ ***********************************************************************/
+
+static void json_write_str(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static int write_json(struct ovpn_status_file *osf)
+{
+	struct ovpn_status_client *cl;
+	char *tmp;
+	FILE *f;
+
+	/* write a temporary file and rename it, so readers never see partial output */
+	tmp = talloc_asprintf(osf, "%s.tmp", osf->cfg.json_path);
+	f = fopen(tmp, "w");
+	if (!f) {
+		talloc_free(tmp);
+		return -errno;
+	}
+
+	fprintf(f, "{\n   \"version\" : 1,\n   \"updated\" : ");
+	json_write_str(f, osf->updated ? osf->updated : "");
+	fprintf(f, ",\n   \"clients\" : [");
+	llist_for_each_entry(cl, &osf->clients, list) {
+		fprintf(f, "%s\n      {\n         \"name\" : ", cl->list.prev == &osf->clients ? "" : ",");
+		json_write_str(f, cl->name);
+		fprintf(f, ",\n         \"srcip\" : ");
+		json_write_str(f, cl->srcip);
+		fprintf(f, ",\n         \"operator\" : ");
+		if (cl->group)
+			json_write_str(f, cl->group);
+		else
+			fprintf(f, "null");
+		fprintf(f, ",\n         \"srcport\" : %u,\n         \"bytes_rx\" : %" PRIu64
+			",\n         \"bytes_tx\" : %" PRIu64 ",\n         \"connected_since\" : ",
+			cl->srcport, cl->bytes_rx, cl->bytes_tx);
+		json_write_str(f, cl->connected_since);
+		fprintf(f, "\n      }");
+	}
+	fprintf(f, "\n   ]\n}\n");
+
+	if (fclose(f) != 0 || rename(tmp, osf->cfg.json_path) < 0) {
+		unlink(tmp);
+		talloc_free(tmp);
+		return -errno;
+	}
+	talloc_free(tmp);
+	return 0;
+}
+
+/***********************************************************************
+ * inotify
+ ***********************************************************************/
+
+static int inotify_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	struct ovpn_status_file *osf;
+	ssize_t len;
+	char *p;
+
+	while ((len = read(ofd->fd, buf, sizeof(buf))) > 0) {
+		for (p = buf; p < buf + len; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			llist_for_each_entry(osf, &g_oss->openvpn_status_files, list) {
+				char *base = strrchr(osf->cfg.path, '/');
+				base = base ? base + 1 : (char *)osf->cfg.path;
+				if (osf->wd == ev->wd && ev->len && !strcmp(ev->name, base))
+					osf->dirty = true;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Watch the directory rather than the file: OpenVPN rewrites the file in place,
+ * other writers may replace it, and it may not exist yet. */
+static void ovpn_status_file_watch(struct ovpn_status_file *osf)
+{
+	char *dir;
+
+	if (inotify_ofd.fd < 0) {
+		inotify_ofd.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify_ofd.fd < 0)
+			return;
+		inotify_ofd.when = BSC_FD_READ;
+		inotify_ofd.cb = inotify_cb;
+		osmo_fd_register(&inotify_ofd);
+	}
+
+	dir = talloc_strdup(osf, osf->cfg.path);
+	osf->wd = inotify_add_watch(inotify_ofd.fd, dirname(dir),
+				    IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE);
+	talloc_free(dir);
+}
+
+static struct ovpn_status_file *ovpn_status_file_add(const char *path)
+{
+	struct ovpn_status_file *osf;
+
+	osf = talloc_zero(g_oss, struct ovpn_status_file);
+	OSMO_ASSERT(osf);
+	osf->cfg.path = talloc_strdup(osf, path);
+	INIT_LLIST_HEAD(&osf->netblocks);
+	INIT_LLIST_HEAD(&osf->clients);
+	osf->wd = -1;
+	osf->dirty = true;
+	ovpn_status_file_watch(osf);
+	llist_add_tail(&osf->list, &g_oss->openvpn_status_files);
+	return osf;
+}
+
+static void ovpn_status_file_destroy(struct ovpn_status_file *osf)
+{
+	struct ovpn_status_file *other;
+	bool wd_shared = false;
+
+	llist_del(&osf->list);
+	llist_for_each_entry(other, &g_oss->openvpn_status_files, list) {
+		if (other->wd == osf->wd)
+			wd_shared = true;
+	}
+	if (osf->wd >= 0 && !wd_shared)
+		inotify_rm_watch(inotify_ofd.fd, osf->wd);
+	talloc_free(osf);
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+static struct cmd_node openvpn_status_node = {
+	OPENVPN_STATUS_NODE,
+	"%s(config-openvpn-status)# ",
+	1,
+};
+
+int osysmon_openvpn_status_go_parent(struct vty *vty)
+{
+	switch (vty->node) {
+	case OPENVPN_STATUS_NODE:
+		vty->node = CONFIG_NODE;
+		vty->index = NULL;
+		break;
+	default:
+		break;
+	}
+	return vty->node;
+}
+
+#define OVPN_STATUS_STR "Configure an OpenVPN status file to be exported\n"
+
+DEFUN(cfg_openvpn_status, cfg_openvpn_status_cmd,
+	"openvpn-status-file PATH",
+	OVPN_STATUS_STR "Path of the status file written by the OpenVPN server\n")
+{
+	struct ovpn_status_file *osf = ovpn_status_file_find(argv[0]);
+	if (!osf)
+		osf = ovpn_status_file_add(argv[0]);
+	if (osf->wd < 0)
+		vty_out(vty, "Couldn't watch %s for changes, re-reading it periodically%s",
+			argv[0], VTY_NEWLINE);
+
+	vty->node = OPENVPN_STATUS_NODE;
+	vty->index = osf;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_openvpn_status, cfg_no_openvpn_status_cmd,
+	"no openvpn-status-file PATH",
+	NO_STR OVPN_STATUS_STR "Path of the status file written by the OpenVPN server\n")
+{
+	struct ovpn_status_file *osf = ovpn_status_file_find(argv[0]);
+	if (!osf) {
+		vty_out(vty, "Cannot find OpenVPN status file '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	ovpn_status_file_destroy(osf);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_ovpn_status_json, cfg_ovpn_status_json_cmd,
+	"json-file PATH",
+	"Write the client list as JSON file on every change\n" "Path of the JSON file\n")
+{
+	struct ovpn_status_file *osf = vty->index;
+	osmo_talloc_replace_string(osf, (char **)&osf->cfg.json_path, argv[0]);
+	osf->dirty = true;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_ovpn_status_no_json, cfg_ovpn_status_no_json_cmd,
+	"no json-file",
+	NO_STR "Don't write the client list as JSON file\n")
+{
+	struct ovpn_status_file *osf = vty->index;
+	talloc_free((char *)osf->cfg.json_path);
+	osf->cfg.json_path = NULL;
+	return CMD_SUCCESS;
+}
+
+static void reclassify(struct ovpn_status_file *osf)
+{
+	struct ovpn_status_client *cl;
+
+	talloc_free(osf->trie);
+	osf->trie = NULL;
+	llist_for_each_entry(cl, &osf->clients, list)
+		cl->group = classify_srcip(osf, cl->srcip);
+	osf->dirty = true;
+}
+
+static int parse_prefix(const char *str, uint32_t *addr, uint8_t *prefix_len)
+{
+	char buf[INET_ADDRSTRLEN + 4];
+	struct in_addr ia;
+	char *slash;
+	int len;
+
+	osmo_strlcpy(buf, str, sizeof(buf));
+	slash = strchr(buf, '/');
+	if (!slash)
+		return -EINVAL;
+	*slash++ = '\0';
+	len = atoi(slash);
+	if (len < 0 || len > 32 || inet_pton(AF_INET, buf, &ia) != 1)
+		return -EINVAL;
+
+	*prefix_len = len;
+	*addr = ntohl(ia.s_addr) & (len ? ~0U << (32 - len) : 0);
+	return 0;
+}
+
+static struct ovpn_netblock *netblock_find(struct ovpn_status_file *osf, const char *group,
+					   uint32_t addr, uint8_t prefix_len)
+{
+	struct ovpn_netblock *nb;
+	llist_for_each_entry(nb, &osf->netblocks, list) {
+		if (nb->addr == addr && nb->prefix_len == prefix_len && !strcmp(nb->group, group))
+			return nb;
+	}
+	return NULL;
+}
+
+#define SRCIP_GROUP_STR "Classify clients by source IP into a peer group\n" \
+			"Name of the peer group\n" "Netblock belonging to the group\n"
+
+DEFUN(cfg_ovpn_status_group, cfg_ovpn_status_group_cmd,
+	"srcip-group NAME A.B.C.D/M",
+	SRCIP_GROUP_STR)
+{
+	struct ovpn_status_file *osf = vty->index;
+	struct ovpn_netblock *nb;
+	uint32_t addr;
+	uint8_t prefix_len;
+
+	if (parse_prefix(argv[1], &addr, &prefix_len) < 0) {
+		vty_out(vty, "Invalid netblock '%s'%s", argv[1], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	if (netblock_find(osf, argv[0], addr, prefix_len))
+		return CMD_SUCCESS;
+
+	nb = talloc_zero(osf, struct ovpn_netblock);
+	OSMO_ASSERT(nb);
+	nb->group = talloc_strdup(nb, argv[0]);
+	nb->addr = addr;
+	nb->prefix_len = prefix_len;
+	llist_add_tail(&nb->list, &osf->netblocks);
+	reclassify(osf);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_ovpn_status_no_group, cfg_ovpn_status_no_group_cmd,
+	"no srcip-group NAME A.B.C.D/M",
+	NO_STR SRCIP_GROUP_STR)
+{
+	struct ovpn_status_file *osf = vty->index;
+	struct ovpn_netblock *nb = NULL;
+	uint32_t addr;
+	uint8_t prefix_len;
+
+	if (parse_prefix(argv[1], &addr, &prefix_len) == 0)
+		nb = netblock_find(osf, argv[0], addr, prefix_len);
+	if (!nb) {
+		vty_out(vty, "Cannot find netblock %s in group %s%s", argv[1], argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	llist_del(&nb->list);
+	talloc_free(nb);
+	reclassify(osf);
+	return CMD_SUCCESS;
+}
+
+static int config_write_openvpn_status(struct vty *vty)
+{
+	struct ovpn_status_file *osf;
+	struct ovpn_netblock *nb;
+	struct in_addr ia;
+
+	llist_for_each_entry(osf, &g_oss->openvpn_status_files, list) {
+		vty_out(vty, "openvpn-status-file %s%s", osf->cfg.path, VTY_NEWLINE);
+		if (osf->cfg.json_path)
+			vty_out(vty, " json-file %s%s", osf->cfg.json_path, VTY_NEWLINE);
+		llist_for_each_entry(nb, &osf->netblocks, list) {
+			ia.s_addr = htonl(nb->addr);
+			vty_out(vty, " srcip-group %s %s/%u%s", nb->group, inet_ntoa(ia),
+				nb->prefix_len, VTY_NEWLINE);
+		}
+	}
+	return CMD_SUCCESS;
+}
+
+static void osysmon_openvpn_status_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_openvpn_status_cmd);
+	install_element(CONFIG_NODE, &cfg_no_openvpn_status_cmd);
+	install_node(&openvpn_status_node, config_write_openvpn_status);
+	install_element(OPENVPN_STATUS_NODE, &cfg_ovpn_status_json_cmd);
+	install_element(OPENVPN_STATUS_NODE, &cfg_ovpn_status_no_json_cmd);
+	install_element(OPENVPN_STATUS_NODE, &cfg_ovpn_status_group_cmd);
+	install_element(OPENVPN_STATUS_NODE, &cfg_ovpn_status_no_group_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+/* number of clients per peer group */
+static void add_group_counts(struct ovpn_status_file *osf, struct value_node *vn_osf)
+{
+	struct value_node *vn_groups = value_node_add(vn_osf, "groups", NULL);
+	struct ovpn_status_client *cl, *cl2;
+	unsigned int count;
+	char buf[16];
+
+	llist_for_each_entry(cl, &osf->clients, list) {
+		const char *group = cl->group ? cl->group : "unknown";
+		if (value_node_find(vn_groups, group))
+			continue;
+		/* every netblock has its own copy of the group name */
+		count = 0;
+		llist_for_each_entry(cl2, &osf->clients, list) {
+			if (!strcmp(cl2->group ? cl2->group : "unknown", group))
+				count++;
+		}
+		snprintf(buf, sizeof(buf), "%u", count);
+		value_node_add(vn_groups, group, buf);
+	}
+}
+
+static void ovpn_status_file_poll(struct ovpn_status_file *osf, struct value_node *parent)
+{
+	struct value_node *vn_osf, *vn_clients, *vn_cl;
+	struct ovpn_status_client *cl;
+	char buf[32];
+	int rc;
+
+	/* only re-read after inotify reported a change, or if we can't watch it */
+	if (osf->dirty || osf->wd < 0) {
+		rc = read_status(osf);
+		/* half-written: try again with the next event, or tick */
+		osf->dirty = rc == -EAGAIN;
+		if (rc != -EAGAIN)
+			osf->found = rc == 0;
+		if (rc == 0 && osf->cfg.json_path && write_json(osf) < 0)
+			fprintf(stderr, "OpenVPN status: can't write %s: %s\n",
+				osf->cfg.json_path, strerror(errno));
+	}
+
+	vn_osf = value_node_add(parent, osf->cfg.path, NULL);
+	if (!vn_osf)
+		return;
+
+	if (!osf->found) {
+		value_node_add(vn_osf, "status", "<NOTFOUND>");
+		return;
+	}
+
+	if (osf->updated)
+		value_node_add(vn_osf, "updated", osf->updated);
+
+	vn_clients = value_node_add(vn_osf, "clients", NULL);
+	llist_for_each_entry(cl, &osf->clients, list) {
+		vn_cl = value_node_add(vn_clients, cl->name, NULL);
+		if (!vn_cl)
+			vn_cl = value_node_add(vn_clients, talloc_asprintf(vn_clients, "%s@%s:%u",
+							cl->name, cl->srcip, cl->srcport), NULL);
+		if (!vn_cl)
+			continue;
+		value_node_add(vn_cl, "srcip", cl->srcip);
+		snprintf(buf, sizeof(buf), "%u", cl->srcport);
+		value_node_add(vn_cl, "srcport", buf);
+		if (cl->group)
+			value_node_add(vn_cl, "group", cl->group);
+		snprintf(buf, sizeof(buf), "%" PRIu64, cl->bytes_rx);
+		value_node_add(vn_cl, "bytes-rx", buf);
+		snprintf(buf, sizeof(buf), "%" PRIu64, cl->bytes_tx);
+		value_node_add(vn_cl, "bytes-tx", buf);
+		value_node_add(vn_cl, "connected-since", cl->connected_since);
+	}
+
+	add_group_counts(osf, vn_osf);
+}
+
+/* called once on startup before config file parsing */
+int osysmon_openvpn_status_init()
+{
+	osysmon_openvpn_status_vty_init();
+	return 0;
+}
+
+/* called periodically */
+int osysmon_openvpn_status_poll(struct value_node *parent)
+{
+	struct value_node *vn_status;
+	struct ovpn_status_file *osf;
+
+	if (llist_empty(&g_oss->openvpn_status_files))
+		return 0;
+
+	vn_status = value_node_add(parent, "openvpn-status", NULL);
+
+	llist_for_each_entry(osf, &g_oss->openvpn_status_files, list)
+		ovpn_status_file_poll(osf, vn_status);
+
+	return 0;
+}
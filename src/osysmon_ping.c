@@ -18,11 +18,24 @@
  */
 
 #include <stdbool.h>
+#include <string.h>
 #include <errno.h>
-
-#include <oping.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/icmp6.h>
+#include <arpa/inet.h>
+
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include <osmocom/core/utils.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/timer.h>
 #include <osmocom/vty/vty.h>
 #include <osmocom/vty/command.h>
 
@@ -33,90 +46,480 @@
  * Data model
  ***********************************************************************/
 
-#define BUFLEN 128
+#define PING_PAYLOAD_LEN 56
+/* how long --oneshot waits for the replies of the first round */
+#define PING_FIRST_ROUND_TIMEOUT 1
+
+/* One ICMP socket per address family, shared by all hosts of that family.
+ * Replies are matched to hosts by source address and sequence number. */
+struct ping_sock {
+	struct osmo_fd ofd;
+	int family;
+	/* SOCK_RAW (needs CAP_NET_RAW) or unprivileged SOCK_DGRAM ping socket */
+	bool raw;
+	/* SO_TIMESTAMPING (RX, possibly TX) or only SO_TIMESTAMPNS (RX) */
+	bool timestamping;
+	bool tx_timestamps;
+	/* SOF_TIMESTAMPING_OPT_ID counter: incremented by the kernel per sent packet */
+	uint32_t tskey;
+};
+
+struct ping_host {
+	/* links to ping_state.hosts */
+	struct llist_head list;
+	/* hostname as it was supplied via vty 'ping' entry */
+	char *name;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char ip[INET6_ADDRSTRLEN];
+	struct ping_sock *sock;
+
+	/* number of echo requests sent (== sequence number of the last one) */
+	uint16_t seq;
+	uint32_t dropped;
+	/* still waiting for the reply to 'seq' */
+	bool outstanding;
+	uint32_t tskey;
+	struct timespec tx_user;
+	struct timespec tx_kern;
+	bool tx_kern_valid;
+
+	/* result of the last answered echo request */
+	bool answered;
+	int ttl;
+	/* RTT from kernel timestamps */
+	double latency;
+	/* RTT as seen from userspace */
+	double latency_user;
+};
 
 struct ping_state {
-       pingobj_t *ping_handle;
+	/* list of 'struct ping_host' */
+	struct llist_head hosts;
+	struct ping_sock sock4;
+	struct ping_sock sock6;
+	uint16_t ident;
+	/* wakes up the main loop when the first round times out */
+	struct osmo_timer_list first_round_timer;
+	bool first_round_sent;
 };
 
-/* FIXME: replace with ping_iterator_count() once we bump requirements to liboping 1.10.0+ */
-static unsigned iterator_count(pingobj_t *p)
+static double ts_diff_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000.0 + (a->tv_nsec - b->tv_nsec) / 1000000.0;
+}
+
+static struct ping_host *ping_host_find(const char *name)
 {
-	unsigned count = 0;
-	pingobj_iter_t *iter;
-	for (iter = ping_iterator_get(p); iter; iter = ping_iterator_next(iter))
-		count++;
-	return count;
+	struct ping_host *ph;
+	llist_for_each_entry(ph, &g_oss->pings->hosts, list) {
+		if (!strcmp(ph->name, name))
+			return ph;
+	}
+	return NULL;
 }
 
-/* Workaround for liboping issue https://github.com/octo/liboping/issues/43 */
-static int add_host(pingobj_t *pinger, const char *host)
+static uint16_t icmp_cksum(const void *data, size_t len)
 {
-	int num_host = iterator_count(pinger),
-		rc = ping_host_add(pinger, host);
+	const uint8_t *p = data;
+	uint32_t sum = 0;
 
-	if (rc < 0) {
-		if (num_host != iterator_count(pinger))
-			ping_host_remove(pinger, host);
+	while (len > 1) {
+		sum += (p[0] << 8) | p[1];
+		p += 2;
+		len -= 2;
 	}
+	if (len)
+		sum += p[0] << 8;
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return htons(~sum);
+}
 
-	return rc;
+/* Try the full SO_TIMESTAMPING feature set first, then RX-only software
+ * timestamps, and finally plain SO_TIMESTAMPNS on old kernels. */
+static void ping_sock_enable_timestamps(struct ping_sock *ps)
+{
+	int on = 1;
+	int flags = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE;
+	int tx_flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+		       SOF_TIMESTAMPING_OPT_TSONLY;
+
+	flags |= tx_flags;
+	if (setsockopt(ps->ofd.fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+		ps->timestamping = true;
+		ps->tx_timestamps = true;
+		return;
+	}
+
+	flags &= ~tx_flags;
+	if (setsockopt(ps->ofd.fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+		ps->timestamping = true;
+		return;
+	}
+
+	setsockopt(ps->ofd.fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
 }
 
+static int ping_sock_open(struct ping_sock *ps)
+{
+	int on = 1;
+	int proto = ps->family == AF_INET ? IPPROTO_ICMP : IPPROTO_ICMPV6;
+	int fd;
 
-static bool add_drop(pingobj_iter_t *iter, struct value_node *vn_host)
+	if (ps->ofd.fd >= 0)
+		return 0;
+
+	fd = socket(ps->family, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, proto);
+	if (fd >= 0)
+		ps->raw = true;
+	else
+		fd = socket(ps->family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, proto);
+	if (fd < 0)
+		return -errno;
+
+	ps->ofd.fd = fd;
+	ps->tskey = 0;
+	ping_sock_enable_timestamps(ps);
+
+	if (ps->family == AF_INET) {
+		/* a raw IPv4 socket returns the IP header, ping sockets need the cmsg */
+		if (!ps->raw)
+			setsockopt(fd, IPPROTO_IP, IP_RECVTTL, &on, sizeof(on));
+	} else
+		setsockopt(fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on));
+
+	if (osmo_fd_register(&ps->ofd) < 0) {
+		close(fd);
+		ps->ofd.fd = -1;
+		return -EIO;
+	}
+	return 0;
+}
+
+static void ping_sock_close(struct ping_sock *ps)
 {
-	char *s = NULL;
-	uint32_t drop, seq;
-	size_t len = sizeof(drop);
-	int rc = ping_iterator_get_info(iter, PING_INFO_DROPPED, &drop, &len);
-	if (rc)
+	if (ps->ofd.fd < 0)
+		return;
+	osmo_fd_unregister(&ps->ofd);
+	close(ps->ofd.fd);
+	ps->ofd.fd = -1;
+}
+
+static bool addr_equal(const struct ping_host *ph, const struct sockaddr_storage *ss)
+{
+	if (ss->ss_family != ph->addr.ss_family)
 		return false;
+	if (ss->ss_family == AF_INET)
+		return ((const struct sockaddr_in *)ss)->sin_addr.s_addr ==
+		       ((const struct sockaddr_in *)&ph->addr)->sin_addr.s_addr;
+	return !memcmp(&((const struct sockaddr_in6 *)ss)->sin6_addr,
+		       &((const struct sockaddr_in6 *)&ph->addr)->sin6_addr, sizeof(struct in6_addr));
+}
 
-	len = sizeof(seq);
-	rc = ping_iterator_get_info(iter, PING_INFO_SEQUENCE, &seq, &len);
-	if (rc)
+/* Pick the kernel timestamp out of SCM_TIMESTAMPING / SCM_TIMESTAMPNS */
+static bool cmsg_get_timestamp(struct cmsghdr *cm, struct timespec *ts)
+{
+	if (cm->cmsg_level != SOL_SOCKET)
 		return false;
 
-	osmo_talloc_asprintf(vn_host, s, "%u/%u", drop, seq);
-	value_node_add(vn_host, "dropped", s);
+	if (cm->cmsg_type == SCM_TIMESTAMPING) {
+		struct scm_timestamping *tss = (struct scm_timestamping *)CMSG_DATA(cm);
+		/* ts[0] is the software timestamp */
+		if (!tss->ts[0].tv_sec && !tss->ts[0].tv_nsec)
+			return false;
+		*ts = tss->ts[0];
+		return true;
+	}
+	if (cm->cmsg_type == SCM_TIMESTAMPNS) {
+		memcpy(ts, CMSG_DATA(cm), sizeof(*ts));
+		return true;
+	}
+	return false;
+}
 
-	return true;
+/* Drain TX timestamps from the socket error queue */
+static void ping_sock_read_errqueue(struct ping_sock *ps)
+{
+	char control[512];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+
+	while (1) {
+		struct sock_extended_err *serr = NULL;
+		struct timespec ts;
+		bool have_ts = false;
+		struct ping_host *ph;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(ps->ofd.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+			return;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cmsg_get_timestamp(cm, &ts))
+				have_ts = true;
+			else if ((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+				 (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+				serr = (struct sock_extended_err *)CMSG_DATA(cm);
+		}
+		if (!have_ts || !serr || serr->ee_errno != ENOMSG ||
+		    serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING)
+			continue;
+
+		llist_for_each_entry(ph, &g_oss->pings->hosts, list) {
+			if (ph->sock == ps && ph->outstanding && ph->tskey == serr->ee_data) {
+				ph->tx_kern = ts;
+				ph->tx_kern_valid = true;
+				break;
+			}
+		}
+	}
 }
 
-static bool add_ttl(pingobj_iter_t *iter, struct value_node *vn_host)
+static void ping_host_rx(struct ping_host *ph, int ttl, const struct timespec *rx_kern,
+			 const struct timespec *rx_user)
 {
-	int ttl, rc;
-	size_t len = sizeof(ttl);
+	const struct timespec *tx = ph->tx_kern_valid ? &ph->tx_kern : &ph->tx_user;
 
-	rc = ping_iterator_get_info(iter, PING_INFO_RECV_TTL, &ttl, &len);
-	if (rc)
-		return false;
+	ph->outstanding = false;
+	ph->answered = true;
+	ph->ttl = ttl;
+	ph->latency_user = ts_diff_ms(rx_user, &ph->tx_user);
+	ph->latency = rx_kern ? ts_diff_ms(rx_kern, tx) : ph->latency_user;
+}
 
-	if (ttl > -1) {
-		char *s = NULL;
-		osmo_talloc_asprintf(vn_host, s, "%d", ttl);
-		value_node_add(vn_host, "TTL", s);
+static void ping_sock_read(struct ping_sock *ps)
+{
+	uint8_t buf[1500];
+	char control[512];
+	struct sockaddr_storage from;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr *cm;
+
+	while (1) {
+		struct timespec rx_kern, rx_user;
+		bool have_ts = false;
+		uint16_t id, seq;
+		uint8_t *icmp = buf;
+		int ttl = -1;
+		ssize_t len;
+		struct ping_host *ph;
+
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &from;
+		msg.msg_namelen = sizeof(from);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		len = recvmsg(ps->ofd.fd, &msg, MSG_DONTWAIT);
+		if (len < 0)
+			return;
+		clock_gettime(CLOCK_REALTIME, &rx_user);
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (cmsg_get_timestamp(cm, &rx_kern))
+				have_ts = true;
+			else if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_TTL)
+				memcpy(&ttl, CMSG_DATA(cm), sizeof(ttl));
+			else if (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_HOPLIMIT)
+				memcpy(&ttl, CMSG_DATA(cm), sizeof(ttl));
+		}
+
+		if (ps->family == AF_INET) {
+			struct icmphdr *ih;
+			if (ps->raw) {
+				struct iphdr *iph = (struct iphdr *)buf;
+				if (len < sizeof(*iph) || len < iph->ihl * 4)
+					continue;
+				ttl = iph->ttl;
+				icmp += iph->ihl * 4;
+				len -= iph->ihl * 4;
+			}
+			if (len < sizeof(*ih))
+				continue;
+			ih = (struct icmphdr *)icmp;
+			if (ih->type != ICMP_ECHOREPLY)
+				continue;
+			id = ntohs(ih->un.echo.id);
+			seq = ntohs(ih->un.echo.sequence);
+		} else {
+			struct icmp6_hdr *ih;
+			if (len < sizeof(*ih))
+				continue;
+			ih = (struct icmp6_hdr *)icmp;
+			if (ih->icmp6_type != ICMP6_ECHO_REPLY)
+				continue;
+			id = ntohs(ih->icmp6_id);
+			seq = ntohs(ih->icmp6_seq);
+		}
+
+		/* ping sockets get their identifier assigned by the kernel */
+		if (ps->raw && id != g_oss->pings->ident)
+			continue;
+
+		llist_for_each_entry(ph, &g_oss->pings->hosts, list) {
+			if (ph->sock == ps && ph->outstanding && ph->seq == seq && addr_equal(ph, &from)) {
+				ping_host_rx(ph, ttl, have_ts ? &rx_kern : NULL, &rx_user);
+				break;
+			}
+		}
 	}
+}
+
+static int ping_sock_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct ping_sock *ps = ofd->data;
 
-	return true;
+	if (what & BSC_FD_READ) {
+		/* TX timestamps first, a reply may already be queued behind them */
+		if (ps->tx_timestamps)
+			ping_sock_read_errqueue(ps);
+		ping_sock_read(ps);
+	}
+	return 0;
 }
 
-static bool add_latency(pingobj_iter_t *iter, struct value_node *vn_host)
+static int ping_host_send(struct ping_host *ph)
 {
-	double latency;
-	size_t len = sizeof(latency);
-	int rc = ping_iterator_get_info(iter, PING_INFO_LATENCY, &latency, &len);
-	if (rc)
-		return false;
+	struct ping_sock *ps = ph->sock;
+	uint8_t pkt[8 + PING_PAYLOAD_LEN];
+	uint16_t id = g_oss->pings->ident;
+
+	if (ph->outstanding)
+		ph->dropped++;
+
+	ph->seq++;
+	ph->answered = false;
+	ph->tx_kern_valid = false;
+
+	memset(pkt, 0, sizeof(pkt));
+	if (ps->family == AF_INET) {
+		struct icmphdr *ih = (struct icmphdr *)pkt;
+		ih->type = ICMP_ECHO;
+		ih->un.echo.id = htons(id);
+		ih->un.echo.sequence = htons(ph->seq);
+		ih->checksum = icmp_cksum(pkt, sizeof(pkt));
+	} else {
+		/* the kernel computes the ICMPv6 checksum */
+		struct icmp6_hdr *ih = (struct icmp6_hdr *)pkt;
+		ih->icmp6_type = ICMP6_ECHO_REQUEST;
+		ih->icmp6_id = htons(id);
+		ih->icmp6_seq = htons(ph->seq);
+	}
 
-	if (latency > -1) {
+	clock_gettime(CLOCK_REALTIME, &ph->tx_user);
+	if (sendto(ps->ofd.fd, pkt, sizeof(pkt), 0, (struct sockaddr *)&ph->addr, ph->addr_len) < 0) {
+		ph->outstanding = false;
+		ph->dropped++;
+		return -errno;
+	}
+	ph->outstanding = true;
+	ph->tskey = ps->tskey++;
+
+	return 0;
+}
+
+static int ping_host_add(const char *name, const char **err)
+{
+	struct ping_state *pst = g_oss->pings;
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+	};
+	struct addrinfo *res;
+	struct ping_host *ph;
+	struct ping_sock *ps;
+	int rc;
+
+	if (ping_host_find(name)) {
+		*err = "host already exists";
+		return -EEXIST;
+	}
+
+	rc = getaddrinfo(name, NULL, &hints, &res);
+	if (rc) {
+		*err = gai_strerror(rc);
+		return -EINVAL;
+	}
+
+	ps = res->ai_family == AF_INET6 ? &pst->sock6 : &pst->sock4;
+	rc = ping_sock_open(ps);
+	if (rc < 0) {
+		freeaddrinfo(res);
+		*err = strerror(-rc);
+		return rc;
+	}
+
+	ph = talloc_zero(pst, struct ping_host);
+	OSMO_ASSERT(ph);
+	ph->name = talloc_strdup(ph, name);
+	ph->sock = ps;
+	memcpy(&ph->addr, res->ai_addr, res->ai_addrlen);
+	ph->addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+
+	if (ps->family == AF_INET)
+		inet_ntop(AF_INET, &((struct sockaddr_in *)&ph->addr)->sin_addr, ph->ip, sizeof(ph->ip));
+	else
+		inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&ph->addr)->sin6_addr, ph->ip, sizeof(ph->ip));
+
+	llist_add_tail(&ph->list, &pst->hosts);
+	return 0;
+}
+
+static void ping_host_remove(struct ping_host *ph)
+{
+	struct ping_sock *ps = ph->sock;
+	struct ping_host *other;
+
+	llist_del(&ph->list);
+	talloc_free(ph);
+
+	llist_for_each_entry(other, &g_oss->pings->hosts, list) {
+		if (other->sock == ps)
+			return;
+	}
+	ping_sock_close(ps);
+}
+
+static void add_drop(struct ping_host *ph, struct value_node *vn_host)
+{
+	char *s = NULL;
+
+	osmo_talloc_asprintf(vn_host, s, "%u/%u", ph->dropped, ph->seq);
+	value_node_add(vn_host, "dropped", s);
+}
+
+static void add_ttl(struct ping_host *ph, struct value_node *vn_host)
+{
+	if (ph->ttl > -1) {
 		char *s = NULL;
-		osmo_talloc_asprintf(vn_host, s, "%.1lf ms", latency);
-		value_node_add(vn_host, "latency", s);
+		osmo_talloc_asprintf(vn_host, s, "%d", ph->ttl);
+		value_node_add(vn_host, "TTL", s);
 	}
+}
+
+static void add_latency(struct ping_host *ph, struct value_node *vn_host)
+{
+	char *s = NULL;
 
-	return true;
+	osmo_talloc_asprintf(vn_host, s, "%.1lf ms", ph->latency);
+	value_node_add(vn_host, "latency", s);
+
+	/* How much of the RTT measured in userspace is our own scheduling delay */
+	s = NULL;
+	osmo_talloc_asprintf(vn_host, s, "%.1lf ms", ph->latency_user);
+	value_node_add(vn_host, "latency-user", s);
+	s = NULL;
+	osmo_talloc_asprintf(vn_host, s, "%.3lf ms", ph->latency_user - ph->latency);
+	value_node_add(vn_host, "latency-delta", s);
 }
 
 
@@ -149,11 +552,11 @@ DEFUN(cfg_ping, cfg_ping_cmd,
       "ping HOST",
       PING_STR "Name of the host to ping\n")
 {
-	int rc = add_host(g_oss->pings->ping_handle, argv[0]);
+	const char *err = NULL;
+	int rc = ping_host_add(argv[0], &err);
 	if (rc < 0) {
-		vty_out(vty, "[%d] Couldn't add pinger for %s: %s%s",
-			iterator_count(g_oss->pings->ping_handle), argv[0],
-			ping_get_error(g_oss->pings->ping_handle), VTY_NEWLINE);
+		vty_out(vty, "[%u] Couldn't add pinger for %s: %s%s",
+			llist_count(&g_oss->pings->hosts), argv[0], err, VTY_NEWLINE);
 
 		return CMD_WARNING;
 	}
@@ -165,30 +568,25 @@ DEFUN(cfg_no_ping, cfg_no_ping_cmd,
       "no ping HOST",
       NO_STR PING_STR "Name of the host to ping\n")
 {
-	int rc = ping_host_remove(g_oss->pings->ping_handle, argv[0]);
-	if (rc < 0) {
-		vty_out(vty, "[%d] Couldn't remove %s pinger: %s%s",
-			iterator_count(g_oss->pings->ping_handle), argv[0],
-			ping_get_error(g_oss->pings->ping_handle), VTY_NEWLINE);
+	struct ping_host *ph = ping_host_find(argv[0]);
+	if (!ph) {
+		vty_out(vty, "[%u] Couldn't remove %s pinger: no such host%s",
+			llist_count(&g_oss->pings->hosts), argv[0], VTY_NEWLINE);
 
 		return CMD_WARNING;
 	}
 
+	ping_host_remove(ph);
+
 	return CMD_SUCCESS;
 }
 
 static int config_write_ping(struct vty *vty)
 {
-	char buf[BUFLEN];
-	pingobj_iter_t *iter;
-	for (iter = ping_iterator_get(g_oss->pings->ping_handle); iter; iter = ping_iterator_next(iter)) {
-		size_t len = BUFLEN;
-		/* hostname as it was supplied via vty 'ping' entry */
-		if (ping_iterator_get_info(iter, PING_INFO_USERNAME, buf, &len))
-			return CMD_WARNING;
-
-		vty_out(vty, "ping %s%s", buf, VTY_NEWLINE);
-	}
+	struct ping_host *ph;
+
+	llist_for_each_entry(ph, &g_oss->pings->hosts, list)
+		vty_out(vty, "ping %s%s", ph->name, VTY_NEWLINE);
 
 	return CMD_SUCCESS;
 }
@@ -198,6 +596,19 @@ static int config_write_ping(struct vty *vty)
  * Runtime Code
  ***********************************************************************/
 
+static void ping_sock_init(struct ping_sock *ps, int family)
+{
+	ps->family = family;
+	ps->ofd.fd = -1;
+	ps->ofd.when = BSC_FD_READ;
+	ps->ofd.cb = ping_sock_cb;
+	ps->ofd.data = ps;
+}
+
+static void ping_first_round_timer_cb(void *data)
+{
+}
+
 /* called once on startup before config file parsing */
 int osysmon_ping_init()
 {
@@ -209,52 +620,75 @@ int osysmon_ping_init()
 	if (!g_oss->pings)
 		return -ENOMEM;
 
-	g_oss->pings->ping_handle = ping_construct();
+	INIT_LLIST_HEAD(&g_oss->pings->hosts);
+	ping_sock_init(&g_oss->pings->sock4, AF_INET);
+	ping_sock_init(&g_oss->pings->sock6, AF_INET6);
+	g_oss->pings->ident = getpid() & 0xffff;
+	osmo_timer_setup(&g_oss->pings->first_round_timer, ping_first_round_timer_cb, NULL);
 
-	if (g_oss->pings->ping_handle)
-		return 0;
+	return 0;
+}
 
-	return -EINVAL;
+/* The poll reports the previous round, so for --oneshot the first round has
+ * to be sent before it. True while waiting for its replies. */
+bool osysmon_ping_busy(void)
+{
+	struct ping_host *ph;
+
+	if (!g_oss->pings || llist_empty(&g_oss->pings->hosts))
+		return false;
+
+	if (!g_oss->pings->first_round_sent) {
+		g_oss->pings->first_round_sent = true;
+		llist_for_each_entry(ph, &g_oss->pings->hosts, list)
+			ping_host_send(ph);
+		osmo_timer_schedule(&g_oss->pings->first_round_timer, PING_FIRST_ROUND_TIMEOUT, 0);
+	}
+	if (!osmo_timer_pending(&g_oss->pings->first_round_timer))
+		return false;
+
+	llist_for_each_entry(ph, &g_oss->pings->hosts, list) {
+		if (ph->outstanding)
+			return true;
+	}
+	osmo_timer_del(&g_oss->pings->first_round_timer);
+	return false;
 }
 
-/* called periodically */
+/* called periodically: report the previous round, then start the next one */
 int osysmon_ping_poll(struct value_node *parent)
 {
-	char buf[BUFLEN];
 	struct value_node *vn_host;
-	int num_host = iterator_count(g_oss->pings->ping_handle);
-	pingobj_iter_t *iter;
+	struct ping_host *ph;
+	int rc = 0;
 
-	if (!num_host)
+	if (llist_empty(&g_oss->pings->hosts))
 		return 0;
 
 	struct value_node *vn_ping = value_node_add(parent, "ping", NULL);
 	if (!vn_ping)
 		return -ENOMEM;
 
-	for (iter = ping_iterator_get(g_oss->pings->ping_handle); iter; iter = ping_iterator_next(iter)) {
-		size_t len = BUFLEN;
-		int rc = ping_iterator_get_info(iter, PING_INFO_USERNAME, buf, &len);
-		if (rc)
-			return -EINVAL;
-
-		vn_host = value_node_find_or_add(vn_ping, talloc_strdup(vn_ping, buf));
+	llist_for_each_entry(ph, &g_oss->pings->hosts, list) {
+		vn_host = value_node_find_or_add(vn_ping, talloc_strdup(vn_ping, ph->name));
 		if (!vn_host)
 			return -ENOMEM;
 
-		len = BUFLEN; /* IP address is looked up on-call, even 40 bytes should be enough */
-		rc = ping_iterator_get_info(iter, PING_INFO_ADDRESS, buf, &len);
-		if (rc)
-			return -EINVAL;
-
-		value_node_add(vn_host, "IP", buf);
+		value_node_add(vn_host, "IP", ph->ip);
 
-		add_drop(iter, vn_host);
+		add_drop(ph, vn_host);
 
 		/* Parameters below might be absent from output depending on the host reachability: */
-		add_latency(iter, vn_host);
-		add_ttl(iter, vn_host);
+		if (ph->answered) {
+			add_latency(ph, vn_host);
+			add_ttl(ph, vn_host);
+		}
 	}
 
-	return ping_send(g_oss->pings->ping_handle);
+	llist_for_each_entry(ph, &g_oss->pings->hosts, list) {
+		if (ping_host_send(ph) < 0)
+			rc = -EIO;
+	}
+
+	return rc;
 }
@@ -0,0 +1,483 @@
+/* Simple Osmocom System Monitor (osysmon): per-process resource usage */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* A process is looked up by the basename of its executable once, then
+ * followed through a pidfd, which becomes readable when it exits. Only then
+ * (or while no matching process exists) /proc is scanned again. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <osmocom/core/select.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "pfile.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define PROC_STAT_BUF_SIZE	1024
+#define PROC_STATUS_BUF_SIZE	2048
+/* rescan for missing processes after 1, 2, 4, ... seconds ... */
+#define PROC_SCAN_BACKOFF_MIN	1
+/* ... up to this many seconds */
+#define PROC_SCAN_BACKOFF_MAX	60
+
+struct osysmon_process {
+	struct llist_head list;
+	struct {
+		const char *name;
+		/* fnmatch() pattern for the basename of the executable */
+		const char *match;
+	} cfg;
+
+	/* the process we follow, 0 if none */
+	pid_t pid;
+	/* becomes readable when the process exits */
+	struct osmo_fd pidfd;
+	struct pfile *stat;
+	struct pfile *status;
+	/* /proc/PID/fd, to count the open files */
+	int fd_dir;
+	DIR *fd_dirp;
+	/* number of times a followed process exited */
+	unsigned int exits;
+	/* looking for a process in the current scan */
+	bool scanning;
+
+	/* counters of the last poll, for rates */
+	struct {
+		bool valid;
+		struct timespec ts;
+		uint64_t cpu_ticks;
+		uint64_t vcsw;
+		uint64_t ivcsw;
+	} prev;
+};
+
+static struct osmo_timer_list proc_scan_timer;
+static unsigned int proc_scan_backoff = PROC_SCAN_BACKOFF_MIN;
+
+static void proc_scan_schedule(bool now);
+
+static struct osysmon_process *osysmon_process_find(const char *name)
+{
+	struct osysmon_process *op;
+
+	llist_for_each_entry(op, &g_oss->processes, list) {
+		if (!strcmp(op->cfg.name, name))
+			return op;
+	}
+	return NULL;
+}
+
+static struct osysmon_process *osysmon_process_add(const char *name, const char *match)
+{
+	struct osysmon_process *op;
+
+	if (osysmon_process_find(name))
+		return NULL;
+
+	op = talloc_zero(g_oss, struct osysmon_process);
+	OSMO_ASSERT(op);
+	op->cfg.name = talloc_strdup(op, name);
+	op->cfg.match = talloc_strdup(op, match);
+	op->pidfd.fd = -1;
+	op->fd_dir = -1;
+	llist_add_tail(&op->list, &g_oss->processes);
+	/* not right away, we only scan from the main loop */
+	proc_scan_schedule(true);
+	return op;
+}
+
+/* Stop following the process */
+static void proc_release(struct osysmon_process *op)
+{
+	if (op->pidfd.fd >= 0) {
+		osmo_fd_unregister(&op->pidfd);
+		close(op->pidfd.fd);
+		op->pidfd.fd = -1;
+	}
+	TALLOC_FREE(op->stat);
+	TALLOC_FREE(op->status);
+	if (op->fd_dirp)
+		closedir(op->fd_dirp);
+	else if (op->fd_dir >= 0)
+		close(op->fd_dir);
+	op->fd_dirp = NULL;
+	op->fd_dir = -1;
+	op->pid = 0;
+	op->prev.valid = false;
+}
+
+static void osysmon_process_destroy(struct osysmon_process *op)
+{
+	proc_release(op);
+	llist_del(&op->list);
+	talloc_free(op);
+}
+
+static int proc_pidfd_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct osysmon_process *op = ofd->data;
+
+	op->exits++;
+	proc_release(op);
+	/* it may have been restarted already */
+	proc_scan_schedule(true);
+	return 0;
+}
+
+static int pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Start following pid */
+static void proc_attach(struct osysmon_process *op, pid_t pid)
+{
+	char path[64];
+	int fd;
+
+	op->pid = pid;
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	op->stat = pfile_alloc_pinned(op, path, PROC_STAT_BUF_SIZE);
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	op->status = pfile_alloc_pinned(op, path, PROC_STATUS_BUF_SIZE);
+	snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+	op->fd_dir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	/* without pidfd (Linux < 5.3), the exit is noticed when reading
+	 * /proc/PID/stat fails */
+	fd = pidfd_open(pid);
+	if (fd >= 0) {
+		op->pidfd.fd = fd;
+		op->pidfd.when = BSC_FD_READ;
+		op->pidfd.cb = proc_pidfd_cb;
+		op->pidfd.data = op;
+		osmo_fd_register(&op->pidfd);
+	}
+}
+
+/* Does the executable of pid match the pattern? */
+static bool proc_matches(pid_t pid, const char *pattern)
+{
+	char path[64], exe[256];
+	char *base, *deleted;
+	ssize_t len;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+	len = readlink(path, exe, sizeof(exe) - 1);
+	if (len > 0) {
+		exe[len] = '\0';
+		/* the binary was replaced by a package upgrade */
+		deleted = strstr(exe, " (deleted)");
+		if (deleted && !deleted[10])
+			*deleted = '\0';
+		base = strrchr(exe, '/');
+		base = base ? base + 1 : exe;
+	} else {
+		/* processes of other users without CAP_SYS_PTRACE: use the
+		 * (possibly truncated) command name instead */
+		snprintf(path, sizeof(path), "/proc/%d/comm", pid);
+		f = fopen(path, "r");
+		if (!f)
+			return false;
+		if (!fgets(exe, sizeof(exe), f)) {
+			fclose(f);
+			return false;
+		}
+		fclose(f);
+		exe[strcspn(exe, "\n")] = '\0';
+		base = exe;
+	}
+	return fnmatch(pattern, base, 0) == 0;
+}
+
+/* Walk /proc once for all watchers without a process. If several processes
+ * match, the one with the lowest PID (usually the oldest) is followed. */
+static void proc_scan_timer_cb(void *data)
+{
+	struct osysmon_process *op;
+	struct dirent *de;
+	bool missing = false;
+	char *end;
+	DIR *dir;
+	long pid;
+
+	llist_for_each_entry(op, &g_oss->processes, list)
+		op->scanning = !op->pid;
+
+	dir = opendir("/proc");
+	if (!dir)
+		goto out;
+
+	while ((de = readdir(dir))) {
+		pid = strtol(de->d_name, &end, 10);
+		if (*end || pid <= 0)
+			continue;
+		llist_for_each_entry(op, &g_oss->processes, list) {
+			if (!op->scanning || (op->pid && op->pid < pid))
+				continue;
+			if (!proc_matches(pid, op->cfg.match))
+				continue;
+			if (op->pid)
+				proc_release(op);
+			proc_attach(op, pid);
+		}
+	}
+	closedir(dir);
+
+out:
+	llist_for_each_entry(op, &g_oss->processes, list) {
+		if (!op->pid)
+			missing = true;
+	}
+	if (missing)
+		proc_scan_schedule(false);
+	else
+		proc_scan_backoff = PROC_SCAN_BACKOFF_MIN;
+}
+
+static void proc_scan_schedule(bool now)
+{
+	if (!proc_scan_timer.cb)
+		osmo_timer_setup(&proc_scan_timer, proc_scan_timer_cb, NULL);
+
+	if (now) {
+		proc_scan_backoff = PROC_SCAN_BACKOFF_MIN;
+		osmo_timer_schedule(&proc_scan_timer, 0, 0);
+		return;
+	}
+	osmo_timer_schedule(&proc_scan_timer, proc_scan_backoff, 0);
+	proc_scan_backoff *= 2;
+	if (proc_scan_backoff > PROC_SCAN_BACKOFF_MAX)
+		proc_scan_backoff = PROC_SCAN_BACKOFF_MAX;
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define PROCESS_STR "Configure a process to be monitored\n"
+DEFUN(cfg_process, cfg_process_cmd,
+	"process NAME match EXE",
+	PROCESS_STR "Name of this process-watcher\n"
+	"Find the process by the name of its executable\n"
+	"Basename of the executable, may contain shell wildcards (e.g. osmo-bts-*)\n")
+{
+	struct osysmon_process *op;
+	op = osysmon_process_add(argv[0], argv[1]);
+	if (!op) {
+		vty_out(vty, "Couldn't add process-watcher, maybe it exists?%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_process, cfg_no_process_cmd,
+	"no process NAME",
+	NO_STR PROCESS_STR "Name of this process-watcher\n")
+{
+	struct osysmon_process *op;
+	op = osysmon_process_find(argv[0]);
+	if (!op) {
+		vty_out(vty, "Cannot find process-watcher for '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	osysmon_process_destroy(op);
+	return CMD_SUCCESS;
+}
+
+static void osysmon_process_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_process_cmd);
+	install_element(CONFIG_NODE, &cfg_no_process_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+/* Number of open files. Since Linux 6.2 that's the st_size of /proc/PID/fd,
+ * before it's 0 and we have to count the directory entries. */
+static long proc_count_fds(struct osysmon_process *op)
+{
+	struct dirent *de;
+	struct stat st;
+	long n = 0;
+
+	if (op->fd_dir < 0)
+		return -1;
+	if (!op->fd_dirp) {
+		if (fstat(op->fd_dir, &st) < 0)
+			return -1;
+		if (st.st_size > 0)
+			return st.st_size;
+		op->fd_dirp = fdopendir(op->fd_dir);
+		if (!op->fd_dirp)
+			return -1;
+	}
+
+	rewinddir(op->fd_dirp);
+	while ((de = readdir(op->fd_dirp))) {
+		if (de->d_name[0] != '.')
+			n++;
+	}
+	return n;
+}
+
+static void add_u64(struct value_node *parent, const char *name, uint64_t val, const char *unit)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%llu%s", (unsigned long long)val, unit);
+	value_node_add(parent, name, buf);
+}
+
+static void add_rate(struct value_node *parent, const char *name, uint64_t cur, uint64_t prev,
+		     double interval, const char *fmt)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), fmt, cur >= prev ? (cur - prev) / interval : 0.0);
+	value_node_add(parent, name, buf);
+}
+
+static void proc_poll(struct osysmon_process *op, struct value_node *parent)
+{
+	uint64_t utime, stime, threads, rss_kb = 0, vcsw = 0, ivcsw = 0;
+	struct value_node *vn;
+	struct timespec ts;
+	const char *p;
+	double interval;
+	long fds;
+	int i;
+
+	if (!op->pid) {
+		value_node_add(parent, op->cfg.name, "<NOTFOUND>");
+		return;
+	}
+
+	/* both are pinned to the process we attached to: failing to read them
+	 * means it exited, even if its PID was reused since */
+	if (pfile_read(op->stat) <= 0 || pfile_read(op->status) == -ESRCH) {
+		/* exited, and we have no pidfd to tell us */
+		op->exits++;
+		proc_release(op);
+		proc_scan_schedule(true);
+		value_node_add(parent, op->cfg.name, "<NOTFOUND>");
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	/* "1234 (comm with spaces) S 1 ...": fields 14/15 are utime/stime,
+	 * field 20 is num_threads, counted from the state as field 3 */
+	p = strrchr(op->stat->buf, ')');
+	if (!p)
+		return;
+	p = pfile_skip_ws(p + 1);
+	for (i = 3; i < 14 && p; i++)
+		p = pfile_skip_field(p);
+	p = pfile_parse_u64(p, &utime);
+	p = pfile_skip_ws(pfile_parse_u64(p, &stime));
+	for (i = 16; i < 20 && p; i++)
+		p = pfile_skip_field(p);
+	p = pfile_parse_u64(p, &threads);
+	if (!p)
+		return;
+
+	if (op->status->len > 0) {
+		pfile_parse_u64(pfile_find_key(op->status->buf, "VmRSS:"), &rss_kb);
+		pfile_parse_u64(pfile_find_key(op->status->buf, "voluntary_ctxt_switches:"), &vcsw);
+		pfile_parse_u64(pfile_find_key(op->status->buf, "nonvoluntary_ctxt_switches:"), &ivcsw);
+	}
+
+	vn = value_node_add(parent, op->cfg.name, NULL);
+	if (!vn)
+		return;
+	add_u64(vn, "pid", op->pid, "");
+	add_u64(vn, "rss", rss_kb, " kB");
+	add_u64(vn, "threads", threads, "");
+	fds = proc_count_fds(op);
+	if (fds >= 0)
+		add_u64(vn, "fds", fds, "");
+
+	if (op->prev.valid) {
+		interval = (ts.tv_sec - op->prev.ts.tv_sec) +
+			   (ts.tv_nsec - op->prev.ts.tv_nsec) / 1e9;
+		if (interval > 0) {
+			/* may exceed 100% for multi-threaded processes */
+			add_rate(vn, "cpu", utime + stime, op->prev.cpu_ticks,
+				 interval * sysconf(_SC_CLK_TCK) / 100.0, "%.1f%%");
+			add_rate(vn, "ctxsw-voluntary", vcsw, op->prev.vcsw, interval, "%.1f/s");
+			add_rate(vn, "ctxsw-involuntary", ivcsw, op->prev.ivcsw, interval, "%.1f/s");
+		}
+	}
+	add_u64(vn, "exits", op->exits, "");
+
+	op->prev.valid = true;
+	op->prev.ts = ts;
+	op->prev.cpu_ticks = utime + stime;
+	op->prev.vcsw = vcsw;
+	op->prev.ivcsw = ivcsw;
+}
+
+/* called once on startup before config file parsing */
+int osysmon_process_init()
+{
+	osysmon_process_vty_init();
+	return 0;
+}
+
+/* called periodically */
+int osysmon_process_poll(struct value_node *parent)
+{
+	struct value_node *vn_proc;
+	struct osysmon_process *op;
+
+	if (llist_empty(&g_oss->processes))
+		return 0;
+
+	vn_proc = value_node_add(parent, "process", NULL);
+
+	llist_for_each_entry(op, &g_oss->processes, list)
+		proc_poll(op, vn_proc);
+
+	return 0;
+}
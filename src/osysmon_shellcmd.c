@@ -19,26 +19,150 @@
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
 #include <sys/sysinfo.h>
 
+#include <osmocom/core/select.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/utils.h>
 #include <osmocom/vty/vty.h>
 #include <osmocom/vty/command.h>
 
 #include "osysmon.h"
 #include "value_node.h"
 
+extern char **environ;
+
 /***********************************************************************
  * Data model
  ***********************************************************************/
 
+/* initial size of the output buffer, grown as needed ... */
+#define SHELLCMD_BUF_SIZE 512
+/* ... up to this many bytes by default, anything beyond is discarded */
+#define SHELLCMD_DEFAULT_MAX_OUTPUT 65536
+/* default time between two runs of a command */
+#define SHELLCMD_DEFAULT_INTERVAL 1
+/* default time a command may run before it is killed */
+#define SHELLCMD_DEFAULT_TIMEOUT 10
+/* default number of commands running at the same time */
+#define SHELLCMD_DEFAULT_MAX_PARALLEL 4
+/* how often to check whether a child exited after its stdout was closed */
+#define SHELLCMD_REAP_INTERVAL_US 20000
+/* how often to check whether killed children we no longer track exited */
+#define SHELLCMD_ORPHAN_REAP_INTERVAL 1
+
+enum shellcmd_split {
+	/* the entire output is one value */
+	SHELLCMD_SPLIT_NONE,
+	/* one value per line, named by line number */
+	SHELLCMD_SPLIT_LINES,
+	/* "key=value" or "key: value" lines */
+	SHELLCMD_SPLIT_KEY_VALUE,
+	/* header row naming whitespace separated columns, followed by data rows */
+	SHELLCMD_SPLIT_COLUMNS,
+};
+
+static const struct value_string shellcmd_split_names[] = {
+	{ SHELLCMD_SPLIT_NONE,		"none" },
+	{ SHELLCMD_SPLIT_LINES,		"lines" },
+	{ SHELLCMD_SPLIT_KEY_VALUE,	"key-value" },
+	{ SHELLCMD_SPLIT_COLUMNS,	"columns" },
+	{ 0, NULL }
+};
+
+/* one value split out of the output, pointing into the output buffer */
+struct shellcmd_field {
+	/* row number (lines, columns) */
+	unsigned int row;
+	/* first column of the row (columns) */
+	const char *row_name;
+	/* key (key-value) or column name (columns) */
+	const char *key;
+	const char *value;
+};
+
+enum shellcmd_state {
+	SHELLCMD_IDLE,
+	/* waiting for one of the running commands to finish */
+	SHELLCMD_QUEUED,
+	SHELLCMD_RUNNING,
+};
+
 struct osysmon_shellcmd {
 	struct llist_head list;
 	struct {
 		const char *name;
 		const char *cmd;
+		unsigned int timeout;
+		/* seconds between runs, 0 to run only once */
+		unsigned int interval;
+		size_t max_output;
+		enum shellcmd_split split;
 	} cfg;
+
+	enum shellcmd_state state;
+	/* entry in shellcmd_queue while queued */
+	struct llist_head queue_list;
+	/* starts a new run every cfg.interval seconds */
+	struct osmo_timer_list run_timer;
+
+	/* the running child */
+	pid_t pid;
+	struct osmo_fd ofd;
+	struct osmo_timer_list timer;
+	struct timespec started;
+	bool reaped;
+	bool killed;
+	int status;
+	char *buf;
+	size_t buf_len;
+	size_t buf_size;
+	/* output beyond cfg.max_output was discarded */
+	bool truncated;
+
+	/* result of the last completed run */
+	struct {
+		bool valid;
+		/* swapped with buf when a run completes */
+		char *output;
+		size_t size;
+		size_t len;
+		bool truncated;
+		/* values split out of the output */
+		struct shellcmd_field *fields;
+		unsigned int num_fields;
+		unsigned int max_fields;
+		int status;
+		bool timed_out;
+		unsigned long runtime_ms;
+		struct timespec finished;
+	} last;
+};
+
+/* commands waiting for a free slot, in order of arrival */
+static LLIST_HEAD(shellcmd_queue);
+static unsigned int shellcmd_running;
+static unsigned int shellcmd_max_parallel = SHELLCMD_DEFAULT_MAX_PARALLEL;
+
+/* killed children that didn't exit yet, see shellcmd_kill() */
+struct shellcmd_orphan {
+	struct llist_head list;
+	pid_t pid;
 };
+static LLIST_HEAD(shellcmd_orphans);
+static struct osmo_timer_list shellcmd_orphan_timer;
+
+static void shellcmd_run_timer_cb(void *data);
+static void shellcmd_timer_cb(void *data);
+static void shellcmd_start_queued(void);
 
 static struct osysmon_shellcmd *osysmon_shellcmd_find(const char *name)
 {
@@ -62,43 +186,763 @@ static struct osysmon_shellcmd *osysmon_shellcmd_add(const char *name, const cha
 	OSMO_ASSERT(oc);
 	oc->cfg.name = talloc_strdup(oc, name);
 	oc->cfg.cmd = talloc_strdup(oc, cmd);
+	oc->cfg.timeout = SHELLCMD_DEFAULT_TIMEOUT;
+	oc->cfg.interval = SHELLCMD_DEFAULT_INTERVAL;
+	oc->cfg.max_output = SHELLCMD_DEFAULT_MAX_OUTPUT;
+	oc->ofd.fd = -1;
+	oc->buf_size = SHELLCMD_BUF_SIZE;
+	oc->buf = talloc_size(oc, oc->buf_size);
+	OSMO_ASSERT(oc->buf);
+	INIT_LLIST_HEAD(&oc->queue_list);
+	osmo_timer_setup(&oc->timer, shellcmd_timer_cb, oc);
+	osmo_timer_setup(&oc->run_timer, shellcmd_run_timer_cb, oc);
+	osmo_timer_schedule(&oc->run_timer, 0, 0);
 	llist_add_tail(&oc->list, &g_oss->shellcmds);
 	return oc;
 }
 
+static void shellcmd_close_pipe(struct osysmon_shellcmd *oc)
+{
+	if (oc->ofd.fd < 0)
+		return;
+	osmo_fd_unregister(&oc->ofd);
+	close(oc->ofd.fd);
+	oc->ofd.fd = -1;
+}
+
+static void shellcmd_orphan_timer_cb(void *data)
+{
+	struct shellcmd_orphan *o, *o2;
+	pid_t rc;
+
+	llist_for_each_entry_safe(o, o2, &shellcmd_orphans, list) {
+		rc = waitpid(o->pid, NULL, WNOHANG);
+		if (rc == o->pid || (rc < 0 && errno == ECHILD)) {
+			llist_del(&o->list);
+			talloc_free(o);
+		}
+	}
+	if (!llist_empty(&shellcmd_orphans))
+		osmo_timer_schedule(&shellcmd_orphan_timer, SHELLCMD_ORPHAN_REAP_INTERVAL, 0);
+}
+
+/* Kill a child and everything it started. It is reaped later if it doesn't
+ * exit right away: waiting for it here would block the main loop for as long
+ * as it is in uninterruptible sleep. */
+static void shellcmd_kill(pid_t pid, int *status)
+{
+	struct shellcmd_orphan *o;
+
+	kill(-pid, SIGKILL);
+	if (waitpid(pid, status, WNOHANG) == pid)
+		return;
+
+	o = talloc_zero(g_oss, struct shellcmd_orphan);
+	OSMO_ASSERT(o);
+	o->pid = pid;
+	llist_add_tail(&o->list, &shellcmd_orphans);
+	if (!osmo_timer_pending(&shellcmd_orphan_timer))
+		osmo_timer_schedule(&shellcmd_orphan_timer, 0, SHELLCMD_REAP_INTERVAL_US);
+}
+
 static void osysmon_shellcmd_destroy(struct osysmon_shellcmd *oc)
 {
+	bool running = oc->state == SHELLCMD_RUNNING;
+
+	if (running) {
+		shellcmd_close_pipe(oc);
+		if (!oc->reaped)
+			shellcmd_kill(oc->pid, NULL);
+	}
+	osmo_timer_del(&oc->timer);
+	osmo_timer_del(&oc->run_timer);
+	llist_del(&oc->queue_list);
 	llist_del(&oc->list);
 	talloc_free(oc);
+
+	/* its slot is free now */
+	if (running) {
+		shellcmd_running--;
+		shellcmd_start_queued();
+	}
 }
 
-static void osysmon_shellcmd_run(struct osysmon_shellcmd *oc, struct value_node *parent)
+static long ms_since(const struct timespec *t)
 {
-	char buf[512];
-	FILE *f;
-	char *p = buf;
-	long offset = 0;
+	struct timespec now;
 
-	f = popen(oc->cfg.cmd, "r");
-	if (!f) {
-		snprintf(buf, sizeof(buf), "<popen failed (%d)>", errno);
-		value_node_add(parent, oc->cfg.name, buf);
-		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) * 1000 + (now.tv_nsec - t->tv_nsec) / 1000000;
+}
+
+static int shellcmd_read_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct osysmon_shellcmd *oc = ofd->data;
+	char discard[256];
+	size_t size;
+	ssize_t rc;
+
+	if (oc->buf_len == oc->buf_size - 1 && oc->buf_size < oc->cfg.max_output + 1) {
+		size = oc->buf_size * 2;
+		if (size > oc->cfg.max_output + 1)
+			size = oc->cfg.max_output + 1;
+		oc->buf = talloc_realloc_size(oc, oc->buf, size);
+		OSMO_ASSERT(oc->buf);
+		oc->buf_size = size;
 	}
 
-	while ((offset = fread(p, 1, sizeof(buf) - 1 - (p - buf), f)) != 0) {
-		p += offset;
-		*p = '\0';
+	/* keep draining the pipe once the buffer is full, so the child doesn't block */
+	if (oc->buf_len < oc->buf_size - 1) {
+		rc = read(ofd->fd, oc->buf + oc->buf_len, oc->buf_size - 1 - oc->buf_len);
+		if (rc > 0)
+			oc->buf_len += rc;
+	} else {
+		rc = read(ofd->fd, discard, sizeof(discard));
+		if (rc > 0)
+			oc->truncated = true;
 	}
 
-	pclose(f);
+	if (rc > 0 || (rc < 0 && (errno == EAGAIN || errno == EINTR)))
+		return 0;
+
+	/* EOF: the output is complete, collect the exit status */
+	shellcmd_close_pipe(oc);
+	shellcmd_timer_cb(oc);
+	return 0;
+}
+
 
-	if (buf != p) {
-		if (*(p - 1) == '\n') /* Remove final new line if exists */
-			*(p - 1) = '\0';
-		value_node_add(parent, oc->cfg.name, buf);
+static void shellcmd_split(struct osysmon_shellcmd *oc);
+
+static void shellcmd_finish(struct osysmon_shellcmd *oc)
+{
+	char *tmp;
+	size_t tmp_size;
+
+	osmo_timer_del(&oc->timer);
+
+	/* Remove final new line if exists */
+	if (oc->buf_len && oc->buf[oc->buf_len - 1] == '\n')
+		oc->buf_len--;
+	oc->buf[oc->buf_len] = '\0';
+
+	/* the output becomes the last result, the previous result's buffer
+	 * is re-used for the next run */
+	tmp = oc->last.output;
+	tmp_size = oc->last.size;
+	oc->last.output = oc->buf;
+	oc->last.size = oc->buf_size;
+	oc->last.len = oc->buf_len;
+	oc->last.truncated = oc->truncated;
+	if (tmp) {
+		oc->buf = tmp;
+		oc->buf_size = tmp_size;
 	} else {
+		oc->buf_size = SHELLCMD_BUF_SIZE;
+		oc->buf = talloc_size(oc, oc->buf_size);
+		OSMO_ASSERT(oc->buf);
+	}
+	shellcmd_split(oc);
+
+	oc->last.status = oc->status;
+	oc->last.timed_out = oc->killed;
+	oc->last.runtime_ms = ms_since(&oc->started);
+	clock_gettime(CLOCK_MONOTONIC, &oc->last.finished);
+	oc->last.valid = true;
+
+	oc->state = SHELLCMD_IDLE;
+	shellcmd_running--;
+	shellcmd_start_queued();
+}
+
+/* Called on EOF, while waiting for the child to exit, and at the deadline */
+static void shellcmd_timer_cb(void *data)
+{
+	struct osysmon_shellcmd *oc = data;
+	long remaining;
+	pid_t rc;
+
+	if (!oc->reaped) {
+		rc = waitpid(oc->pid, &oc->status, WNOHANG);
+		if (rc == oc->pid || (rc < 0 && errno == ECHILD))
+			oc->reaped = true;
+	}
+	if (oc->reaped && oc->ofd.fd < 0) {
+		shellcmd_finish(oc);
+		return;
+	}
+
+	remaining = oc->cfg.timeout * 1000 - ms_since(&oc->started);
+	if (remaining <= 0 && !oc->killed) {
+		/* the whole process group: sh -c may have forked further children
+		 * that still hold on to stdout */
+		kill(-oc->pid, SIGKILL);
+		oc->killed = true;
+		shellcmd_close_pipe(oc);
+	}
+
+	if (oc->ofd.fd < 0 || remaining <= 0)
+		osmo_timer_schedule(&oc->timer, 0, SHELLCMD_REAP_INTERVAL_US);
+	else
+		osmo_timer_schedule(&oc->timer, remaining / 1000, (remaining % 1000) * 1000);
+}
+
+/* Start '/bin/sh -c CMD' with posix_spawn(), which uses vfork semantics, so we
+ * don't copy the page tables of osmo-sysmon for every command. Returns the
+ * non-blocking read end of a pipe connected to its stdout, or -errno. */
+static int spawn_sh(const char *cmd, pid_t *pid)
+{
+	char *argv[] = { "/bin/sh", "-c", (char *)cmd, NULL };
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	int fds[2];
+	int rc;
+
+	if (pipe(fds) < 0)
+		return -errno;
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	posix_spawn_file_actions_init(&fa);
+	posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+
+	/* own process group so we can kill everything it started on timeout,
+	 * default signal dispositions rather than our SIG_IGN for SIGPIPE */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF |
+					POSIX_SPAWN_SETSIGMASK);
+	posix_spawnattr_setpgroup(&attr, 0);
+	sigfillset(&sigs);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+
+	rc = posix_spawn(pid, argv[0], &fa, &attr, argv, environ);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
+	close(fds[1]);
+	if (rc != 0) {
+		close(fds[0]);
+		return -rc;
+	}
+
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	return fds[0];
+}
+
+static int shellcmd_spawn(struct osysmon_shellcmd *oc)
+{
+	int fd;
+
+	fd = spawn_sh(oc->cfg.cmd, &oc->pid);
+	if (fd < 0)
+		return fd;
+
+	oc->ofd.fd = fd;
+	oc->ofd.when = BSC_FD_READ;
+	oc->ofd.cb = shellcmd_read_cb;
+	oc->ofd.data = oc;
+	osmo_fd_register(&oc->ofd);
+	return 0;
+}
+
+static void shellcmd_start(struct osysmon_shellcmd *oc)
+{
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &oc->started);
+	oc->buf_len = 0;
+	oc->truncated = false;
+	oc->reaped = false;
+	oc->killed = false;
+	oc->status = 0;
+
+	rc = shellcmd_spawn(oc);
+	if (rc < 0) {
+		talloc_free(oc->last.output);
+		oc->last.output = talloc_asprintf(oc, "<spawn failed (%d)>", -rc);
+		oc->last.len = strlen(oc->last.output);
+		oc->last.size = oc->last.len + 1;
+		oc->last.truncated = false;
+		oc->last.num_fields = 0;
+		oc->last.status = 0;
+		oc->last.timed_out = false;
+		oc->last.runtime_ms = 0;
+		clock_gettime(CLOCK_MONOTONIC, &oc->last.finished);
+		oc->last.valid = true;
+		oc->state = SHELLCMD_IDLE;
+		return;
+	}
+
+	oc->state = SHELLCMD_RUNNING;
+	shellcmd_running++;
+	osmo_timer_schedule(&oc->timer, oc->cfg.timeout, 0);
+}
+
+static void shellcmd_start_queued(void)
+{
+	struct osysmon_shellcmd *oc;
+
+	while (shellcmd_running < shellcmd_max_parallel && !llist_empty(&shellcmd_queue)) {
+		oc = llist_first_entry(&shellcmd_queue, struct osysmon_shellcmd, queue_list);
+		llist_del_init(&oc->queue_list);
+		shellcmd_start(oc);
+	}
+}
+
+static void shellcmd_run_timer_cb(void *data)
+{
+	struct osysmon_shellcmd *oc = data;
+
+	if (oc->cfg.interval)
+		osmo_timer_schedule(&oc->run_timer, oc->cfg.interval, 0);
+
+	/* still running or waiting from the last time */
+	if (oc->state != SHELLCMD_IDLE)
+		return;
+
+	oc->state = SHELLCMD_QUEUED;
+	llist_add_tail(&oc->queue_list, &shellcmd_queue);
+	shellcmd_start_queued();
+}
+
+static struct shellcmd_field *shellcmd_add_field(struct osysmon_shellcmd *oc)
+{
+	if (oc->last.num_fields == oc->last.max_fields) {
+		oc->last.max_fields = oc->last.max_fields ? oc->last.max_fields * 2 : 16;
+		oc->last.fields = talloc_realloc(oc, oc->last.fields, struct shellcmd_field,
+						 oc->last.max_fields);
+		OSMO_ASSERT(oc->last.fields);
+	}
+	return &oc->last.fields[oc->last.num_fields++];
+}
+
+static char *trim(char *str)
+{
+	char *end;
+
+	str += strspn(str, " \t");
+	end = str + strlen(str);
+	while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		*--end = '\0';
+	return str;
+}
+
+/* Cut the next whitespace-separated token out of a line, NUL-terminating it
+ * in place. The last one of max tokens gets the rest of the line. */
+static char *next_token(char **pos, bool last)
+{
+	char *tok = *pos + strspn(*pos, " \t");
+
+	if (!*tok)
+		return NULL;
+	if (last) {
+		*pos = tok + strlen(tok);
+		return trim(tok);
+	}
+	*pos = tok + strcspn(tok, " \t");
+	if (**pos)
+		*(*pos)++ = '\0';
+	return tok;
+}
+
+/* Split the output of the last run into fields in a single pass. The output
+ * is cut up in place, the fields point into it. */
+static void shellcmd_split(struct osysmon_shellcmd *oc)
+{
+	const char **hdr = NULL;
+	unsigned int num_hdr = 0, row = 0, i;
+	struct shellcmd_field *f;
+	char *pos, *line, *nl, *sep, *tok, *row_name;
+
+	oc->last.num_fields = 0;
+	if (oc->cfg.split == SHELLCMD_SPLIT_NONE)
+		return;
+
+	for (pos = oc->last.output; *pos; pos = nl ? nl + 1 : line + strlen(line)) {
+		line = pos;
+		nl = strchr(line, '\n');
+		if (nl)
+			*nl = '\0';
+
+		switch (oc->cfg.split) {
+		case SHELLCMD_SPLIT_LINES:
+			f = shellcmd_add_field(oc);
+			f->row = ++row;
+			f->row_name = NULL;
+			f->key = NULL;
+			f->value = line;
+			break;
+		case SHELLCMD_SPLIT_KEY_VALUE:
+			sep = line + strcspn(line, "=:");
+			if (!*sep)
+				break;
+			*sep = '\0';
+			line = trim(line);
+			if (!*line)
+				break;
+			f = shellcmd_add_field(oc);
+			f->row = 0;
+			f->row_name = NULL;
+			f->key = line;
+			f->value = trim(sep + 1);
+			break;
+		case SHELLCMD_SPLIT_COLUMNS:
+			if (!num_hdr) {
+				/* the header row names the columns */
+				while ((tok = next_token(&line, false))) {
+					hdr = talloc_realloc(oc, hdr, const char *, num_hdr + 1);
+					OSMO_ASSERT(hdr);
+					hdr[num_hdr++] = tok;
+				}
+				break;
+			}
+			row_name = next_token(&line, num_hdr == 1);
+			if (!row_name)
+				break;
+			row++;
+			for (i = 0, tok = row_name; i < num_hdr && tok;
+			     tok = next_token(&line, i + 1 == num_hdr - 1), i++) {
+				f = shellcmd_add_field(oc);
+				f->row = row;
+				f->row_name = row_name;
+				f->key = hdr[i];
+				f->value = tok;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	talloc_free(hdr);
+}
+
+static void osysmon_shellcmd_publish(struct osysmon_shellcmd *oc, struct value_node *parent)
+{
+	struct value_node *vn, *vn_row = NULL;
+	const struct shellcmd_field *f;
+	unsigned int i, row = 0;
+
+	if (!oc->last.valid) {
+		value_node_add(parent, oc->cfg.name, "<PENDING>");
+		return;
+	}
+	if (!oc->last.output[0]) {
 		value_node_add(parent, oc->cfg.name, "<EMPTY>");
+		return;
+	}
+	if (oc->cfg.split == SHELLCMD_SPLIT_NONE || !oc->last.num_fields) {
+		value_node_add(parent, oc->cfg.name, oc->last.output);
+		return;
+	}
+
+	vn = value_node_add(parent, oc->cfg.name, NULL);
+	if (!vn)
+		return;
+
+	for (i = 0; i < oc->last.num_fields; i++) {
+		f = &oc->last.fields[i];
+		switch (oc->cfg.split) {
+		case SHELLCMD_SPLIT_LINES:
+			value_node_add(vn, talloc_asprintf(vn, "%u", f->row), f->value);
+			break;
+		case SHELLCMD_SPLIT_KEY_VALUE:
+			value_node_add(vn, f->key, f->value);
+			break;
+		case SHELLCMD_SPLIT_COLUMNS:
+			if (f->row != row) {
+				row = f->row;
+				/* rows are named by their first column, or by row
+				 * number if that isn't unique (e.g. 'tmpfs' in df) */
+				vn_row = value_node_add(vn, f->row_name, NULL);
+				if (!vn_row)
+					vn_row = value_node_add(vn, talloc_asprintf(vn, "%u", row), NULL);
+			}
+			if (vn_row)
+				value_node_add(vn_row, f->key, f->value);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void osysmon_shellcmd_stats(struct osysmon_shellcmd *oc, struct value_node *parent)
+{
+	struct value_node *vn;
+	char buf[32];
+
+	if (!oc->last.valid)
+		return;
+
+	vn = value_node_add(parent, oc->cfg.name, NULL);
+	if (oc->last.timed_out)
+		snprintf(buf, sizeof(buf), "timeout");
+	else if (WIFSIGNALED(oc->last.status))
+		snprintf(buf, sizeof(buf), "signal %d", WTERMSIG(oc->last.status));
+	else
+		snprintf(buf, sizeof(buf), "%d", WEXITSTATUS(oc->last.status));
+	value_node_add(vn, "exit", buf);
+	snprintf(buf, sizeof(buf), "%lu ms", oc->last.runtime_ms);
+	value_node_add(vn, "runtime", buf);
+	/* how old the output we report is */
+	snprintf(buf, sizeof(buf), "%ld s", ms_since(&oc->last.finished) / 1000);
+	value_node_add(vn, "age", buf);
+	snprintf(buf, sizeof(buf), "%zu", oc->last.len);
+	value_node_add(vn, "output-size", buf);
+	if (oc->last.truncated)
+		value_node_add(vn, "truncated", "yes");
+}
+
+/***********************************************************************
+ * Long-running commands printing "key value" lines
+ ***********************************************************************/
+
+/* longest line we accept from a stream command */
+#define SHELLCMD_STREAM_LINE_MAX 1024
+/* maximum number of distinct keys per stream command */
+#define SHELLCMD_STREAM_MAX_KEYS 256
+/* restart delay after the command exited, doubled on every restart ... */
+#define SHELLCMD_STREAM_BACKOFF_MIN 1
+/* ... up to this many seconds */
+#define SHELLCMD_STREAM_BACKOFF_MAX 300
+/* a command that ran for this many seconds is considered stable again */
+#define SHELLCMD_STREAM_STABLE_TIME 60
+
+struct shellcmd_stream_value {
+	struct llist_head list;
+	char *key;
+	char *value;
+};
+
+struct osysmon_shellcmd_stream {
+	struct llist_head list;
+	struct {
+		const char *name;
+		const char *cmd;
+	} cfg;
+
+	pid_t pid;
+	struct osmo_fd ofd;
+	struct timespec started;
+	/* (re)starts the command */
+	struct osmo_timer_list restart_timer;
+	unsigned int backoff;
+	unsigned int restarts;
+	int last_status;
+
+	/* partial line received so far */
+	char *rx;
+	size_t rx_len;
+	/* the current line is too long and being skipped */
+	bool rx_skip;
+
+	/* list of 'struct shellcmd_stream_value', in order of first appearance */
+	struct llist_head values;
+	unsigned int num_values;
+};
+
+static void shellcmd_stream_restart_cb(void *data);
+
+static struct osysmon_shellcmd_stream *osysmon_shellcmd_stream_find(const char *name)
+{
+	struct osysmon_shellcmd_stream *os;
+
+	llist_for_each_entry(os, &g_oss->shellcmd_streams, list) {
+		if (!strcmp(os->cfg.name, name))
+			return os;
+	}
+	return NULL;
+}
+
+static struct osysmon_shellcmd_stream *osysmon_shellcmd_stream_add(const char *name, const char *cmd)
+{
+	struct osysmon_shellcmd_stream *os;
+
+	if (osysmon_shellcmd_stream_find(name))
+		return NULL;
+
+	os = talloc_zero(g_oss, struct osysmon_shellcmd_stream);
+	OSMO_ASSERT(os);
+	os->cfg.name = talloc_strdup(os, name);
+	os->cfg.cmd = talloc_strdup(os, cmd);
+	os->ofd.fd = -1;
+	os->backoff = SHELLCMD_STREAM_BACKOFF_MIN;
+	os->rx = talloc_size(os, SHELLCMD_STREAM_LINE_MAX);
+	OSMO_ASSERT(os->rx);
+	INIT_LLIST_HEAD(&os->values);
+	/* not right away: we may still daemonize after reading the config */
+	osmo_timer_setup(&os->restart_timer, shellcmd_stream_restart_cb, os);
+	osmo_timer_schedule(&os->restart_timer, 0, 0);
+	llist_add_tail(&os->list, &g_oss->shellcmd_streams);
+	return os;
+}
+
+/* Kill the command and everything it started */
+static void shellcmd_stream_stop(struct osysmon_shellcmd_stream *os)
+{
+	if (os->ofd.fd < 0)
+		return;
+	osmo_fd_unregister(&os->ofd);
+	close(os->ofd.fd);
+	os->ofd.fd = -1;
+	shellcmd_kill(os->pid, &os->last_status);
+}
+
+static void osysmon_shellcmd_stream_destroy(struct osysmon_shellcmd_stream *os)
+{
+	shellcmd_stream_stop(os);
+	osmo_timer_del(&os->restart_timer);
+	llist_del(&os->list);
+	talloc_free(os);
+}
+
+static void shellcmd_stream_set(struct osysmon_shellcmd_stream *os, const char *key, const char *value)
+{
+	struct shellcmd_stream_value *sv;
+
+	llist_for_each_entry(sv, &os->values, list) {
+		if (!strcmp(sv->key, key)) {
+			if (strcmp(sv->value, value))
+				osmo_talloc_replace_string(sv, &sv->value, value);
+			return;
+		}
+	}
+
+	if (os->num_values >= SHELLCMD_STREAM_MAX_KEYS)
+		return;
+	sv = talloc_zero(os, struct shellcmd_stream_value);
+	OSMO_ASSERT(sv);
+	sv->key = talloc_strdup(sv, key);
+	sv->value = talloc_strdup(sv, value);
+	llist_add_tail(&sv->list, &os->values);
+	os->num_values++;
+}
+
+/* "key value with spaces" */
+static void shellcmd_stream_line(struct osysmon_shellcmd_stream *os, char *line)
+{
+	char *key, *value, *end;
+
+	key = line + strspn(line, " \t");
+	value = key + strcspn(key, " \t");
+	if (value == key)
+		return;
+	if (*value)
+		*value++ = '\0';
+	value += strspn(value, " \t");
+	end = value + strlen(value);
+	while (end > value && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r'))
+		*--end = '\0';
+	shellcmd_stream_set(os, key, value);
+}
+
+static void shellcmd_stream_exited(struct osysmon_shellcmd_stream *os)
+{
+	struct timespec now;
+
+	shellcmd_stream_stop(os);
+	os->restarts++;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec - os->started.tv_sec >= SHELLCMD_STREAM_STABLE_TIME)
+		os->backoff = SHELLCMD_STREAM_BACKOFF_MIN;
+	osmo_timer_schedule(&os->restart_timer, os->backoff, 0);
+	os->backoff *= 2;
+	if (os->backoff > SHELLCMD_STREAM_BACKOFF_MAX)
+		os->backoff = SHELLCMD_STREAM_BACKOFF_MAX;
+}
+
+static int shellcmd_stream_read_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct osysmon_shellcmd_stream *os = ofd->data;
+	char *line, *nl;
+	ssize_t rc;
+
+	rc = read(ofd->fd, os->rx + os->rx_len, SHELLCMD_STREAM_LINE_MAX - 1 - os->rx_len);
+	if (rc < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (rc <= 0) {
+		/* the last line may lack its newline */
+		os->rx[os->rx_len] = '\0';
+		if (os->rx_len && !os->rx_skip)
+			shellcmd_stream_line(os, os->rx);
+		/* a stream command closing stdout is of no further use */
+		shellcmd_stream_exited(os);
+		return 0;
+	}
+	os->rx_len += rc;
+	os->rx[os->rx_len] = '\0';
+
+	line = os->rx;
+	while ((nl = strchr(line, '\n'))) {
+		*nl = '\0';
+		if (!os->rx_skip)
+			shellcmd_stream_line(os, line);
+		os->rx_skip = false;
+		line = nl + 1;
+	}
+	os->rx_len -= line - os->rx;
+	memmove(os->rx, line, os->rx_len);
+
+	if (os->rx_len == SHELLCMD_STREAM_LINE_MAX - 1) {
+		os->rx_skip = true;
+		os->rx_len = 0;
+	}
+	return 0;
+}
+
+static void shellcmd_stream_restart_cb(void *data)
+{
+	struct osysmon_shellcmd_stream *os = data;
+	int fd;
+
+	clock_gettime(CLOCK_MONOTONIC, &os->started);
+	os->rx_len = 0;
+	os->rx_skip = false;
+
+	fd = spawn_sh(os->cfg.cmd, &os->pid);
+	if (fd < 0) {
+		osmo_timer_schedule(&os->restart_timer, os->backoff, 0);
+		return;
+	}
+	os->ofd.fd = fd;
+	os->ofd.when = BSC_FD_READ;
+	os->ofd.cb = shellcmd_stream_read_cb;
+	os->ofd.data = os;
+	osmo_fd_register(&os->ofd);
+}
+
+static void osysmon_shellcmd_stream_publish(struct osysmon_shellcmd_stream *os, struct value_node *parent)
+{
+	struct shellcmd_stream_value *sv;
+	struct value_node *vn;
+
+	if (llist_empty(&os->values)) {
+		value_node_add(parent, os->cfg.name, "<PENDING>");
+		return;
+	}
+
+	vn = value_node_add(parent, os->cfg.name, NULL);
+	if (!vn)
+		return;
+	llist_for_each_entry(sv, &os->values, list)
+		value_node_add(vn, sv->key, sv->value);
+}
+
+static void osysmon_shellcmd_stream_stats(struct osysmon_shellcmd_stream *os, struct value_node *parent)
+{
+	struct value_node *vn = value_node_add(parent, os->cfg.name, NULL);
+	char buf[32];
+
+	value_node_add(vn, "running", os->ofd.fd >= 0 ? "yes" : "no");
+	snprintf(buf, sizeof(buf), "%u", os->restarts);
+	value_node_add(vn, "restarts", buf);
+	if (os->ofd.fd >= 0) {
+		snprintf(buf, sizeof(buf), "%ld s", ms_since(&os->started) / 1000);
+		value_node_add(vn, "uptime", buf);
 	}
 }
 
@@ -106,13 +950,27 @@ static void osysmon_shellcmd_run(struct osysmon_shellcmd *oc, struct value_node
  * VTY
  ***********************************************************************/
 
+/* The telnet VTY has no authentication, and whoever can connect must not
+ * get to run commands as us */
+static bool shellcmd_vty_allowed(struct vty *vty)
+{
+	if (vty->type == VTY_FILE)
+		return true;
+	vty_out(vty, "%% Shell commands can only be configured in the config file%s", VTY_NEWLINE);
+	return false;
+}
+
 #define CMD_STR "Configure a shell command to be executed\n"
 DEFUN(cfg_shellcmd, cfg_shellcmd_cmd,
 	"shellcmd NAME .TEXT",
 	CMD_STR "Name of this shell command snippet\n" "Command to run\n")
 {
 	struct osysmon_shellcmd *oc;
-	char *concat = argv_concat(argv, argc, 1);
+	char *concat;
+
+	if (!shellcmd_vty_allowed(vty))
+		return CMD_WARNING;
+	concat = argv_concat(argv, argc, 1);
 	oc = osysmon_shellcmd_add(argv[0], concat);
 	talloc_free(concat);
 	if (!oc) {
@@ -136,11 +994,139 @@ DEFUN(cfg_no_shellcmd, cfg_no_shellcmd_cmd,
 	return CMD_SUCCESS;
 }
 
+/* separate from 'shellcmd NAME .TEXT', which would take them as a command */
+#define OPTION_STR "Configure a shell command added with 'shellcmd'\n"
+DEFUN(cfg_shellcmd_kill_after, cfg_shellcmd_kill_after_cmd,
+	"shellcmd-option NAME kill-after <1-3600>",
+	OPTION_STR "Name of this shell command snippet\n"
+	"Kill the command if it runs for longer than this\n" "Timeout in seconds\n")
+{
+	struct osysmon_shellcmd *oc;
+	oc = osysmon_shellcmd_find(argv[0]);
+	if (!oc) {
+		vty_out(vty, "Cannot find shell cmd for '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	oc->cfg.timeout = atoi(argv[1]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_shellcmd_interval, cfg_shellcmd_interval_cmd,
+	"shellcmd-option NAME interval (<1-86400>|once)",
+	OPTION_STR "Name of this shell command snippet\n"
+	"Configure how often the command is run, its output is reported until the next run\n"
+	"Interval in seconds\n" "Run only once, for commands whose output never changes\n")
+{
+	struct osysmon_shellcmd *oc;
+	oc = osysmon_shellcmd_find(argv[0]);
+	if (!oc) {
+		vty_out(vty, "Cannot find shell cmd for '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	if (!strcmp(argv[1], "once"))
+		oc->cfg.interval = 0;
+	else
+		oc->cfg.interval = atoi(argv[1]);
+
+	/* the first run is still pending, the new interval applies after it */
+	if (oc->state == SHELLCMD_IDLE && !oc->last.valid)
+		return CMD_SUCCESS;
+	if (oc->cfg.interval)
+		osmo_timer_schedule(&oc->run_timer, oc->cfg.interval, 0);
+	else
+		osmo_timer_del(&oc->run_timer);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_shellcmd_max_output, cfg_shellcmd_max_output_cmd,
+	"shellcmd-option NAME max-output <512-16777216>",
+	OPTION_STR "Name of this shell command snippet\n"
+	"Limit the amount of output captured, anything beyond is discarded\n"
+	"Size in bytes\n")
+{
+	struct osysmon_shellcmd *oc;
+	oc = osysmon_shellcmd_find(argv[0]);
+	if (!oc) {
+		vty_out(vty, "Cannot find shell cmd for '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	oc->cfg.max_output = atoi(argv[1]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_shellcmd_split, cfg_shellcmd_split_cmd,
+	"shellcmd-option NAME split (none|lines|key-value|columns)",
+	OPTION_STR "Name of this shell command snippet\n"
+	"Split the output into multiple values\n"
+	"Report the entire output as one value\n"
+	"One value per line, named by line number\n"
+	"'key=value' or 'key: value' lines\n"
+	"Header row naming whitespace separated columns, followed by data rows\n")
+{
+	struct osysmon_shellcmd *oc;
+	oc = osysmon_shellcmd_find(argv[0]);
+	if (!oc) {
+		vty_out(vty, "Cannot find shell cmd for '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	oc->cfg.split = get_string_value(shellcmd_split_names, argv[1]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_shellcmd_max_parallel, cfg_shellcmd_max_parallel_cmd,
+	"shellcmd-max-parallel <1-64>",
+	"Limit the number of shell commands running at the same time\n"
+	"Number of commands\n")
+{
+	shellcmd_max_parallel = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+#define STREAM_STR "Configure a long-running shell command printing 'key value' lines\n"
+DEFUN(cfg_shellcmd_stream, cfg_shellcmd_stream_cmd,
+	"shellcmd-stream NAME .TEXT",
+	STREAM_STR "Name of this shell command snippet\n" "Command to run\n")
+{
+	struct osysmon_shellcmd_stream *os;
+	char *concat;
+
+	if (!shellcmd_vty_allowed(vty))
+		return CMD_WARNING;
+	concat = argv_concat(argv, argc, 1);
+	os = osysmon_shellcmd_stream_add(argv[0], concat);
+	talloc_free(concat);
+	if (!os) {
+		vty_out(vty, "Couldn't add shell cmd, maybe it exists?%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_shellcmd_stream, cfg_no_shellcmd_stream_cmd,
+	"no shellcmd-stream NAME",
+	NO_STR STREAM_STR "Name of this shell command snippet\n")
+{
+	struct osysmon_shellcmd_stream *os;
+	os = osysmon_shellcmd_stream_find(argv[0]);
+	if (!os) {
+		vty_out(vty, "Cannot find shell cmd for '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	osysmon_shellcmd_stream_destroy(os);
+	return CMD_SUCCESS;
+}
 
 static void osysmon_shellcmd_vty_init(void)
 {
 	install_element(CONFIG_NODE, &cfg_shellcmd_cmd);
 	install_element(CONFIG_NODE, &cfg_no_shellcmd_cmd);
+	install_element(CONFIG_NODE, &cfg_shellcmd_kill_after_cmd);
+	install_element(CONFIG_NODE, &cfg_shellcmd_interval_cmd);
+	install_element(CONFIG_NODE, &cfg_shellcmd_max_output_cmd);
+	install_element(CONFIG_NODE, &cfg_shellcmd_split_cmd);
+	install_element(CONFIG_NODE, &cfg_shellcmd_max_parallel_cmd);
+	install_element(CONFIG_NODE, &cfg_shellcmd_stream_cmd);
+	install_element(CONFIG_NODE, &cfg_no_shellcmd_stream_cmd);
 }
 
 /***********************************************************************
@@ -150,23 +1136,50 @@ static void osysmon_shellcmd_vty_init(void)
 /* called once on startup before config file parsing */
 int osysmon_shellcmd_init()
 {
+	osmo_timer_setup(&shellcmd_orphan_timer, shellcmd_orphan_timer_cb, NULL);
 	osysmon_shellcmd_vty_init();
 	return 0;
 }
 
-/* called periodically */
+/* Are there commands which haven't completed their first run yet? */
+bool osysmon_shellcmd_busy(void)
+{
+	struct osysmon_shellcmd *oc;
+
+	llist_for_each_entry(oc, &g_oss->shellcmds, list) {
+		if (!oc->last.valid)
+			return true;
+	}
+	return false;
+}
+
+/* called periodically. The commands run asynchronously on their own timers,
+ * we only report the result of the last completed run here. */
 int osysmon_shellcmd_poll(struct value_node *parent)
 {
-	struct value_node *vn_file;
+	struct value_node *vn_file, *vn_stats;
+	struct osysmon_shellcmd_stream *os;
 	struct osysmon_shellcmd *oc;
 
+	if (!llist_empty(&g_oss->shellcmd_streams)) {
+		vn_file = value_node_add(parent, "shellcmd-stream", NULL);
+		vn_stats = value_node_add(parent, "shellcmd-stream-stats", NULL);
+		llist_for_each_entry(os, &g_oss->shellcmd_streams, list) {
+			osysmon_shellcmd_stream_publish(os, vn_file);
+			osysmon_shellcmd_stream_stats(os, vn_stats);
+		}
+	}
+
 	if (llist_empty(&g_oss->shellcmds))
 		return 0;
 
 	vn_file = value_node_add(parent, "shellcmd", NULL);
+	vn_stats = value_node_add(parent, "shellcmd-stats", NULL);
 
-	llist_for_each_entry(oc, &g_oss->shellcmds, list)
-		osysmon_shellcmd_run(oc, vn_file);
+	llist_for_each_entry(oc, &g_oss->shellcmds, list) {
+		osysmon_shellcmd_publish(oc, vn_file);
+		osysmon_shellcmd_stats(oc, vn_stats);
+	}
 
 	return 0;
 }
@@ -0,0 +1,240 @@
+/* Simple Osmocom System Monitor (osysmon): shared memory snapshot */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Every completed tree is flattened into private buffers first, and then
+ * copied into the shared mapping inside the seqlock, which keeps the window
+ * in which readers have to retry as short as possible. See osysmon_shm.h for
+ * the layout and the reader side. */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "render.h"
+#include "osysmon_shm.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define SHM_MIN_SIZE	65536
+
+static struct {
+	char *path;
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+	/* the flattened tree, re-used every tick */
+	struct render_buf *nodes;
+	struct render_buf *strings;
+} shm = {
+	.fd = -1,
+};
+
+static void shm_close(void)
+{
+	if (shm.map)
+		munmap(shm.map, shm.map_size);
+	if (shm.fd >= 0)
+		close(shm.fd);
+	shm.map = NULL;
+	shm.map_size = 0;
+	shm.fd = -1;
+	TALLOC_FREE(shm.path);
+}
+
+/* Map at least size bytes of the file, growing it if needed. It is never
+ * shrunk: readers would get SIGBUS accessing what they still have mapped. */
+static int shm_map(size_t size)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(shm.fd, &st) < 0)
+		return -errno;
+	if (st.st_size > size)
+		size = st.st_size;
+	size = (size + SHM_MIN_SIZE - 1) / SHM_MIN_SIZE * SHM_MIN_SIZE;
+	if (size > st.st_size && ftruncate(shm.fd, size) < 0)
+		return -errno;
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm.fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+	if (shm.map)
+		munmap(shm.map, shm.map_size);
+	shm.map = map;
+	shm.map_size = size;
+	return 0;
+}
+
+/* An existing file is re-used, so that readers which have it open already
+ * keep working across a restart of osmo-sysmon */
+static int shm_open_path(const char *path)
+{
+	struct osysmon_shm_hdr *hdr;
+	int rc;
+
+	shm_close();
+	shm.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (shm.fd < 0)
+		return -errno;
+	rc = shm_map(SHM_MIN_SIZE);
+	if (rc < 0) {
+		close(shm.fd);
+		shm.fd = -1;
+		return rc;
+	}
+
+	hdr = (struct osysmon_shm_hdr *)shm.map;
+	if (hdr->magic != OSYSMON_SHM_MAGIC || hdr->version != OSYSMON_SHM_VERSION) {
+		memset(hdr, 0, sizeof(*hdr));
+		hdr->magic = OSYSMON_SHM_MAGIC;
+		hdr->version = OSYSMON_SHM_VERSION;
+	}
+	/* we died while writing */
+	if (hdr->seq & 1)
+		hdr->seq++;
+	hdr->size = shm.map_size;
+
+	shm.path = talloc_strdup(g_oss, path);
+	if (!shm.nodes) {
+		shm.nodes = render_buf_alloc(g_oss, 4096);
+		shm.strings = render_buf_alloc(g_oss, 4096);
+	}
+	return 0;
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define SHM_STR "Publish every completed tree as shared memory snapshot\n"
+DEFUN(cfg_shm_snapshot, cfg_shm_snapshot_cmd,
+	"shm-snapshot PATH",
+	SHM_STR "File to map, preferably on tmpfs (e.g. /dev/shm/osmo-sysmon)\n")
+{
+	int rc = shm_open_path(argv[0]);
+	if (rc < 0) {
+		vty_out(vty, "Cannot map %s: %s%s", argv[0], strerror(-rc), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_shm_snapshot, cfg_no_shm_snapshot_cmd,
+	"no shm-snapshot",
+	NO_STR SHM_STR)
+{
+	shm_close();
+	return CMD_SUCCESS;
+}
+
+static void osysmon_shm_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_shm_snapshot_cmd);
+	install_element(CONFIG_NODE, &cfg_no_shm_snapshot_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+static uint32_t shm_add_string(const char *str)
+{
+	uint32_t off = shm.strings->len;
+
+	render_buf_append(shm.strings, str, strlen(str) + 1);
+	return off;
+}
+
+/* Append node and its subtree in depth-first order */
+static void shm_flatten(const struct value_node *node)
+{
+	struct osysmon_shm_node sn = {}, *psn;
+	const struct value_node *vn;
+	uint32_t idx = shm.nodes->len / sizeof(sn);
+
+	sn.name = shm_add_string(node->name);
+	sn.value = node->value ? shm_add_string(node->value) : OSYSMON_SHM_NONE;
+	render_buf_append(shm.nodes, &sn, sizeof(sn));
+
+	llist_for_each_entry(vn, &node->children, list) {
+		shm_flatten(vn);
+		sn.num_children++;
+	}
+
+	/* the buffer may have moved */
+	psn = (struct osysmon_shm_node *)shm.nodes->data + idx;
+	psn->num_children = sn.num_children;
+	psn->subtree = shm.nodes->len / sizeof(sn) - idx;
+}
+
+/* called once on startup before config file parsing */
+int osysmon_shm_init()
+{
+	osysmon_shm_vty_init();
+	return 0;
+}
+
+/* called with every completed tree */
+void osysmon_shm_update(struct value_node *root)
+{
+	struct osysmon_shm_hdr *hdr;
+	struct timespec ts;
+	size_t nodes_off, strings_off, size;
+
+	if (!shm.map)
+		return;
+
+	render_buf_reset(shm.nodes);
+	render_buf_reset(shm.strings);
+	shm_flatten(root);
+
+	nodes_off = sizeof(*hdr);
+	strings_off = nodes_off + shm.nodes->len;
+	size = strings_off + shm.strings->len;
+	if (size > shm.map_size && shm_map(size) < 0)
+		return;
+	hdr = (struct osysmon_shm_hdr *)shm.map;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	__atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	hdr->size = shm.map_size;
+	hdr->timestamp_us = ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	hdr->nodes_off = nodes_off;
+	hdr->num_nodes = shm.nodes->len / sizeof(struct osysmon_shm_node);
+	hdr->strings_off = strings_off;
+	hdr->strings_len = shm.strings->len;
+	memcpy(shm.map + nodes_off, shm.nodes->data, shm.nodes->len);
+	memcpy(shm.map + strings_off, shm.strings->data, shm.strings->len);
+
+	__atomic_store_n(&hdr->seq, hdr->seq + 1, __ATOMIC_RELEASE);
+}
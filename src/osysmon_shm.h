@@ -0,0 +1,243 @@
+#pragma once
+
+/* Layout of the shared memory snapshot of the value tree, which osmo-sysmon
+ * writes with "shm-snapshot PATH", and a self-contained reader for it: other
+ * programs only need this header, no library.
+ *
+ * A reader looks at the values right in the mapping, without copying them,
+ * and checks afterwards whether osmo-sysmon wrote a new snapshot meanwhile
+ * (seqlock):
+ *
+ *	struct osysmon_shm_reader r;
+ *	const struct osysmon_shm_hdr *hdr;
+ *	uint32_t seq;
+ *
+ *	osysmon_shm_open(&r, "/dev/shm/osmo-sysmon");
+ *	do {
+ *		hdr = osysmon_shm_begin(&r, &seq);
+ *		... osysmon_shm_find(&r, hdr, "netdev/eth0/rx-bytes") ...
+ *	} while (osysmon_shm_retry(&r, seq));
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define OSYSMON_SHM_MAGIC	0x4d59534f	/* "OSYM" */
+#define OSYSMON_SHM_VERSION	1
+#define OSYSMON_SHM_NONE	0xffffffff
+
+struct osysmon_shm_hdr {
+	uint32_t magic;
+	uint32_t version;
+	/* size of the file, it only ever grows */
+	uint32_t size;
+	/* odd while a snapshot is being written */
+	uint32_t seq;
+	/* CLOCK_REALTIME when the snapshot was taken */
+	uint64_t timestamp_us;
+	/* struct osysmon_shm_node[num_nodes] in depth-first order, [0] is
+	 * the root */
+	uint32_t nodes_off;
+	uint32_t num_nodes;
+	/* NUL-terminated names and values */
+	uint32_t strings_off;
+	uint32_t strings_len;
+};
+
+struct osysmon_shm_node {
+	/* offsets into the strings */
+	uint32_t name;
+	/* OSYSMON_SHM_NONE for nodes with children */
+	uint32_t value;
+	uint32_t num_children;
+	/* number of nodes in the subtree incl. this one: the first child of
+	 * node i is i + 1, its next sibling i + subtree */
+	uint32_t subtree;
+};
+
+struct osysmon_shm_reader {
+	int fd;
+	const uint8_t *map;
+	size_t map_size;
+};
+
+static inline int osysmon_shm_map(struct osysmon_shm_reader *r)
+{
+	struct stat st;
+	void *map;
+
+	if (fstat(r->fd, &st) < 0)
+		return -errno;
+	if (st.st_size < (off_t)sizeof(struct osysmon_shm_hdr))
+		return -ENODATA;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (map == MAP_FAILED)
+		return -errno;
+	if (r->map)
+		munmap((void *)r->map, r->map_size);
+	r->map = map;
+	r->map_size = st.st_size;
+	return 0;
+}
+
+static inline int osysmon_shm_open(struct osysmon_shm_reader *r, const char *path)
+{
+	int rc;
+
+	r->map = NULL;
+	r->map_size = 0;
+	r->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (r->fd < 0)
+		return -errno;
+	rc = osysmon_shm_map(r);
+	if (rc < 0) {
+		close(r->fd);
+		r->fd = -1;
+	}
+	return rc;
+}
+
+static inline void osysmon_shm_close(struct osysmon_shm_reader *r)
+{
+	if (r->map)
+		munmap((void *)r->map, r->map_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	r->map = NULL;
+	r->fd = -1;
+}
+
+/* Start reading a snapshot. Returns NULL while there is none or one is being
+ * written; everything read from it is only valid if osysmon_shm_retry()
+ * returns false afterwards. */
+static inline const struct osysmon_shm_hdr *osysmon_shm_begin(struct osysmon_shm_reader *r, uint32_t *seq)
+{
+	const struct osysmon_shm_hdr *hdr = (const struct osysmon_shm_hdr *)r->map;
+
+	*seq = 0;
+	if (!hdr)
+		return NULL;
+	*seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+	if ((*seq & 1) || hdr->magic != OSYSMON_SHM_MAGIC || hdr->version != OSYSMON_SHM_VERSION)
+		return NULL;
+	/* the file grew since we mapped it */
+	if (hdr->size > r->map_size) {
+		if (osysmon_shm_map(r) < 0)
+			return NULL;
+		hdr = (const struct osysmon_shm_hdr *)r->map;
+	}
+	if (!hdr->num_nodes)
+		return NULL;
+	return hdr;
+}
+
+static inline bool osysmon_shm_retry(const struct osysmon_shm_reader *r, uint32_t seq)
+{
+	const struct osysmon_shm_hdr *hdr = (const struct osysmon_shm_hdr *)r->map;
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return !hdr || (seq & 1) || __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/* The accessors below never read outside the mapping, even if the snapshot
+ * changes underneath: they return NULL / "" for anything out of bounds */
+static inline const struct osysmon_shm_node *osysmon_shm_node(const struct osysmon_shm_reader *r,
+							      const struct osysmon_shm_hdr *hdr,
+							      uint32_t idx)
+{
+	uint64_t off = hdr->nodes_off + (uint64_t)idx * sizeof(struct osysmon_shm_node);
+
+	if (idx >= hdr->num_nodes || off + sizeof(struct osysmon_shm_node) > r->map_size)
+		return NULL;
+	return (const struct osysmon_shm_node *)(r->map + off);
+}
+
+static inline const char *osysmon_shm_str(const struct osysmon_shm_reader *r,
+					  const struct osysmon_shm_hdr *hdr, uint32_t off)
+{
+	uint64_t start = (uint64_t)hdr->strings_off + off;
+	uint64_t end = (uint64_t)hdr->strings_off + hdr->strings_len;
+
+	if (off == OSYSMON_SHM_NONE || off >= hdr->strings_len || end > r->map_size ||
+	    !memchr(r->map + start, '\0', end - start))
+		return "";
+	return (const char *)r->map + start;
+}
+
+/* Look up a node by its path below the root, e.g. "netdev/eth0/rx-bytes".
+ * Returns its index or -ENOENT. */
+static inline int osysmon_shm_find(const struct osysmon_shm_reader *r,
+				   const struct osysmon_shm_hdr *hdr, const char *path)
+{
+	const struct osysmon_shm_node *node;
+	uint32_t idx = 0, i, num;
+	size_t len;
+
+	while (*path) {
+		len = strcspn(path, "/");
+		node = osysmon_shm_node(r, hdr, idx);
+		if (!node)
+			return -ENOENT;
+		num = node->num_children;
+		for (i = 0, idx++; i < num; i++) {
+			node = osysmon_shm_node(r, hdr, idx);
+			if (!node || !node->subtree)
+				return -ENOENT;
+			if (!strncmp(osysmon_shm_str(r, hdr, node->name), path, len) &&
+			    osysmon_shm_str(r, hdr, node->name)[len] == '\0')
+				break;
+			idx += node->subtree;
+		}
+		if (i == num)
+			return -ENOENT;
+		path += len;
+		if (*path == '/')
+			path++;
+	}
+	return idx;
+}
+
+/* Copy the value at path into buf. Returns 0, -ENOENT, -EISDIR if the node
+ * has children, -ENOSPC if buf is too small, -ENODATA if there is no snapshot
+ * or -EAGAIN if no consistent one could be read. */
+static inline int osysmon_shm_get(struct osysmon_shm_reader *r, const char *path, char *buf, size_t len)
+{
+	const struct osysmon_shm_hdr *hdr;
+	const struct osysmon_shm_node *node;
+	const char *val;
+	uint32_t seq;
+	int tries, idx, rc;
+
+	for (tries = 0; tries < 100; tries++) {
+		hdr = osysmon_shm_begin(r, &seq);
+		if (!hdr) {
+			if (!(seq & 1))
+				return -ENODATA;
+			/* being written, which takes a few microseconds */
+			sched_yield();
+			continue;
+		}
+		idx = osysmon_shm_find(r, hdr, path);
+		node = idx >= 0 ? osysmon_shm_node(r, hdr, idx) : NULL;
+		if (!node) {
+			rc = -ENOENT;
+		} else if (node->value == OSYSMON_SHM_NONE) {
+			rc = -EISDIR;
+		} else {
+			val = osysmon_shm_str(r, hdr, node->value);
+			rc = strlen(val) < len ? 0 : -ENOSPC;
+			if (!rc)
+				strcpy(buf, val);
+		}
+		if (!osysmon_shm_retry(r, seq))
+			return rc;
+	}
+	return -EAGAIN;
+}
@@ -0,0 +1,363 @@
+/* Simple Osmocom System Monitor (osysmon): StatsD / Graphite push exporter */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Numeric leaves are pushed as gauges ("ctrl-client.bsc.bts.0.rf_state:1|g")
+ * or Graphite plaintext lines ("... 1 1560000000") over UDP, as many lines
+ * per datagram as fit into the configured MTU, so a tick costs one send()
+ * per datagram rather than per value. Only leaves which changed since the
+ * last tick are sent, plus all of them every 'statsd-refresh' seconds.
+ * Leaves which don't fit into the byte budget stay pending for the next
+ * tick, the next tick continuing where this one stopped. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <osmocom/core/socket.h>
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "leaf_table.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define STATSD_DEFAULT_MTU	1432
+#define STATSD_DEFAULT_REFRESH	60
+#define STATSD_MAX_MTU		65507
+#define STATSD_LINE_MAX		640
+
+enum statsd_protocol {
+	STATSD_PROTO_STATSD,
+	STATSD_PROTO_GRAPHITE,
+};
+
+static const struct value_string statsd_protocol_names[] = {
+	{ STATSD_PROTO_STATSD, "statsd" },
+	{ STATSD_PROTO_GRAPHITE, "graphite" },
+	{ 0, NULL }
+};
+
+static struct {
+	struct {
+		char *host;
+		uint16_t port;
+		enum statsd_protocol proto;
+		char *prefix;
+		unsigned int mtu;
+		unsigned int refresh;
+		/* bytes per second, 0 for no limit */
+		unsigned int budget;
+	} cfg;
+	int fd;
+
+	/* token bucket of the byte budget, holding up to one second */
+	double tokens;
+	struct timespec last_fill;
+	time_t last_refresh;
+	/* position in g_oss->leaves to continue at, after running out of
+	 * budget */
+	unsigned int cursor;
+
+	char dgram[STATSD_MAX_MTU];
+	size_t dgram_len;
+} statsd = {
+	.cfg = {
+		.mtu = STATSD_DEFAULT_MTU,
+		.refresh = STATSD_DEFAULT_REFRESH,
+	},
+	.fd = -1,
+};
+
+static void statsd_close(void)
+{
+	if (statsd.fd >= 0)
+		close(statsd.fd);
+	statsd.fd = -1;
+}
+
+static int statsd_connect(const char *host, uint16_t port)
+{
+	int fd;
+
+	fd = osmo_sock_init(AF_UNSPEC, SOCK_DGRAM, IPPROTO_UDP, host, port,
+			    OSMO_SOCK_F_CONNECT | OSMO_SOCK_F_NONBLOCK);
+	if (fd < 0)
+		return fd;
+
+	statsd_close();
+	statsd.fd = fd;
+	osmo_talloc_replace_string(g_oss, &statsd.cfg.host, host);
+	statsd.cfg.port = port;
+	/* start with a full refresh */
+	statsd.last_refresh = 0;
+	statsd.tokens = statsd.cfg.budget;
+	statsd.cursor = 0;
+	return 0;
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define STATSD_STR "Push the numeric values to a StatsD or Graphite server via UDP\n"
+DEFUN(cfg_statsd_server, cfg_statsd_server_cmd,
+	"statsd-server HOST <1-65535>",
+	STATSD_STR "Host name or IP address of the server\n" "UDP port (StatsD 8125, Graphite 2003)\n")
+{
+	if (statsd_connect(argv[0], atoi(argv[1])) < 0) {
+		vty_out(vty, "Cannot connect to %s:%s%s", argv[0], argv[1], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	if (!g_oss->leaves)
+		g_oss->leaves = leaf_table_alloc(g_oss);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_statsd_server, cfg_no_statsd_server_cmd,
+	"no statsd-server",
+	NO_STR STATSD_STR)
+{
+	statsd_close();
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_statsd_protocol, cfg_statsd_protocol_cmd,
+	"statsd-protocol (statsd|graphite)",
+	"Line protocol to push with\n"
+	"StatsD gauges, NAME:VALUE|g (default)\n"
+	"Graphite plaintext, NAME VALUE TIMESTAMP\n")
+{
+	statsd.cfg.proto = get_string_value(statsd_protocol_names, argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_statsd_prefix, cfg_statsd_prefix_cmd,
+	"statsd-prefix PREFIX",
+	"Prefix the metric names, e.g. with the name of the site\n"
+	"Prefix, separated from the names by a dot\n")
+{
+	osmo_talloc_replace_string(g_oss, &statsd.cfg.prefix, argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_statsd_prefix, cfg_no_statsd_prefix_cmd,
+	"no statsd-prefix",
+	NO_STR "Prefix the metric names\n")
+{
+	TALLOC_FREE(statsd.cfg.prefix);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_statsd_mtu, cfg_statsd_mtu_cmd,
+	"statsd-mtu <64-65507>",
+	"Maximum size of the datagrams\n"
+	"Size of the UDP payload in bytes (default 1432)\n")
+{
+	statsd.cfg.mtu = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_statsd_refresh, cfg_statsd_refresh_cmd,
+	"statsd-refresh <0-86400>",
+	"Send all values periodically, not only the changed ones\n"
+	"Interval in seconds, 0 to never do so (default 60)\n")
+{
+	statsd.cfg.refresh = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_statsd_budget, cfg_statsd_budget_cmd,
+	"statsd-budget <0-1000000000>",
+	"Limit the bytes sent per second, values over the limit are sent later\n"
+	"Bytes of UDP payload per second, 0 for no limit (default)\n")
+{
+	statsd.cfg.budget = atoi(argv[0]);
+	statsd.tokens = statsd.cfg.budget;
+	return CMD_SUCCESS;
+}
+
+static void osysmon_statsd_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_statsd_server_cmd);
+	install_element(CONFIG_NODE, &cfg_no_statsd_server_cmd);
+	install_element(CONFIG_NODE, &cfg_statsd_protocol_cmd);
+	install_element(CONFIG_NODE, &cfg_statsd_prefix_cmd);
+	install_element(CONFIG_NODE, &cfg_no_statsd_prefix_cmd);
+	install_element(CONFIG_NODE, &cfg_statsd_mtu_cmd);
+	install_element(CONFIG_NODE, &cfg_statsd_refresh_cmd);
+	install_element(CONFIG_NODE, &cfg_statsd_budget_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+/* "ctrl-client/bsc/bts.0.rf_state" -> "ctrl-client.bsc.bts.0.rf_state",
+ * anything else that has a meaning in the line protocols becomes '_' */
+static int metric_name(char *buf, size_t size, const char *path)
+{
+	size_t len = 0;
+
+	if (statsd.cfg.prefix)
+		len = snprintf(buf, size, "%s.", statsd.cfg.prefix);
+	for (; *path && len + 1 < size; path++) {
+		if (*path == '/')
+			buf[len++] = '.';
+		else if ((*path >= 'a' && *path <= 'z') || (*path >= 'A' && *path <= 'Z') ||
+			 (*path >= '0' && *path <= '9') || *path == '.' || *path == '-' || *path == '_')
+			buf[len++] = *path;
+		else
+			buf[len++] = '_';
+	}
+	if (*path || len >= size)
+		return -ENOSPC;
+	buf[len] = '\0';
+	return len;
+}
+
+static int format_line(char *buf, size_t size, const struct leaf *l, double val, time_t now)
+{
+	char name[STATSD_LINE_MAX / 2];
+
+	if (metric_name(name, sizeof(name), l->path) < 0)
+		return -ENOSPC;
+	if (statsd.cfg.proto == STATSD_PROTO_GRAPHITE)
+		return snprintf(buf, size, "%s %.15g %lld\n", name, val, (long long)now);
+	/* a signed gauge value is a relative change in StatsD */
+	if (val < 0)
+		return snprintf(buf, size, "%s:0|g\n%s:%.15g|g\n", name, name, val);
+	return snprintf(buf, size, "%s:%.15g|g\n", name, val);
+}
+
+static void statsd_flush(void)
+{
+	if (!statsd.dgram_len)
+		return;
+	/* it's UDP, errors like ECONNREFUSED or EAGAIN just lose this one */
+	send(statsd.fd, statsd.dgram, statsd.dgram_len, 0);
+	statsd.dgram_len = 0;
+}
+
+/* Returns false if the line doesn't fit into the budget. A line longer than
+ * the whole budget goes out once the bucket is full, taking it negative, so
+ * it doesn't stay pending forever. */
+static bool statsd_add(const char *line, size_t len)
+{
+	if (statsd.cfg.budget && statsd.tokens < len && statsd.tokens < statsd.cfg.budget)
+		return false;
+	if (statsd.dgram_len + len > statsd.cfg.mtu)
+		statsd_flush();
+	memcpy(statsd.dgram + statsd.dgram_len, line, len);
+	statsd.dgram_len += len;
+	statsd.tokens -= len;
+	return true;
+}
+
+static void statsd_fill_budget(void)
+{
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - statsd.last_fill.tv_sec) + (now.tv_nsec - statsd.last_fill.tv_nsec) / 1e9;
+	statsd.last_fill = now;
+	statsd.tokens = OSMO_MIN(statsd.cfg.budget, statsd.tokens + elapsed * statsd.cfg.budget);
+}
+
+/* Returns false if it didn't fit into the budget, it stays pending then */
+static bool statsd_send_leaf(struct leaf *l, time_t now)
+{
+	char line[STATSD_LINE_MAX];
+	double val;
+	int len;
+
+	if (leaf_number(l, &val) && isfinite(val)) {
+		len = format_line(line, sizeof(line), l, val, now);
+		if (len > 0 && len < sizeof(line) && !statsd_add(line, len))
+			return false;
+	}
+	l->statsd_pending = false;
+	return true;
+}
+
+/* Send the pending leaves from index from up to to (exclusive). Returns the
+ * index of the first one that didn't fit into the budget, or -1. */
+static int statsd_send_range(unsigned int from, unsigned int to, time_t now)
+{
+	unsigned int i = 0;
+	struct leaf *l;
+
+	llist_for_each_entry(l, &g_oss->leaves->leaves, list) {
+		if (i >= to)
+			break;
+		if (i >= from && l->statsd_pending && !statsd_send_leaf(l, now))
+			return i;
+		i++;
+	}
+	return -1;
+}
+
+/* called once on startup before config file parsing */
+int osysmon_statsd_init()
+{
+	osysmon_statsd_vty_init();
+	return 0;
+}
+
+/* called with every completed tree, after g_oss->leaves was updated */
+void osysmon_statsd_update(struct value_node *root)
+{
+	struct leaf *l;
+	time_t now;
+	int stop;
+
+	if (statsd.fd < 0)
+		return;
+
+	now = time(NULL);
+	llist_for_each_entry(l, &g_oss->leaves->changed, changed)
+		l->statsd_pending = true;
+	if (statsd.cfg.refresh && now - statsd.last_refresh >= statsd.cfg.refresh) {
+		llist_for_each_entry(l, &g_oss->leaves->leaves, list)
+			l->statsd_pending = true;
+		statsd.last_refresh = now;
+	}
+	if (statsd.cfg.budget)
+		statsd_fill_budget();
+
+	/* continue where the budget ran out the last time, so that the leaves
+	 * at the end of the tree get their turn as well */
+	if (statsd.cursor >= g_oss->leaves->num_leaves)
+		statsd.cursor = 0;
+	stop = statsd_send_range(statsd.cursor, UINT_MAX, now);
+	if (stop < 0)
+		stop = statsd_send_range(0, statsd.cursor, now);
+	statsd.cursor = stop < 0 ? 0 : stop;
+	statsd_flush();
+}
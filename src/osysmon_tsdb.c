@@ -0,0 +1,557 @@
+/* Simple Osmocom System Monitor (osysmon): on-disk time series store */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Every tick, the numeric leaves are appended to the current block of a
+ * preallocated, mmap'd ring of blocks (see tsdb.h for the encoding). Once the
+ * ring is full, the oldest block is overwritten, so the size of the store is
+ * fixed. Blocks are only appended to, and the mapping is synced every
+ * 'tsdb-sync-interval' seconds and when a block is full: with a longer
+ * interval, fewer rewrites of the same partially filled flash page. The paths
+ * of the series are kept in the append-only catalog PATH.series. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <osmocom/core/timer.h>
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "leaf_table.h"
+#include "tsdb.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define TSDB_BLOCK_SIZE			65536
+#define TSDB_DEFAULT_MAX_SIZE		16
+#define TSDB_DEFAULT_SYNC_INTERVAL	60
+
+static struct {
+	char *path;
+	/* in MiB */
+	unsigned int max_size;
+	unsigned int sync_interval;
+	struct osmo_timer_list sync_timer;
+
+	int fd;
+	uint8_t *map;
+	size_t map_size;
+	uint32_t num_blocks;
+	/* block appended to, 0 if none yet */
+	uint32_t block;
+	uint32_t seq;
+	struct tsdb_codec *codec;
+
+	/* path of each series, index is the id - 1 */
+	FILE *catalog;
+	char **series;
+	uint32_t num_series;
+	bool catalog_dirty;
+	/* don't retry every tick, until reconfigured */
+	bool open_failed;
+
+	/* collected every tick */
+	uint32_t *ids;
+	double *values;
+	uint32_t alloc;
+
+	/* modified since the last sync: the header and data bytes of the
+	 * current block */
+	bool hdr_dirty;
+	size_t dirty_lo;
+	size_t dirty_hi;
+
+	struct {
+		uint64_t samples;
+		/* encoded, including the block headers */
+		uint64_t bytes;
+		/* synced to disk, in whole pages */
+		uint64_t written;
+		uint64_t dropped;
+	} stats;
+} tsdb = {
+	.max_size = TSDB_DEFAULT_MAX_SIZE,
+	.sync_interval = TSDB_DEFAULT_SYNC_INTERVAL,
+	.fd = -1,
+};
+
+static struct tsdb_block_hdr *block_hdr(uint32_t block)
+{
+	return (struct tsdb_block_hdr *)(tsdb.map + (size_t)block * TSDB_BLOCK_SIZE);
+}
+
+static uint8_t *block_data(uint32_t block)
+{
+	return (uint8_t *)(block_hdr(block) + 1);
+}
+
+#define TSDB_BLOCK_BITS	((TSDB_BLOCK_SIZE - sizeof(struct tsdb_block_hdr)) * 8)
+
+static void tsdb_sync(bool wait);
+
+static void tsdb_close(void)
+{
+	struct leaf *l;
+
+	if (tsdb.map) {
+		tsdb_sync(true);
+		munmap(tsdb.map, tsdb.map_size);
+	}
+	if (tsdb.fd >= 0)
+		close(tsdb.fd);
+	if (tsdb.catalog)
+		fclose(tsdb.catalog);
+	TALLOC_FREE(tsdb.series);
+	tsdb.num_series = 0;
+	tsdb.catalog = NULL;
+	tsdb.map = NULL;
+	tsdb.map_size = 0;
+	tsdb.fd = -1;
+	tsdb.block = 0;
+	osmo_timer_del(&tsdb.sync_timer);
+	memset(&tsdb.stats, 0, sizeof(tsdb.stats));
+
+	/* ids are per catalog */
+	if (g_oss->leaves) {
+		llist_for_each_entry(l, &g_oss->leaves->leaves, list)
+			l->tsdb_id = 0;
+	}
+}
+
+static int catalog_add(const char *path)
+{
+	char **series;
+
+	series = talloc_realloc(g_oss, tsdb.series, char *, tsdb.num_series + 1);
+	if (!series)
+		return -ENOMEM;
+	tsdb.series = series;
+	tsdb.series[tsdb.num_series++] = talloc_strdup(tsdb.series, path);
+	return tsdb.num_series;
+}
+
+static int catalog_open(const char *path)
+{
+	char *fname = talloc_asprintf(g_oss, "%s.series", path);
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	tsdb.catalog = fopen(fname, "a+e");
+	talloc_free(fname);
+	if (!tsdb.catalog)
+		return -errno;
+
+	while ((len = getline(&line, &size, tsdb.catalog)) > 0) {
+		if (line[len - 1] == '\n')
+			line[len - 1] = '\0';
+		catalog_add(line);
+	}
+	free(line);
+
+	/* a line torn by a crash was never referenced, as the catalog is
+	 * synced before the blocks; it still occupies its id */
+	fseek(tsdb.catalog, 0, SEEK_END);
+	if (ftell(tsdb.catalog) > 0) {
+		fseek(tsdb.catalog, -1, SEEK_END);
+		if (fgetc(tsdb.catalog) != '\n')
+			fputc('\n', tsdb.catalog);
+	}
+	return 0;
+}
+
+/* Leaves are only looked up when first seen, which is rare enough for a
+ * linear search */
+static uint32_t catalog_id(const char *path)
+{
+	uint32_t i;
+	int id;
+
+	for (i = 0; i < tsdb.num_series; i++) {
+		if (!strcmp(tsdb.series[i], path))
+			return i + 1;
+	}
+	id = catalog_add(path);
+	if (id < 0 || fprintf(tsdb.catalog, "%s\n", path) < 0)
+		return 0;
+	tsdb.catalog_dirty = true;
+	return id;
+}
+
+/* A new store gets 'tsdb-max-size', an existing one keeps its size: it holds
+ * what happened before a crash or reboot, so it is never started over
+ * implicitly. A file that isn't a store of this version is left alone. */
+static int tsdb_open(const char *path)
+{
+	struct tsdb_file_hdr *fh, hdr;
+	struct stat st;
+	bool init;
+	size_t size;
+	uint32_t i;
+	int rc;
+
+	tsdb_close();
+	tsdb.fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (tsdb.fd < 0)
+		goto err_errno;
+	if (fstat(tsdb.fd, &st) < 0)
+		goto err_errno;
+
+	init = st.st_size == 0;
+	if (init) {
+		tsdb.num_blocks = (size_t)tsdb.max_size * 1024 * 1024 / TSDB_BLOCK_SIZE;
+	} else {
+		if (pread(tsdb.fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.magic != TSDB_FILE_MAGIC ||
+		    hdr.version != TSDB_VERSION || hdr.block_size != TSDB_BLOCK_SIZE || hdr.num_blocks < 2 ||
+		    st.st_size < (off_t)hdr.num_blocks * TSDB_BLOCK_SIZE) {
+			fprintf(stderr, "tsdb: %s is no time series store of version %u, not touching it\n",
+				path, TSDB_VERSION);
+			tsdb_close();
+			return -EINVAL;
+		}
+		tsdb.num_blocks = hdr.num_blocks;
+		if ((size_t)tsdb.num_blocks * TSDB_BLOCK_SIZE != (size_t)tsdb.max_size * 1024 * 1024)
+			fprintf(stderr, "tsdb: %s keeps its size of %zu MiB, remove it to apply tsdb-max-size\n",
+				path, (size_t)tsdb.num_blocks * TSDB_BLOCK_SIZE / 1024 / 1024);
+	}
+	size = (size_t)tsdb.num_blocks * TSDB_BLOCK_SIZE;
+
+	/* writing to a hole of the mapping on a full disk would be SIGBUS */
+	rc = posix_fallocate(tsdb.fd, 0, size);
+	if (rc)
+		goto err;
+	tsdb.map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, tsdb.fd, 0);
+	if (tsdb.map == MAP_FAILED) {
+		tsdb.map = NULL;
+		goto err_errno;
+	}
+	tsdb.map_size = size;
+
+	/* the blocks of a new file are zero, i.e. unused */
+	if (init) {
+		fh = (struct tsdb_file_hdr *)tsdb.map;
+		fh->magic = TSDB_FILE_MAGIC;
+		fh->version = TSDB_VERSION;
+		fh->block_size = TSDB_BLOCK_SIZE;
+		fh->num_blocks = tsdb.num_blocks;
+		msync(tsdb.map, sysconf(_SC_PAGESIZE), MS_SYNC);
+	}
+
+	/* continue after the newest block */
+	tsdb.seq = 0;
+	for (i = 1; i < tsdb.num_blocks; i++) {
+		if (block_hdr(i)->magic == TSDB_BLOCK_MAGIC &&
+		    (!tsdb.block || (int32_t)(block_hdr(i)->seq - tsdb.seq) > 0)) {
+			tsdb.block = i;
+			tsdb.seq = block_hdr(i)->seq;
+		}
+	}
+
+	rc = catalog_open(path);
+	if (rc < 0) {
+		rc = -rc;
+		goto err;
+	}
+
+	if (!tsdb.codec)
+		tsdb.codec = tsdb_codec_alloc(g_oss);
+	tsdb_codec_reset(tsdb.codec);
+	osmo_timer_schedule(&tsdb.sync_timer, tsdb.sync_interval, 0);
+	return 0;
+
+err_errno:
+	rc = errno;
+err:
+	fprintf(stderr, "tsdb: cannot open %s: %s\n", path, strerror(rc));
+	tsdb_close();
+	return -rc;
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define TSDB_STR "Record all numeric leaves in an on-disk time series store\n"
+DEFUN(cfg_tsdb, cfg_tsdb_cmd,
+	"tsdb PATH",
+	TSDB_STR "File of the store, the paths of the series are kept in PATH.series\n")
+{
+	/* opened with the first tick, once the whole config is known */
+	tsdb_close();
+	tsdb.open_failed = false;
+	osmo_talloc_replace_string(g_oss, &tsdb.path, argv[0]);
+	if (!g_oss->leaves)
+		g_oss->leaves = leaf_table_alloc(g_oss);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_tsdb, cfg_no_tsdb_cmd,
+	"no tsdb",
+	NO_STR TSDB_STR)
+{
+	tsdb_close();
+	TALLOC_FREE(tsdb.path);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_tsdb_max_size, cfg_tsdb_max_size_cmd,
+	"tsdb-max-size <1-4096>",
+	"Size of the store, the oldest samples are overwritten once it is full\n"
+	"Size in MiB of a new store (default 16), an existing one keeps its size\n")
+{
+	tsdb.max_size = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_tsdb_sync_interval, cfg_tsdb_sync_interval_cmd,
+	"tsdb-sync-interval <1-3600>",
+	"How often to write the current block to disk\n"
+	"Interval in seconds (default 60)\n")
+{
+	tsdb.sync_interval = atoi(argv[0]);
+	if (tsdb.map)
+		osmo_timer_schedule(&tsdb.sync_timer, tsdb.sync_interval, 0);
+	return CMD_SUCCESS;
+}
+
+static void osysmon_tsdb_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_tsdb_cmd);
+	install_element(CONFIG_NODE, &cfg_no_tsdb_cmd);
+	install_element(CONFIG_NODE, &cfg_tsdb_max_size_cmd);
+	install_element(CONFIG_NODE, &cfg_tsdb_sync_interval_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+static void mark_dirty(size_t lo, size_t hi)
+{
+	if (tsdb.dirty_lo == tsdb.dirty_hi) {
+		tsdb.dirty_lo = lo;
+		tsdb.dirty_hi = hi;
+		return;
+	}
+	tsdb.dirty_lo = OSMO_MIN(tsdb.dirty_lo, lo);
+	tsdb.dirty_hi = OSMO_MAX(tsdb.dirty_hi, hi);
+}
+
+/* Write what changed in the current block to disk. The written bytes are
+ * counted in whole pages, that's what the kernel writes. They're a lower
+ * bound: the kernel may write dirty pages back on its own in between (see
+ * vm.dirty_expire_centisecs). */
+static void tsdb_sync(bool wait)
+{
+	size_t page = sysconf(_SC_PAGESIZE), lo, hi;
+	size_t hdr_off = (size_t)tsdb.block * TSDB_BLOCK_SIZE;
+
+	if (tsdb.catalog_dirty) {
+		fflush(tsdb.catalog);
+		fsync(fileno(tsdb.catalog));
+		tsdb.catalog_dirty = false;
+	}
+
+	if (tsdb.dirty_lo != tsdb.dirty_hi) {
+		lo = tsdb.dirty_lo / page * page;
+		hi = (tsdb.dirty_hi + page - 1) / page * page;
+		msync(tsdb.map + lo, hi - lo, wait ? MS_SYNC : MS_ASYNC);
+		tsdb.stats.written += hi - lo;
+		/* the header shares the first page with the data */
+		if (lo == hdr_off)
+			tsdb.hdr_dirty = false;
+	}
+	if (tsdb.hdr_dirty) {
+		msync(tsdb.map + hdr_off, page, wait ? MS_SYNC : MS_ASYNC);
+		tsdb.stats.written += page;
+	}
+	tsdb.hdr_dirty = false;
+	tsdb.dirty_lo = tsdb.dirty_hi = 0;
+}
+
+static void tsdb_sync_cb(void *data)
+{
+	tsdb_sync(true);
+	osmo_timer_schedule(&tsdb.sync_timer, tsdb.sync_interval, 0);
+}
+
+/* Finish the current block and start the next one, overwriting the oldest */
+static void tsdb_next_block(uint64_t ts)
+{
+	struct tsdb_block_hdr *hdr;
+
+	/* a block left empty, as a tick didn't even fit into it, is re-used
+	 * instead of overwriting the next one */
+	if (!tsdb.block || block_hdr(tsdb.block)->num_ticks) {
+		if (tsdb.block)
+			tsdb_sync(true);
+		tsdb.block = tsdb.block % (tsdb.num_blocks - 1) + 1;
+	}
+	hdr = block_hdr(tsdb.block);
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = TSDB_BLOCK_MAGIC;
+	hdr->seq = ++tsdb.seq;
+	hdr->first_ts = ts;
+	hdr->last_ts = ts;
+	tsdb.hdr_dirty = true;
+	tsdb.stats.bytes += sizeof(*hdr);
+	tsdb_codec_reset(tsdb.codec);
+}
+
+static int tsdb_append(uint64_t ts, uint32_t num)
+{
+	struct tsdb_block_hdr *hdr;
+	uint32_t bits;
+	size_t off;
+	int rc = -ENOSPC;
+
+	if (tsdb.block && tsdb.codec->num_ticks) {
+		hdr = block_hdr(tsdb.block);
+		bits = hdr->bits;
+		rc = tsdb_encode_tick(tsdb.codec, block_data(tsdb.block), TSDB_BLOCK_BITS, &bits, ts,
+				      tsdb.ids, tsdb.values, num);
+	}
+	if (rc == -ENOSPC) {
+		tsdb_next_block(ts);
+		hdr = block_hdr(tsdb.block);
+		bits = 0;
+		rc = tsdb_encode_tick(tsdb.codec, block_data(tsdb.block), TSDB_BLOCK_BITS, &bits, ts,
+				      tsdb.ids, tsdb.values, num);
+	}
+	if (rc < 0)
+		return rc;
+
+	off = block_data(tsdb.block) - tsdb.map;
+	mark_dirty(off + hdr->bits / 8, off + (bits + 7) / 8);
+	tsdb.stats.bytes += (bits + 7) / 8 - (hdr->bits + 7) / 8;
+	tsdb.hdr_dirty = true;
+	hdr->bits = bits;
+	hdr->last_ts = ts;
+	hdr->num_ticks++;
+	return 0;
+}
+
+/* called once on startup before config file parsing */
+int osysmon_tsdb_init()
+{
+	osmo_timer_setup(&tsdb.sync_timer, tsdb_sync_cb, NULL);
+	osysmon_tsdb_vty_init();
+	return 0;
+}
+
+static void add_u64(struct value_node *parent, const char *name, uint64_t val, const char *unit)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%llu%s", (unsigned long long)val, unit);
+	value_node_add(parent, name, buf);
+}
+
+static void add_ratio(struct value_node *parent, const char *name, double num, double denom)
+{
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%.2f", denom ? num / denom : 0.0);
+	value_node_add(parent, name, buf);
+}
+
+/* Statistics of the store. The compression ratio is against a plain 8 byte
+ * timestamp and 8 byte double per sample, the write amplification is the
+ * bytes written to disk per encoded byte. */
+int osysmon_tsdb_poll(struct value_node *parent)
+{
+	struct tsdb_block_hdr *oldest;
+	struct value_node *vn;
+	struct timespec ts;
+
+	if (!tsdb.map)
+		return 0;
+
+	vn = value_node_add(parent, "tsdb", NULL);
+	if (!vn)
+		return -ENOMEM;
+	add_u64(vn, "series", tsdb.num_series, "");
+	add_u64(vn, "samples", tsdb.stats.samples, "");
+	add_ratio(vn, "bits-per-sample", tsdb.stats.bytes * 8.0, tsdb.stats.samples);
+	add_ratio(vn, "compression-ratio", tsdb.stats.samples * 16.0, tsdb.stats.bytes);
+	add_u64(vn, "written", tsdb.stats.written / 1024, " kB");
+	add_ratio(vn, "write-amplification", tsdb.stats.written, tsdb.stats.bytes);
+	add_u64(vn, "dropped", tsdb.stats.dropped, "");
+
+	/* how far back the store goes */
+	if (tsdb.block) {
+		oldest = block_hdr(tsdb.block % (tsdb.num_blocks - 1) + 1);
+		if (oldest->magic != TSDB_BLOCK_MAGIC)
+			oldest = block_hdr(1);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		add_u64(vn, "retention", ts.tv_sec - oldest->first_ts / 1000, " s");
+	}
+	return 0;
+}
+
+/* called with every completed tree, after g_oss->leaves was updated */
+void osysmon_tsdb_update(struct value_node *root)
+{
+	struct timespec ts;
+	struct leaf *l;
+	uint32_t num = 0;
+	double val;
+
+	if (!tsdb.path || tsdb.open_failed)
+		return;
+	if (!tsdb.map && tsdb_open(tsdb.path) < 0) {
+		tsdb.open_failed = true;
+		return;
+	}
+
+	if (tsdb.alloc < g_oss->leaves->num_leaves) {
+		tsdb.alloc = g_oss->leaves->num_leaves;
+		tsdb.ids = talloc_realloc(g_oss, tsdb.ids, uint32_t, tsdb.alloc);
+		tsdb.values = talloc_realloc(g_oss, tsdb.values, double, tsdb.alloc);
+		OSMO_ASSERT(tsdb.ids && tsdb.values);
+	}
+
+	llist_for_each_entry(l, &g_oss->leaves->leaves, list) {
+		if (!leaf_number(l, &val))
+			continue;
+		if (!l->tsdb_id)
+			l->tsdb_id = catalog_id(l->path);
+		if (!l->tsdb_id)
+			continue;
+		tsdb.ids[num] = l->tsdb_id;
+		tsdb.values[num] = val;
+		num++;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (tsdb_append(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000, num) < 0) {
+		tsdb.stats.dropped++;
+		return;
+	}
+	tsdb.stats.samples += num;
+}
@@ -0,0 +1,432 @@
+/* Simple Osmocom System Monitor (osysmon): unix domain socket query API */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Line based protocol, requests:
+ *
+ *   GET [PATTERN]        all leaves matching the pattern
+ *   SUBSCRIBE [PATTERN]  the matching leaves, then every tick those that
+ *                        changed, appeared or vanished
+ *   UNSUBSCRIBE          drop all subscriptions
+ *
+ * A pattern is a path prefix whose components may contain shell wildcards,
+ * e.g. "ctrl-client/bsc" or "netdev/tun?/running".
+ * Responses are lines of
+ *
+ *   = PATH<TAB>VALUE     a leaf and its current value
+ *   - PATH               a leaf that vanished
+ *   ! MESSAGE            an error
+ *
+ * with the reply to a GET and each per-tick batch of changes terminated by an
+ * empty line. */
+
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fnmatch.h>
+
+#include <osmocom/core/select.h>
+#include <osmocom/core/socket.h>
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "render.h"
+#include "leaf_table.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define UNIX_MAX_CLIENTS	64
+#define UNIX_MAX_SUBSCRIPTIONS	16
+#define UNIX_MAX_DEPTH		16
+#define UNIX_LINE_MAX		1024
+/* drop clients not reading their updates */
+#define UNIX_MAX_BACKLOG	(1024 * 1024)
+
+/* A pattern split into its path components once, so matching a path costs
+ * no allocation or parsing of the pattern */
+struct path_pattern {
+	char *str;
+	unsigned int num;
+	struct {
+		const char *str;
+		size_t len;
+		bool glob;
+	} comp[UNIX_MAX_DEPTH];
+};
+
+struct unix_client {
+	struct llist_head list;
+	struct osmo_fd ofd;
+	char line[UNIX_LINE_MAX];
+	size_t line_len;
+	struct render_buf *out;
+	size_t out_off;
+	struct path_pattern *subs[UNIX_MAX_SUBSCRIPTIONS];
+	unsigned int num_subs;
+};
+
+static struct {
+	char *path;
+	struct osmo_fd listen_ofd;
+	struct llist_head clients;
+	unsigned int num_clients;
+} unix_srv = {
+	.listen_ofd = { .fd = -1 },
+	.clients = LLIST_HEAD_INIT(unix_srv.clients),
+};
+
+static struct path_pattern *pattern_compile(void *ctx, const char *str)
+{
+	struct path_pattern *pp = talloc_zero(ctx, struct path_pattern);
+	char *c;
+
+	OSMO_ASSERT(pp);
+	pp->str = talloc_strdup(pp, str);
+	for (c = pp->str; *c; ) {
+		if (pp->num == UNIX_MAX_DEPTH) {
+			talloc_free(pp);
+			return NULL;
+		}
+		pp->comp[pp->num].str = c;
+		pp->comp[pp->num].len = strcspn(c, "/");
+		pp->comp[pp->num].glob = strcspn(c, "*?[") < pp->comp[pp->num].len;
+		c += pp->comp[pp->num].len;
+		pp->num++;
+		/* terminated for fnmatch() */
+		if (*c == '/')
+			*c++ = '\0';
+	}
+	return pp;
+}
+
+/* Does the pattern match the leading components of the path? */
+static bool pattern_match(const struct path_pattern *pp, const char *path)
+{
+	char comp[UNIX_LINE_MAX];
+	unsigned int i;
+	size_t len;
+
+	for (i = 0; i < pp->num; i++) {
+		if (!*path)
+			return false;
+		len = strcspn(path, "/");
+		if (pp->comp[i].glob) {
+			if (len >= sizeof(comp))
+				return false;
+			memcpy(comp, path, len);
+			comp[len] = '\0';
+			if (fnmatch(pp->comp[i].str, comp, 0))
+				return false;
+		} else if (len != pp->comp[i].len || strncmp(path, pp->comp[i].str, len)) {
+			return false;
+		}
+		path += len;
+		if (*path == '/')
+			path++;
+	}
+	return true;
+}
+
+static void unix_client_close(struct unix_client *uc)
+{
+	osmo_fd_unregister(&uc->ofd);
+	close(uc->ofd.fd);
+	llist_del(&uc->list);
+	unix_srv.num_clients--;
+	talloc_free(uc);
+}
+
+static void unix_close_all(void)
+{
+	struct unix_client *uc, *uc2;
+
+	llist_for_each_entry_safe(uc, uc2, &unix_srv.clients, list)
+		unix_client_close(uc);
+	if (unix_srv.listen_ofd.fd >= 0) {
+		osmo_fd_unregister(&unix_srv.listen_ofd);
+		close(unix_srv.listen_ofd.fd);
+		unix_srv.listen_ofd.fd = -1;
+		unlink(unix_srv.path);
+	}
+	TALLOC_FREE(unix_srv.path);
+}
+
+static int unix_accept_cb(struct osmo_fd *ofd, unsigned int what);
+
+static int unix_listen(const char *path)
+{
+	int rc;
+
+	unix_close_all();
+	unix_srv.listen_ofd.when = BSC_FD_READ;
+	unix_srv.listen_ofd.cb = unix_accept_cb;
+	rc = osmo_sock_unix_init_ofd(&unix_srv.listen_ofd, SOCK_STREAM, 0, path, OSMO_SOCK_F_BIND);
+	if (rc < 0) {
+		unix_srv.listen_ofd.fd = -1;
+		return rc;
+	}
+	unix_srv.path = talloc_strdup(g_oss, path);
+	if (!g_oss->leaves)
+		g_oss->leaves = leaf_table_alloc(g_oss);
+	return 0;
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define UNIX_STR "Answer queries and subscriptions for values on a unix domain socket\n"
+DEFUN(cfg_unix_socket, cfg_unix_socket_cmd,
+	"unix-socket PATH",
+	UNIX_STR "Path of the socket\n")
+{
+	if (unix_listen(argv[0]) < 0) {
+		vty_out(vty, "Cannot listen on %s: %s%s", argv[0], strerror(errno), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_unix_socket, cfg_no_unix_socket_cmd,
+	"no unix-socket",
+	NO_STR UNIX_STR)
+{
+	unix_close_all();
+	return CMD_SUCCESS;
+}
+
+static void osysmon_unix_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_unix_socket_cmd);
+	install_element(CONFIG_NODE, &cfg_no_unix_socket_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+/* Write as much of the backlog as the socket takes */
+static int unix_client_flush(struct unix_client *uc)
+{
+	ssize_t rc;
+
+	if (uc->out_off < uc->out->len) {
+		rc = write(uc->ofd.fd, uc->out->data + uc->out_off, uc->out->len - uc->out_off);
+		if (rc < 0 && errno != EAGAIN) {
+			unix_client_close(uc);
+			return -EIO;
+		}
+		if (rc > 0)
+			uc->out_off += rc;
+	}
+
+	if (uc->out_off == uc->out->len) {
+		render_buf_reset(uc->out);
+		uc->out_off = 0;
+		uc->ofd.when = BSC_FD_READ;
+		return 0;
+	}
+	if (uc->out->len - uc->out_off > UNIX_MAX_BACKLOG) {
+		unix_client_close(uc);
+		return -ENOBUFS;
+	}
+	uc->ofd.when = BSC_FD_READ | BSC_FD_WRITE;
+	return 0;
+}
+
+static void put_leaf(struct unix_client *uc, const struct leaf *l)
+{
+	render_buf_printf(uc->out, "= %s\t%s\n", l->path, l->value);
+}
+
+static void put_matching(struct unix_client *uc, const struct path_pattern *pp)
+{
+	const struct leaf *l;
+
+	llist_for_each_entry(l, &g_oss->leaves->leaves, list) {
+		if (pattern_match(pp, l->path))
+			put_leaf(uc, l);
+	}
+}
+
+static void unix_client_request(struct unix_client *uc, char *line)
+{
+	struct path_pattern *pp;
+	char *arg;
+
+	arg = strchr(line, ' ');
+	if (arg)
+		*arg++ = '\0';
+	else
+		arg = "";
+
+	if (!strcmp(line, "GET")) {
+		pp = pattern_compile(uc, arg);
+		if (!pp) {
+			render_buf_puts(uc->out, "! pattern too deep\n");
+			return;
+		}
+		put_matching(uc, pp);
+		render_buf_puts(uc->out, "\n");
+		talloc_free(pp);
+	} else if (!strcmp(line, "SUBSCRIBE")) {
+		if (uc->num_subs == UNIX_MAX_SUBSCRIPTIONS) {
+			render_buf_puts(uc->out, "! too many subscriptions\n");
+			return;
+		}
+		pp = pattern_compile(uc, arg);
+		if (!pp) {
+			render_buf_puts(uc->out, "! pattern too deep\n");
+			return;
+		}
+		uc->subs[uc->num_subs++] = pp;
+		/* the current state, changes follow */
+		put_matching(uc, pp);
+		render_buf_puts(uc->out, "\n");
+	} else if (!strcmp(line, "UNSUBSCRIBE")) {
+		while (uc->num_subs)
+			talloc_free(uc->subs[--uc->num_subs]);
+	} else {
+		render_buf_printf(uc->out, "! unknown request '%s'\n", line);
+	}
+}
+
+static int unix_client_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct unix_client *uc = ofd->data;
+	char *eol, *line;
+	ssize_t rc;
+
+	if (what & BSC_FD_WRITE) {
+		if (unix_client_flush(uc) < 0)
+			return 0;
+	}
+	if (!(what & BSC_FD_READ))
+		return 0;
+
+	rc = read(ofd->fd, uc->line + uc->line_len, sizeof(uc->line) - 1 - uc->line_len);
+	if (rc < 0 && errno == EAGAIN)
+		return 0;
+	if (rc <= 0) {
+		unix_client_close(uc);
+		return 0;
+	}
+	uc->line_len += rc;
+	uc->line[uc->line_len] = '\0';
+
+	for (line = uc->line; (eol = strchr(line, '\n')); line = eol + 1) {
+		*eol = '\0';
+		if (eol > line && eol[-1] == '\r')
+			eol[-1] = '\0';
+		unix_client_request(uc, line);
+	}
+	uc->line_len -= line - uc->line;
+	memmove(uc->line, line, uc->line_len);
+	if (uc->line_len == sizeof(uc->line) - 1) {
+		render_buf_puts(uc->out, "! request too long\n");
+		uc->line_len = 0;
+	}
+
+	unix_client_flush(uc);
+	return 0;
+}
+
+static int unix_accept_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct unix_client *uc;
+	int fd;
+
+	fd = accept(ofd->fd, NULL, NULL);
+	if (fd < 0)
+		return 0;
+	if (unix_srv.num_clients >= UNIX_MAX_CLIENTS) {
+		close(fd);
+		return 0;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	uc = talloc_zero(g_oss, struct unix_client);
+	OSMO_ASSERT(uc);
+	uc->out = render_buf_alloc(uc, 4096);
+	uc->ofd.fd = fd;
+	uc->ofd.when = BSC_FD_READ;
+	uc->ofd.cb = unix_client_cb;
+	uc->ofd.data = uc;
+	osmo_fd_register(&uc->ofd);
+	llist_add_tail(&uc->list, &unix_srv.clients);
+	unix_srv.num_clients++;
+	return 0;
+}
+
+/* Push what changed with the last tree to one subscriber, in one batch */
+static void unix_client_notify(struct unix_client *uc)
+{
+	const struct leaf_table *lt = g_oss->leaves;
+	const struct leaf *l;
+	size_t len = uc->out->len;
+	unsigned int i;
+
+	llist_for_each_entry(l, &lt->changed, changed) {
+		for (i = 0; i < uc->num_subs; i++) {
+			if (pattern_match(uc->subs[i], l->path)) {
+				put_leaf(uc, l);
+				break;
+			}
+		}
+	}
+	llist_for_each_entry(l, &lt->removed, list) {
+		for (i = 0; i < uc->num_subs; i++) {
+			if (pattern_match(uc->subs[i], l->path)) {
+				render_buf_printf(uc->out, "- %s\n", l->path);
+				break;
+			}
+		}
+	}
+
+	if (uc->out->len == len)
+		return;
+	render_buf_puts(uc->out, "\n");
+	unix_client_flush(uc);
+}
+
+/* called once on startup before config file parsing */
+int osysmon_unix_init()
+{
+	osysmon_unix_vty_init();
+	return 0;
+}
+
+/* called with every completed tree, after g_oss->leaves was updated */
+void osysmon_unix_update(struct value_node *root)
+{
+	struct unix_client *uc, *uc2;
+
+	if (unix_srv.listen_ofd.fd < 0)
+		return;
+
+	llist_for_each_entry_safe(uc, uc2, &unix_srv.clients, list) {
+		if (uc->num_subs)
+			unix_client_notify(uc);
+	}
+}
@@ -0,0 +1,930 @@
+/* Simple Osmocom System Monitor (osysmon): store-and-forward uplink */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+/* Every tick becomes a frame (see uplink.h for the format): a KEY frame with
+ * all leaves every 'uplink-keyframe-interval' ticks and after (re)connecting,
+ * otherwise a DELTA of what changed since the previous tick.
+ *
+ * While connected, frames are sent right away and kept in memory from the
+ * newest acknowledged KEY frame on. If the connection fails, or frames stay
+ * unacknowledged for UPLINK_ACK_TIMEOUT (a dead backhaul often shows as
+ * nothing but TCP retransmissions), these frames go to the spool, followed
+ * by the frames of all ticks until reconnected. The spool is a directory of
+ * segment files, each starting with a KEY frame, the oldest one deleted
+ * beyond 'uplink-spool-max-size'. Once reconnected, it is drained in order,
+ * after the live frame of every tick and at up to 'uplink-spool-rate' bytes
+ * per second; segments are deleted when acknowledged.
+ *
+ * With 'uplink-server HOST PORT udp' (e.g. to an 'aggregator-udp'), every
+ * tick is one datagram of a HELLO frame followed by the KEY or DELTA frame,
+ * without acknowledgement and without spool: what is lost stays lost, and
+ * the collector ignores DELTA frames until the next KEY frame. A frame that
+ * doesn't fit into a datagram is dropped. */
+
+#include "config.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <osmocom/core/select.h>
+#include <osmocom/core/socket.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/vty/vty.h>
+#include <osmocom/vty/command.h>
+
+#include "osysmon.h"
+#include "value_node.h"
+#include "leaf_table.h"
+#include "render.h"
+#include "uplink.h"
+
+/***********************************************************************
+ * Data model
+ ***********************************************************************/
+
+#define UPLINK_ACK_TIMEOUT			15
+#define UPLINK_RECONNECT_INTERVAL		5
+/* unacknowledged or unsent bytes, beyond which the connection is stuck */
+#define UPLINK_MAX_PENDING			(4 * 1024 * 1024)
+/* don't drain the spool into the socket beyond this */
+#define UPLINK_MAX_DRAIN_OUT			(64 * 1024)
+#define UPLINK_ZSTD_LEVEL			3
+#define UPLINK_SPOOL_SEGMENTS			8
+#define UPLINK_DEFAULT_KEYFRAME_INTERVAL	60
+#define UPLINK_DEFAULT_SPOOL_MAX_SIZE		16
+#define UPLINK_DEFAULT_SPOOL_RATE		65536
+
+struct uplink_frame {
+	struct llist_head list;
+	uint64_t seq;
+	bool key;
+	/* for the ack timeout */
+	time_t queued;
+	size_t len;
+	/* header and payload */
+	uint8_t data[0];
+};
+
+struct spool_segment {
+	struct llist_head list;
+	char *path;
+	uint64_t first_seq;
+	uint64_t last_seq;
+	size_t size;
+};
+
+static struct {
+	struct {
+		char *host;
+		uint16_t port;
+		/* datagrams, without acks and spool */
+		bool udp;
+		char *site;
+		unsigned int keyframe_interval;
+		char *spool_dir;
+		/* in MiB */
+		unsigned int spool_max_size;
+		/* bytes per second */
+		unsigned int spool_rate;
+	} cfg;
+
+	/* fd >= 0 while connecting or connected */
+	struct osmo_fd ofd;
+	bool connected;
+	struct osmo_timer_list reconnect_timer;
+	/* what the socket didn't take yet */
+	struct render_buf *out;
+	size_t out_off;
+	/* partial ACK frame */
+	uint8_t in[UPLINK_HDR_LEN];
+	size_t in_len;
+
+	/* the frames of the ticks */
+	uint64_t seq;
+	unsigned int since_key;
+	bool need_key;
+	struct render_buf *raw;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zctx;
+#endif
+
+	/* sent, from the newest acknowledged KEY frame on */
+	struct llist_head unacked;
+	size_t unacked_bytes;
+	uint64_t acked;
+
+	/* oldest first */
+	struct llist_head segments;
+	size_t spool_size;
+	/* appending to the last segment */
+	int spool_fd;
+	/* the next frame to drain is at drain_off of drain_seg */
+	struct spool_segment *drain_seg;
+	int drain_fd;
+	off_t drain_off;
+	/* token bucket of the drain rate, holding up to one second */
+	double tokens;
+	struct timespec last_fill;
+	struct osmo_timer_list drain_timer;
+
+	struct {
+		uint64_t raw_bytes;
+		uint64_t bytes;
+		uint64_t dropped;
+	} stats;
+} uplink = {
+	.cfg = {
+		.keyframe_interval = UPLINK_DEFAULT_KEYFRAME_INTERVAL,
+		.spool_max_size = UPLINK_DEFAULT_SPOOL_MAX_SIZE,
+		.spool_rate = UPLINK_DEFAULT_SPOOL_RATE,
+	},
+	.ofd = { .fd = -1 },
+	.unacked = LLIST_HEAD_INIT(uplink.unacked),
+	.segments = LLIST_HEAD_INIT(uplink.segments),
+	.spool_fd = -1,
+	.drain_fd = -1,
+};
+
+/* spool */
+
+static size_t spool_segment_size(void)
+{
+	return (size_t)uplink.cfg.spool_max_size * 1024 * 1024 / UPLINK_SPOOL_SEGMENTS;
+}
+
+static void spool_drain_reset(void)
+{
+	if (uplink.drain_fd >= 0)
+		close(uplink.drain_fd);
+	uplink.drain_fd = -1;
+	uplink.drain_seg = NULL;
+	uplink.drain_off = 0;
+}
+
+static void spool_segment_del(struct spool_segment *seg)
+{
+	if (seg == uplink.drain_seg)
+		spool_drain_reset();
+	if (seg == llist_last_entry(&uplink.segments, struct spool_segment, list) && uplink.spool_fd >= 0) {
+		close(uplink.spool_fd);
+		uplink.spool_fd = -1;
+	}
+	unlink(seg->path);
+	uplink.spool_size -= seg->size;
+	llist_del(&seg->list);
+	talloc_free(seg);
+}
+
+static struct spool_segment *spool_segment_add(uint64_t first_seq, size_t size)
+{
+	struct spool_segment *seg = talloc_zero(g_oss, struct spool_segment), *s;
+
+	OSMO_ASSERT(seg);
+	seg->path = talloc_asprintf(seg, "%s/%016" PRIx64 ".spool", uplink.cfg.spool_dir, first_seq);
+	seg->first_seq = first_seq;
+	seg->last_seq = first_seq;
+	seg->size = size;
+	uplink.spool_size += size;
+
+	/* in order, for the segments found on startup */
+	llist_for_each_entry(s, &uplink.segments, list) {
+		if (s->first_seq > first_seq) {
+			llist_add_tail(&seg->list, &s->list);
+			return seg;
+		}
+	}
+	llist_add_tail(&seg->list, &uplink.segments);
+	return seg;
+}
+
+/* Find the last seq of a segment of a previous run, dropping a frame torn by
+ * a crash. Returns false if there is no complete frame. */
+static bool spool_segment_scan(struct spool_segment *seg)
+{
+	uint8_t buf[UPLINK_HDR_LEN];
+	struct uplink_hdr hdr;
+	size_t off = 0;
+	int fd;
+
+	fd = open(seg->path, O_RDWR | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	while (off + sizeof(buf) <= seg->size) {
+		if (pread(fd, buf, sizeof(buf), off) != sizeof(buf) || uplink_hdr_decode(&hdr, buf) < 0 ||
+		    off + sizeof(buf) + hdr.len > seg->size)
+			break;
+		seg->last_seq = hdr.seq;
+		off += sizeof(buf) + hdr.len;
+	}
+	if (off < seg->size && ftruncate(fd, off) == 0) {
+		uplink.spool_size -= seg->size - off;
+		seg->size = off;
+	}
+	close(fd);
+	return off > 0;
+}
+
+static void spool_close(void)
+{
+	struct spool_segment *seg, *seg2;
+
+	spool_drain_reset();
+	if (uplink.spool_fd >= 0)
+		close(uplink.spool_fd);
+	uplink.spool_fd = -1;
+	llist_for_each_entry_safe(seg, seg2, &uplink.segments, list) {
+		llist_del(&seg->list);
+		talloc_free(seg);
+	}
+	uplink.spool_size = 0;
+	TALLOC_FREE(uplink.cfg.spool_dir);
+}
+
+/* Pick up the segments of a previous run */
+static int spool_open(const char *dir)
+{
+	struct spool_segment *seg, *seg2;
+	struct dirent *de;
+	struct stat st;
+	uint64_t first_seq;
+	char *path;
+	DIR *d;
+
+	spool_close();
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+		return -errno;
+	d = opendir(dir);
+	if (!d)
+		return -errno;
+	uplink.cfg.spool_dir = talloc_strdup(g_oss, dir);
+
+	while ((de = readdir(d))) {
+		if (strlen(de->d_name) != 22 || strcmp(de->d_name + 16, ".spool") ||
+		    sscanf(de->d_name, "%16" SCNx64, &first_seq) != 1)
+			continue;
+		path = talloc_asprintf(g_oss, "%s/%s", dir, de->d_name);
+		if (stat(path, &st) == 0)
+			spool_segment_add(first_seq, st.st_size);
+		talloc_free(path);
+	}
+	closedir(d);
+
+	llist_for_each_entry_safe(seg, seg2, &uplink.segments, list) {
+		if (!spool_segment_scan(seg))
+			spool_segment_del(seg);
+	}
+	/* the seqs of the spool have to keep increasing */
+	if (!llist_empty(&uplink.segments)) {
+		seg = llist_last_entry(&uplink.segments, struct spool_segment, list);
+		uplink.seq = OSMO_MAX(uplink.seq, seg->last_seq);
+	}
+	return 0;
+}
+
+static void spool_append(const struct uplink_frame *f)
+{
+	struct spool_segment *seg = NULL, *first;
+	size_t max_size = (size_t)uplink.cfg.spool_max_size * 1024 * 1024;
+
+	if (!uplink.cfg.spool_dir)
+		goto drop;
+	if (!llist_empty(&uplink.segments))
+		seg = llist_last_entry(&uplink.segments, struct spool_segment, list);
+
+	/* segments start with a KEY frame, so that the oldest can go */
+	if (!seg || uplink.spool_fd < 0 || (f->key && seg->size >= spool_segment_size())) {
+		if (!f->key)
+			goto drop;
+		if (uplink.spool_fd >= 0)
+			close(uplink.spool_fd);
+		seg = spool_segment_add(f->seq, 0);
+		uplink.spool_fd = open(seg->path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+		if (uplink.spool_fd < 0) {
+			spool_segment_del(seg);
+			goto drop;
+		}
+	}
+
+	while (uplink.spool_size + f->len > max_size) {
+		first = llist_first_entry(&uplink.segments, struct spool_segment, list);
+		if (first == seg)
+			goto drop;
+		spool_segment_del(first);
+	}
+
+	if (write(uplink.spool_fd, f->data, f->len) != f->len) {
+		/* e.g. a full disk, the segment must stay parseable */
+		if (ftruncate(uplink.spool_fd, seg->size) < 0) {
+			close(uplink.spool_fd);
+			uplink.spool_fd = -1;
+		}
+		goto drop;
+	}
+	seg->last_seq = f->seq;
+	seg->size += f->len;
+	uplink.spool_size += f->len;
+	return;
+
+drop:
+	uplink.stats.dropped++;
+	/* the next frame spooled has to be one */
+	uplink.need_key = true;
+}
+
+/* The collector has all frames of the spool up to seq */
+static void spool_ack(uint64_t seq)
+{
+	struct spool_segment *seg, *seg2;
+
+	llist_for_each_entry_safe(seg, seg2, &uplink.segments, list) {
+		if (seg->last_seq > seq)
+			break;
+		spool_segment_del(seg);
+	}
+}
+
+/* connection */
+
+static int uplink_fd_cb(struct osmo_fd *ofd, unsigned int what);
+static void spool_drain(void);
+
+static void uplink_frame_free(struct uplink_frame *f)
+{
+	llist_del(&f->list);
+	uplink.unacked_bytes -= f->len;
+	talloc_free(f);
+}
+
+static void uplink_close(void)
+{
+	osmo_timer_del(&uplink.reconnect_timer);
+	osmo_timer_del(&uplink.drain_timer);
+	if (uplink.ofd.fd >= 0) {
+		osmo_fd_unregister(&uplink.ofd);
+		close(uplink.ofd.fd);
+		uplink.ofd.fd = -1;
+	}
+	uplink.connected = false;
+	uplink.in_len = 0;
+	uplink.out_off = 0;
+	if (uplink.out)
+		render_buf_reset(uplink.out);
+	spool_drain_reset();
+}
+
+/* Whatever wasn't acknowledged may be lost, so it goes to the spool */
+static void uplink_disconnect(void)
+{
+	struct uplink_frame *f, *f2;
+
+	uplink_close();
+	llist_for_each_entry_safe(f, f2, &uplink.unacked, list) {
+		spool_append(f);
+		uplink_frame_free(f);
+	}
+	uplink.need_key = true;
+	osmo_timer_schedule(&uplink.reconnect_timer, UPLINK_RECONNECT_INTERVAL, 0);
+}
+
+static void uplink_queue(uint8_t type, uint8_t flags, uint64_t seq, const void *payload, size_t len)
+{
+	struct uplink_hdr hdr = {
+		.type = type,
+		.flags = flags,
+		.len = len,
+		.raw_len = len,
+		.seq = seq,
+	};
+	uint8_t buf[UPLINK_HDR_LEN];
+
+	uplink_hdr_encode(buf, &hdr);
+	render_buf_append(uplink.out, buf, sizeof(buf));
+	render_buf_append(uplink.out, payload, len);
+}
+
+static void uplink_write(void)
+{
+	ssize_t rc;
+
+	if (!uplink.connected)
+		return;
+	while (uplink.out_off < uplink.out->len) {
+		rc = write(uplink.ofd.fd, uplink.out->data + uplink.out_off, uplink.out->len - uplink.out_off);
+		if (rc < 0 && errno == EAGAIN)
+			break;
+		if (rc <= 0) {
+			uplink_disconnect();
+			return;
+		}
+		uplink.out_off += rc;
+	}
+	if (uplink.out_off == uplink.out->len) {
+		render_buf_reset(uplink.out);
+		uplink.out_off = 0;
+		uplink.ofd.when &= ~BSC_FD_WRITE;
+	} else {
+		uplink.ofd.when |= BSC_FD_WRITE;
+	}
+}
+
+static void uplink_connect(void)
+{
+	int fd;
+
+	uplink_close();
+	uplink.need_key = true;
+	fd = osmo_sock_init(AF_UNSPEC, uplink.cfg.udp ? SOCK_DGRAM : SOCK_STREAM,
+			    uplink.cfg.udp ? IPPROTO_UDP : IPPROTO_TCP, uplink.cfg.host, uplink.cfg.port,
+			    OSMO_SOCK_F_CONNECT | OSMO_SOCK_F_NONBLOCK);
+	if (fd < 0) {
+		osmo_timer_schedule(&uplink.reconnect_timer, UPLINK_RECONNECT_INTERVAL, 0);
+		return;
+	}
+	uplink.ofd.fd = fd;
+	uplink.ofd.when = BSC_FD_READ | BSC_FD_WRITE;
+	uplink.ofd.cb = uplink_fd_cb;
+	if (uplink.cfg.udp) {
+		/* nothing to wait for, every datagram carries its HELLO */
+		uplink.ofd.when = 0;
+		uplink.connected = true;
+	}
+	osmo_fd_register(&uplink.ofd);
+	if (uplink.cfg.udp)
+		return;
+
+	if (!uplink.out)
+		uplink.out = render_buf_alloc(g_oss, 65536);
+	uplink_queue(UPLINK_HELLO, 0, 0, uplink.cfg.site, strlen(uplink.cfg.site));
+}
+
+static void uplink_reconnect_cb(void *data)
+{
+	uplink_connect();
+}
+
+static void uplink_drain_cb(void *data)
+{
+	spool_drain();
+}
+
+/* UDP: send the frame right away, with the HELLO frame in front */
+static void uplink_send_datagram(const struct uplink_frame *f)
+{
+	struct uplink_hdr hdr = {
+		.type = UPLINK_HELLO,
+		.len = strlen(uplink.cfg.site),
+		.raw_len = strlen(uplink.cfg.site),
+	};
+	uint8_t buf[UPLINK_HDR_LEN];
+	struct iovec iov[] = {
+		{ .iov_base = buf, .iov_len = sizeof(buf) },
+		{ .iov_base = uplink.cfg.site, .iov_len = hdr.len },
+		{ .iov_base = (void *)f->data, .iov_len = f->len },
+	};
+
+	uplink_hdr_encode(buf, &hdr);
+	/* also fails with ECONNREFUSED for an earlier datagram */
+	if (uplink.ofd.fd < 0 || writev(uplink.ofd.fd, iov, ARRAY_SIZE(iov)) < 0) {
+		uplink.stats.dropped++;
+		/* the collector can't apply the DELTA frames after a lost one */
+		uplink.need_key = true;
+	}
+}
+
+/* Keep the frames from the newest acknowledged KEY frame on, the spool
+ * needs one to start with */
+static void uplink_ack(uint64_t seq)
+{
+	struct uplink_frame *f, *f2, *key = NULL;
+
+	uplink.acked = seq;
+	llist_for_each_entry(f, &uplink.unacked, list) {
+		if (f->seq > seq)
+			break;
+		if (f->key)
+			key = f;
+	}
+	if (!key)
+		return;
+	llist_for_each_entry_safe(f, f2, &uplink.unacked, list) {
+		if (f == key)
+			break;
+		uplink_frame_free(f);
+	}
+}
+
+static int uplink_read(void)
+{
+	struct uplink_hdr hdr;
+	ssize_t rc;
+
+	while (1) {
+		rc = read(uplink.ofd.fd, uplink.in + uplink.in_len, sizeof(uplink.in) - uplink.in_len);
+		if (rc < 0 && errno == EAGAIN)
+			return 0;
+		if (rc <= 0)
+			return -EIO;
+		uplink.in_len += rc;
+		if (uplink.in_len < sizeof(uplink.in))
+			continue;
+		uplink.in_len = 0;
+		if (uplink_hdr_decode(&hdr, uplink.in) < 0 || hdr.type != UPLINK_ACK || hdr.len)
+			return -EINVAL;
+		if (hdr.flags & UPLINK_F_SPOOL)
+			spool_ack(hdr.seq);
+		else
+			uplink_ack(hdr.seq);
+	}
+}
+
+static int uplink_fd_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	if (!uplink.connected && (what & BSC_FD_WRITE)) {
+		if (getsockopt(ofd->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err) {
+			uplink_disconnect();
+			return 0;
+		}
+		uplink.connected = true;
+	}
+	if ((what & BSC_FD_READ) && uplink_read() < 0) {
+		uplink_disconnect();
+		return 0;
+	}
+	if (what & BSC_FD_WRITE) {
+		uplink_write();
+		spool_drain();
+	}
+	return 0;
+}
+
+/***********************************************************************
+ * VTY
+ ***********************************************************************/
+
+#define UPLINK_STR "Send the values to a collector via TCP, spooling them while it isn't reachable, or UDP\n"
+DEFUN(cfg_uplink_server, cfg_uplink_server_cmd,
+	"uplink-server HOST <1-65535> [udp]",
+	UPLINK_STR "Host name or IP address of the collector\n" "Port of the collector\n"
+	"Use UDP instead, without acknowledgement and spool\n")
+{
+	struct uplink_frame *f, *f2;
+
+	osmo_talloc_replace_string(g_oss, &uplink.cfg.host, argv[0]);
+	uplink.cfg.port = atoi(argv[1]);
+	uplink.cfg.udp = argc > 2;
+	/* when switching from TCP, nothing will acknowledge these */
+	if (uplink.cfg.udp) {
+		llist_for_each_entry_safe(f, f2, &uplink.unacked, list)
+			uplink_frame_free(f);
+	}
+	if (!g_oss->leaves)
+		g_oss->leaves = leaf_table_alloc(g_oss);
+	/* retried until it works, the backhaul may be down */
+	uplink_connect();
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_uplink_server, cfg_no_uplink_server_cmd,
+	"no uplink-server",
+	NO_STR UPLINK_STR)
+{
+	struct uplink_frame *f, *f2;
+
+	uplink_close();
+	llist_for_each_entry_safe(f, f2, &uplink.unacked, list)
+		uplink_frame_free(f);
+	TALLOC_FREE(uplink.cfg.host);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_uplink_site, cfg_uplink_site_cmd,
+	"uplink-site NAME",
+	"Name of this site at the collector\n" "Name (default: the host name)\n")
+{
+	osmo_talloc_replace_string(g_oss, &uplink.cfg.site, argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_uplink_keyframe_interval, cfg_uplink_keyframe_interval_cmd,
+	"uplink-keyframe-interval <1-3600>",
+	"How often to send all values, not only the changed ones\n"
+	"Interval in ticks (default 60)\n")
+{
+	uplink.cfg.keyframe_interval = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+#define SPOOL_STR "Keep what couldn't be sent on disk, and send it once reconnected\n"
+DEFUN(cfg_uplink_spool, cfg_uplink_spool_cmd,
+	"uplink-spool DIR",
+	SPOOL_STR "Directory of the spool, created if missing\n")
+{
+	int rc = spool_open(argv[0]);
+	if (rc < 0) {
+		vty_out(vty, "Cannot open %s: %s%s", argv[0], strerror(-rc), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_uplink_spool, cfg_no_uplink_spool_cmd,
+	"no uplink-spool",
+	NO_STR SPOOL_STR)
+{
+	spool_close();
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_uplink_spool_max_size, cfg_uplink_spool_max_size_cmd,
+	"uplink-spool-max-size <1-4096>",
+	"Limit the size of the spool, the oldest values are dropped beyond it\n"
+	"Size in MiB (default 16)\n")
+{
+	uplink.cfg.spool_max_size = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_uplink_spool_rate, cfg_uplink_spool_rate_cmd,
+	"uplink-spool-rate <1024-100000000>",
+	"Limit the rate of sending the spool, so that live values still get through\n"
+	"Bytes per second (default 65536)\n")
+{
+	uplink.cfg.spool_rate = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+static void osysmon_uplink_vty_init(void)
+{
+	install_element(CONFIG_NODE, &cfg_uplink_server_cmd);
+	install_element(CONFIG_NODE, &cfg_no_uplink_server_cmd);
+	install_element(CONFIG_NODE, &cfg_uplink_site_cmd);
+	install_element(CONFIG_NODE, &cfg_uplink_keyframe_interval_cmd);
+	install_element(CONFIG_NODE, &cfg_uplink_spool_cmd);
+	install_element(CONFIG_NODE, &cfg_no_uplink_spool_cmd);
+	install_element(CONFIG_NODE, &cfg_uplink_spool_max_size_cmd);
+	install_element(CONFIG_NODE, &cfg_uplink_spool_rate_cmd);
+}
+
+/***********************************************************************
+ * Runtime Code
+ ***********************************************************************/
+
+static void add_record(char type, const char *path, const char *value)
+{
+	render_buf_append(uplink.raw, &type, 1);
+	render_buf_append(uplink.raw, path, strlen(path) + 1);
+	if (value)
+		render_buf_append(uplink.raw, value, strlen(value) + 1);
+}
+
+static struct uplink_frame *frame_build(void)
+{
+	struct uplink_hdr hdr = { .type = UPLINK_DELTA };
+	struct uplink_frame *f;
+	struct timespec ts;
+	const void *payload;
+	struct leaf *l;
+#ifdef HAVE_ZSTD
+	void *buf = NULL;
+	size_t rc;
+#endif
+
+	render_buf_reset(uplink.raw);
+	if (uplink.need_key || ++uplink.since_key >= uplink.cfg.keyframe_interval) {
+		hdr.type = UPLINK_KEY;
+		uplink.need_key = false;
+		uplink.since_key = 0;
+		llist_for_each_entry(l, &g_oss->leaves->leaves, list)
+			add_record('=', l->path, l->value);
+	} else {
+		llist_for_each_entry(l, &g_oss->leaves->changed, changed)
+			add_record('=', l->path, l->value);
+		llist_for_each_entry(l, &g_oss->leaves->removed, list)
+			add_record('-', l->path, NULL);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	hdr.seq = ++uplink.seq;
+	hdr.timestamp = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+	hdr.raw_len = hdr.len = uplink.raw->len;
+	payload = uplink.raw->data;
+
+#ifdef HAVE_ZSTD
+	buf = talloc_size(g_oss, ZSTD_compressBound(uplink.raw->len));
+	rc = ZSTD_compressCCtx(uplink.zctx, buf, ZSTD_compressBound(uplink.raw->len), uplink.raw->data,
+			       uplink.raw->len, UPLINK_ZSTD_LEVEL);
+	if (!ZSTD_isError(rc) && rc < uplink.raw->len) {
+		hdr.flags |= UPLINK_F_ZSTD;
+		hdr.len = rc;
+		payload = buf;
+	}
+#endif
+
+	f = talloc_size(g_oss, sizeof(*f) + UPLINK_HDR_LEN + hdr.len);
+	OSMO_ASSERT(f);
+	f->seq = hdr.seq;
+	f->key = hdr.type == UPLINK_KEY;
+	f->queued = ts.tv_sec;
+	f->len = UPLINK_HDR_LEN + hdr.len;
+	uplink_hdr_encode(f->data, &hdr);
+	memcpy(f->data + UPLINK_HDR_LEN, payload, hdr.len);
+#ifdef HAVE_ZSTD
+	talloc_free(buf);
+#endif
+
+	uplink.stats.raw_bytes += UPLINK_HDR_LEN + hdr.raw_len;
+	uplink.stats.bytes += f->len;
+	return f;
+}
+
+/* Send spooled frames at up to the configured rate, as far as the socket
+ * takes them. A frame larger than the rate is sent once the bucket is full,
+ * going below zero. */
+static void spool_drain(void)
+{
+	struct timespec now;
+	struct uplink_hdr hdr;
+	uint8_t buf[UPLINK_HDR_LEN];
+	struct spool_segment *seg;
+	size_t len;
+	double elapsed;
+
+	if (!uplink.connected || llist_empty(&uplink.segments))
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - uplink.last_fill.tv_sec) + (now.tv_nsec - uplink.last_fill.tv_nsec) / 1e9;
+	uplink.last_fill = now;
+	uplink.tokens = OSMO_MIN(uplink.cfg.spool_rate, uplink.tokens + elapsed * uplink.cfg.spool_rate);
+
+	while (uplink.connected) {
+		/* continued by the write event */
+		if (uplink.out->len - uplink.out_off >= UPLINK_MAX_DRAIN_OUT) {
+			uplink_write();
+			if (!uplink.connected || uplink.out->len - uplink.out_off >= UPLINK_MAX_DRAIN_OUT)
+				return;
+		}
+		if (!uplink.drain_seg) {
+			uplink.drain_seg = llist_first_entry(&uplink.segments, struct spool_segment, list);
+			uplink.drain_fd = open(uplink.drain_seg->path, O_RDONLY | O_CLOEXEC);
+			uplink.drain_off = 0;
+			if (uplink.drain_fd < 0) {
+				spool_segment_del(uplink.drain_seg);
+				return;
+			}
+		}
+		seg = uplink.drain_seg;
+		if (uplink.drain_off >= seg->size) {
+			/* caught up with the spool */
+			if (seg == llist_last_entry(&uplink.segments, struct spool_segment, list))
+				break;
+			close(uplink.drain_fd);
+			uplink.drain_seg = llist_entry(seg->list.next, struct spool_segment, list);
+			uplink.drain_fd = open(uplink.drain_seg->path, O_RDONLY | O_CLOEXEC);
+			uplink.drain_off = 0;
+			if (uplink.drain_fd < 0) {
+				spool_segment_del(uplink.drain_seg);
+				return;
+			}
+			continue;
+		}
+
+		if (pread(uplink.drain_fd, buf, sizeof(buf), uplink.drain_off) != sizeof(buf) ||
+		    uplink_hdr_decode(&hdr, buf) < 0) {
+			spool_segment_del(seg);
+			return;
+		}
+		len = sizeof(buf) + hdr.len;
+		if (uplink.tokens < len && uplink.tokens < uplink.cfg.spool_rate) {
+			elapsed = (OSMO_MIN(len, uplink.cfg.spool_rate) - uplink.tokens) / uplink.cfg.spool_rate;
+			osmo_timer_schedule(&uplink.drain_timer, elapsed, (elapsed - (int)elapsed) * 1000000);
+			break;
+		}
+
+		render_buf_reserve(uplink.out, len);
+		if (pread(uplink.drain_fd, uplink.out->data + uplink.out->len, len, uplink.drain_off) != len) {
+			spool_segment_del(seg);
+			return;
+		}
+		uplink.out->data[uplink.out->len + 1] |= UPLINK_F_SPOOL;
+		uplink.out->len += len;
+		uplink.drain_off += len;
+		uplink.tokens -= len;
+	}
+	uplink_write();
+}
+
+/* called once on startup before config file parsing */
+int osysmon_uplink_init()
+{
+	char hostname[256];
+
+	osmo_timer_setup(&uplink.reconnect_timer, uplink_reconnect_cb, NULL);
+	osmo_timer_setup(&uplink.drain_timer, uplink_drain_cb, NULL);
+	if (gethostname(hostname, sizeof(hostname)) < 0)
+		strcpy(hostname, "osmo-sysmon");
+	hostname[sizeof(hostname) - 1] = '\0';
+	uplink.cfg.site = talloc_strdup(g_oss, hostname);
+	uplink.raw = render_buf_alloc(g_oss, 65536);
+#ifdef HAVE_ZSTD
+	uplink.zctx = ZSTD_createCCtx();
+	OSMO_ASSERT(uplink.zctx);
+#endif
+	osysmon_uplink_vty_init();
+	return 0;
+}
+
+int osysmon_uplink_poll(struct value_node *parent)
+{
+	struct value_node *vn;
+	char buf[32];
+
+	if (!uplink.cfg.host)
+		return 0;
+
+	vn = value_node_add(parent, "uplink", NULL);
+	if (!vn)
+		return -ENOMEM;
+	value_node_add(vn, "state", uplink.connected ? "connected" :
+		       uplink.ofd.fd >= 0 ? "connecting" : "disconnected");
+	snprintf(buf, sizeof(buf), "%zu kB", uplink.spool_size / 1024);
+	value_node_add(vn, "spool", buf);
+	snprintf(buf, sizeof(buf), "%.2f", uplink.stats.bytes ? (double)uplink.stats.raw_bytes / uplink.stats.bytes : 0.0);
+	value_node_add(vn, "compression-ratio", buf);
+	snprintf(buf, sizeof(buf), "%" PRIu64, uplink.stats.dropped);
+	value_node_add(vn, "dropped", buf);
+	return 0;
+}
+
+/* called with every completed tree, after g_oss->leaves was updated */
+void osysmon_uplink_update(struct value_node *root)
+{
+	struct uplink_frame *f;
+	time_t now = time(NULL);
+
+	if (!uplink.cfg.host)
+		return;
+
+	f = frame_build();
+	if (uplink.cfg.udp) {
+		uplink_send_datagram(f);
+		talloc_free(f);
+		return;
+	}
+	if (uplink.ofd.fd < 0) {
+		spool_append(f);
+		talloc_free(f);
+		return;
+	}
+
+	llist_add_tail(&f->list, &uplink.unacked);
+	uplink.unacked_bytes += f->len;
+	render_buf_append(uplink.out, f->data, f->len);
+
+	/* the oldest unacknowledged frame */
+	llist_for_each_entry(f, &uplink.unacked, list) {
+		if (f->seq > uplink.acked)
+			break;
+	}
+	if ((&f->list != &uplink.unacked && now - f->queued > UPLINK_ACK_TIMEOUT) ||
+	    uplink.unacked_bytes > UPLINK_MAX_PENDING || uplink.out->len - uplink.out_off > UPLINK_MAX_PENDING) {
+		uplink_disconnect();
+		return;
+	}
+
+	uplink_write();
+	spool_drain();
+}
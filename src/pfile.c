@@ -0,0 +1,175 @@
+/* Simple Osmocom System Monitor (osysmon): persistently opened (pseudo-)files */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <talloc.h>
+#include <osmocom/core/utils.h>
+
+#include "pfile.h"
+
+static int pfile_talloc_destructor(struct pfile *pf)
+{
+	pfile_close(pf);
+	return 0;
+}
+
+/* The buffer needs to be large enough for the entire file: /proc files
+ * generated by seq_file can't be read piecewise at offset 0 */
+struct pfile *pfile_alloc(void *ctx, const char *path, size_t size)
+{
+	struct pfile *pf;
+
+	pf = talloc_zero(ctx, struct pfile);
+	OSMO_ASSERT(pf);
+	pf->path = talloc_strdup(pf, path);
+	pf->fd = -1;
+	pf->size = size;
+	pf->buf = talloc_size(pf, size);
+	OSMO_ASSERT(pf->path && pf->buf);
+	pf->buf[0] = '\0';
+	talloc_set_destructor(pf, pfile_talloc_destructor);
+	return pf;
+}
+
+/* For /proc/PID/... files: open right away and never re-open by path, once
+ * the process exited the PID may belong to an unrelated one. Reads fail
+ * with -ESRCH after the process is gone (or if the open failed). */
+struct pfile *pfile_alloc_pinned(void *ctx, const char *path, size_t size)
+{
+	struct pfile *pf = pfile_alloc(ctx, path, size);
+
+	pf->pinned = true;
+	pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+	return pf;
+}
+
+void pfile_close(struct pfile *pf)
+{
+	if (pf->fd >= 0)
+		close(pf->fd);
+	pf->fd = -1;
+}
+
+/* Returns the number of bytes read into pf->buf, or -errno */
+ssize_t pfile_read(struct pfile *pf)
+{
+	int retry;
+
+	for (retry = 0; retry < 2; retry++) {
+		if (pf->fd < 0 && pf->pinned) {
+			pf->len = -ESRCH;
+			break;
+		}
+		if (pf->fd < 0) {
+			pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+			if (pf->fd < 0) {
+				pf->len = -errno;
+				break;
+			}
+		}
+		pf->len = pread(pf->fd, pf->buf, pf->size - 1, 0);
+		if (pf->len >= 0)
+			break;
+		pf->len = -errno;
+		/* re-open once, the file may have been replaced (never done for
+		 * pinned files) */
+		pfile_close(pf);
+	}
+
+	if (pf->len < 0) {
+		pf->buf[0] = '\0';
+		return pf->len;
+	}
+	pf->buf[pf->len] = '\0';
+	return pf->len;
+}
+
+const char *pfile_skip_ws(const char *p)
+{
+	if (!p)
+		return NULL;
+	while (*p == ' ' || *p == '\t')
+		p++;
+	return *p ? p : NULL;
+}
+
+/* Skip the current whitespace separated field and the whitespace after it */
+const char *pfile_skip_field(const char *p)
+{
+	if (!p)
+		return NULL;
+	while (*p && *p != ' ' && *p != '\t' && *p != '\n')
+		p++;
+	return pfile_skip_ws(p);
+}
+
+const char *pfile_next_line(const char *p)
+{
+	if (!p)
+		return NULL;
+	p = strchr(p, '\n');
+	if (!p || !p[1])
+		return NULL;
+	return p + 1;
+}
+
+/* Parse an unsigned decimal number after optional whitespace */
+const char *pfile_parse_u64(const char *p, uint64_t *val)
+{
+	uint64_t v = 0;
+
+	p = pfile_skip_ws(p);
+	if (!p || *p < '0' || *p > '9')
+		return NULL;
+	while (*p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
+	*val = v;
+	return p;
+}
+
+/* Find the line starting with key, return the position right after it */
+const char *pfile_find_key(const char *p, const char *key)
+{
+	size_t len = strlen(key);
+
+	while (p) {
+		if (!strncmp(p, key, len))
+			return p + len;
+		p = pfile_next_line(p);
+	}
+	return NULL;
+}
+
+/* Find the field starting with name (e.g. "total=") in the current line,
+ * return the position right after it */
+const char *pfile_find_field(const char *p, const char *name)
+{
+	size_t len = strlen(name);
+
+	p = pfile_skip_ws(p);
+	while (p && *p != '\n') {
+		if (!strncmp(p, name, len))
+			return p + len;
+		p = pfile_skip_field(p);
+	}
+	return NULL;
+}
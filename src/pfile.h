@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* A (pseudo-)file kept open and re-read from offset 0 with pread() every
+ * time, e.g. in /proc or /sys, saving the open()/close() per poll */
+struct pfile {
+	const char *path;
+	int fd;
+	/* contents of the last read, NUL-terminated */
+	char *buf;
+	size_t size;
+	ssize_t len;
+	/* never re-open by path, see pfile_alloc_pinned() */
+	bool pinned;
+};
+
+struct pfile *pfile_alloc(void *ctx, const char *path, size_t size);
+struct pfile *pfile_alloc_pinned(void *ctx, const char *path, size_t size);
+void pfile_close(struct pfile *pf);
+ssize_t pfile_read(struct pfile *pf);
+
+/* Allocation-free parsing helpers, all return NULL at the end of the buffer
+ * or if the expected token isn't there */
+const char *pfile_skip_ws(const char *p);
+const char *pfile_skip_field(const char *p);
+const char *pfile_next_line(const char *p);
+const char *pfile_parse_u64(const char *p, uint64_t *val);
+const char *pfile_find_key(const char *p, const char *key);
+const char *pfile_find_field(const char *p, const char *name);
@@ -0,0 +1,594 @@
+/* Simple Osmocom System Monitor (osysmon): rendering of the value tree */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <talloc.h>
+#include <osmocom/core/utils.h>
+
+#include "config.h"
+#include "value_node.h"
+#include "render.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/***********************************************************************
+ * Output buffer
+ ***********************************************************************/
+
+struct render_buf *render_buf_alloc(void *ctx, size_t size)
+{
+	struct render_buf *rb = talloc_zero(ctx, struct render_buf);
+
+	OSMO_ASSERT(rb);
+	rb->size = size;
+	rb->data = talloc_size(rb, size);
+	OSMO_ASSERT(rb->data);
+	rb->data[0] = '\0';
+	return rb;
+}
+
+void render_buf_reset(struct render_buf *rb)
+{
+	rb->len = 0;
+	rb->data[0] = '\0';
+}
+
+/* Make room for len more bytes plus the terminating NUL */
+void render_buf_reserve(struct render_buf *rb, size_t len)
+{
+	size_t size = rb->size;
+
+	if (rb->len + len < size)
+		return;
+	while (rb->len + len >= size)
+		size *= 2;
+	rb->data = talloc_realloc_size(rb, rb->data, size);
+	OSMO_ASSERT(rb->data);
+	rb->size = size;
+}
+
+void render_buf_append(struct render_buf *rb, const void *data, size_t len)
+{
+	render_buf_reserve(rb, len);
+	memcpy(rb->data + rb->len, data, len);
+	rb->len += len;
+	rb->data[rb->len] = '\0';
+}
+
+void render_buf_puts(struct render_buf *rb, const char *str)
+{
+	render_buf_append(rb, str, strlen(str));
+}
+
+void render_buf_printf(struct render_buf *rb, const char *fmt, ...)
+{
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(rb->data + rb->len, rb->size - rb->len, fmt, ap);
+	va_end(ap);
+	if (len < 0)
+		return;
+	if (rb->len + len >= rb->size) {
+		render_buf_reserve(rb, len);
+		va_start(ap, fmt);
+		vsnprintf(rb->data + rb->len, rb->size - rb->len, fmt, ap);
+		va_end(ap);
+	}
+	rb->len += len;
+}
+
+/***********************************************************************
+ * Text, JSON and CBOR
+ ***********************************************************************/
+
+/* All of these write the tree in a single depth-first pass straight into the
+ * buffer, without building any intermediate representation */
+
+const struct value_string render_format_names[] = {
+	{ RENDER_TEXT, "text" },
+	{ RENDER_JSON, "json" },
+	{ RENDER_CBOR, "cbor" },
+	{ 0, NULL }
+};
+
+static void render_text_node(struct render_buf *rb, const struct value_node *node, unsigned int indent)
+{
+	const struct value_node *vn;
+
+	render_buf_reserve(rb, indent);
+	memset(rb->data + rb->len, ' ', indent);
+	rb->len += indent;
+
+	if (node->value) {
+		render_buf_printf(rb, "%s: %s\n", node->name, node->value);
+		return;
+	}
+	render_buf_printf(rb, "%s\n", node->name);
+	llist_for_each_entry(vn, &node->children, list)
+		render_text_node(rb, vn, indent + 2);
+}
+
+/* JSON number grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)? */
+static bool is_number(const char *str, bool *integer)
+{
+	const char *c = str;
+
+	*integer = true;
+	if (*c == '-')
+		c++;
+	if (*c == '0')
+		c++;
+	else if (*c >= '1' && *c <= '9')
+		while (*c >= '0' && *c <= '9')
+			c++;
+	else
+		return false;
+	if (*c == '.') {
+		*integer = false;
+		c++;
+		if (*c < '0' || *c > '9')
+			return false;
+		while (*c >= '0' && *c <= '9')
+			c++;
+	}
+	if (*c == 'e' || *c == 'E') {
+		*integer = false;
+		c++;
+		if (*c == '+' || *c == '-')
+			c++;
+		if (*c < '0' || *c > '9')
+			return false;
+		while (*c >= '0' && *c <= '9')
+			c++;
+	}
+	return *c == '\0';
+}
+
+static void json_string(struct render_buf *rb, const char *str)
+{
+	const char *c;
+
+	render_buf_append(rb, "\"", 1);
+	for (c = str; *c; c++) {
+		switch (*c) {
+		case '"':
+			render_buf_puts(rb, "\\\"");
+			break;
+		case '\\':
+			render_buf_puts(rb, "\\\\");
+			break;
+		case '\n':
+			render_buf_puts(rb, "\\n");
+			break;
+		case '\t':
+			render_buf_puts(rb, "\\t");
+			break;
+		default:
+			if ((unsigned char)*c < 0x20)
+				render_buf_printf(rb, "\\u%04x", *c);
+			else
+				render_buf_append(rb, c, 1);
+		}
+	}
+	render_buf_append(rb, "\"", 1);
+}
+
+/* Values that are plain numbers are written as such, anything else (incl.
+ * values with a unit) as string */
+static void render_json_node(struct render_buf *rb, const struct value_node *node)
+{
+	const struct value_node *vn;
+	bool integer;
+
+	if (node->value) {
+		if (is_number(node->value, &integer))
+			render_buf_puts(rb, node->value);
+		else
+			json_string(rb, node->value);
+		return;
+	}
+
+	render_buf_append(rb, "{", 1);
+	llist_for_each_entry(vn, &node->children, list) {
+		if (vn->list.prev != &node->children)
+			render_buf_append(rb, ",", 1);
+		json_string(rb, vn->name);
+		render_buf_append(rb, ":", 1);
+		render_json_node(rb, vn);
+	}
+	render_buf_append(rb, "}", 1);
+}
+
+/* RFC 8949 major types */
+#define CBOR_UINT	0
+#define CBOR_NINT	1
+#define CBOR_TEXT	3
+#define CBOR_MAP	5
+#define CBOR_FLOAT64	((7 << 5) | 27)
+
+static void cbor_head(struct render_buf *rb, uint8_t major, uint64_t val)
+{
+	uint8_t buf[9];
+	unsigned int len, i;
+
+	if (val < 24) {
+		buf[0] = (major << 5) | val;
+		len = 1;
+	} else if (val <= 0xff) {
+		buf[0] = (major << 5) | 24;
+		len = 2;
+	} else if (val <= 0xffff) {
+		buf[0] = (major << 5) | 25;
+		len = 3;
+	} else if (val <= 0xffffffff) {
+		buf[0] = (major << 5) | 26;
+		len = 5;
+	} else {
+		buf[0] = (major << 5) | 27;
+		len = 9;
+	}
+	/* big endian */
+	for (i = len - 1; i > 0; i--) {
+		buf[i] = val & 0xff;
+		val >>= 8;
+	}
+	render_buf_append(rb, buf, len);
+}
+
+static void cbor_text(struct render_buf *rb, const char *str)
+{
+	size_t len = strlen(str);
+
+	cbor_head(rb, CBOR_TEXT, len);
+	render_buf_append(rb, str, len);
+}
+
+static void cbor_value(struct render_buf *rb, const char *value)
+{
+	unsigned long long u;
+	uint8_t buf[9];
+	bool integer;
+	uint64_t bits;
+	double d;
+	int i;
+
+	if (!is_number(value, &integer)) {
+		cbor_text(rb, value);
+		return;
+	}
+
+	if (integer) {
+		errno = 0;
+		u = strtoull(value[0] == '-' ? value + 1 : value, NULL, 10);
+		if (!errno) {
+			if (value[0] != '-')
+				cbor_head(rb, CBOR_UINT, u);
+			else if (u)
+				cbor_head(rb, CBOR_NINT, u - 1);
+			else
+				cbor_head(rb, CBOR_UINT, 0);
+			return;
+		}
+	}
+
+	d = strtod(value, NULL);
+	memcpy(&bits, &d, sizeof(bits));
+	buf[0] = CBOR_FLOAT64;
+	for (i = 8; i > 0; i--) {
+		buf[i] = bits & 0xff;
+		bits >>= 8;
+	}
+	render_buf_append(rb, buf, sizeof(buf));
+}
+
+/* Maps with definite length, the number of children is cheap to count */
+static void render_cbor_node(struct render_buf *rb, const struct value_node *node)
+{
+	const struct value_node *vn;
+
+	if (node->value) {
+		cbor_value(rb, node->value);
+		return;
+	}
+
+	cbor_head(rb, CBOR_MAP, llist_count(&node->children));
+	llist_for_each_entry(vn, &node->children, list) {
+		cbor_text(rb, vn->name);
+		render_cbor_node(rb, vn);
+	}
+}
+
+/* Render the tree, replacing the contents of rb. JSON is one line (i.e.
+ * NDJSON over several ticks), CBOR one map (i.e. a CBOR sequence), both
+ * without the root node itself. */
+void render_tree(struct render_buf *rb, enum render_format fmt, const struct value_node *root)
+{
+	render_buf_reset(rb);
+
+	switch (fmt) {
+	case RENDER_TEXT:
+		render_text_node(rb, root, 0);
+		break;
+	case RENDER_JSON:
+		render_json_node(rb, root);
+		render_buf_append(rb, "\n", 1);
+		break;
+	case RENDER_CBOR:
+		render_cbor_node(rb, root);
+		break;
+	}
+}
+
+/***********************************************************************
+ * OpenMetrics
+ ***********************************************************************/
+
+/* The tree has no notion of metric types, so every leaf becomes a sample:
+ *
+ *   netdev/eth0/rx-bytes: 1234    ->  osysmon_netdev_rx_bytes{name="eth0"} 1234
+ *   process/bts/rss: 1560 kB      ->  osysmon_process_rss_bytes{name="bts"} 1597440
+ *   cpu/pressure/io/some: 0.3%    ->  osysmon_cpu_some_percent{name="pressure/io"} 0.3
+ *   sysinfo/uname: Linux ...      ->  osysmon_sysinfo_uname_info{value="Linux ..."} 1
+ *
+ * i.e. the family is named after the top level node and the leaf, the levels
+ * in between end up in the "name" label. Values with a known unit are
+ * converted to base units, anything else that isn't a number becomes an
+ * info metric. */
+
+#define OM_MAX_DEPTH	16
+
+struct om_sample {
+	/* position in the tree, keeps the output order within a family */
+	unsigned int seq;
+	char *family;
+	bool info;
+	/* the levels between top level node and leaf, may be NULL */
+	char *name;
+	/* the number to print, or the string value of an info metric */
+	char *value;
+};
+
+struct om_state {
+	void *ctx;
+	struct om_sample *samples;
+	unsigned int num;
+	unsigned int alloc;
+	const char *path[OM_MAX_DEPTH];
+};
+
+static void om_append_sanitized(struct render_buf *rb, const char *str)
+{
+	const char *c;
+	char ch;
+
+	for (c = str; *c; c++) {
+		ch = *c;
+		if (!((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') ||
+		      (ch >= '0' && ch <= '9') || ch == '_' || ch == ':'))
+			ch = '_';
+		render_buf_append(rb, &ch, 1);
+	}
+}
+
+static void om_append_escaped(struct render_buf *rb, const char *str)
+{
+	const char *c;
+
+	for (c = str; *c; c++) {
+		switch (*c) {
+		case '\\':
+			render_buf_puts(rb, "\\\\");
+			break;
+		case '"':
+			render_buf_puts(rb, "\\\"");
+			break;
+		case '\n':
+			render_buf_puts(rb, "\\n");
+			break;
+		default:
+			render_buf_append(rb, c, 1);
+		}
+	}
+}
+
+/* Parse "1234", "-3.5%", "1560 kB", ... into the number to print and the
+ * unit. Returns NULL if the value isn't a number with a known unit. */
+static char *om_parse_number(void *ctx, const char *value, const struct value_unit **unit)
+{
+	double val;
+	size_t len;
+
+	*unit = value_number(value, &val, &len);
+	if (!*unit)
+		return NULL;
+	/* keep integers exact, a double has only 53 bits */
+	if ((*unit)->scale == 1)
+		return talloc_strndup(ctx, value, len);
+	return talloc_asprintf(ctx, "%.15g", val * (*unit)->scale);
+}
+
+static void om_add_sample(struct om_state *st, unsigned int depth, const char *value)
+{
+	const struct value_unit *unit;
+	struct render_buf *rb;
+	struct om_sample *s;
+	unsigned int i;
+
+	if (st->num == st->alloc) {
+		st->alloc = st->alloc ? st->alloc * 2 : 64;
+		st->samples = talloc_realloc(st->ctx, st->samples, struct om_sample, st->alloc);
+		OSMO_ASSERT(st->samples);
+	}
+	s = &st->samples[st->num];
+	memset(s, 0, sizeof(*s));
+	s->seq = st->num++;
+
+	s->value = om_parse_number(st->ctx, value, &unit);
+	if (!s->value) {
+		s->info = true;
+		s->value = talloc_strdup(st->ctx, value);
+	}
+
+	rb = render_buf_alloc(st->ctx, 64);
+	render_buf_puts(rb, "osysmon_");
+	om_append_sanitized(rb, st->path[0]);
+	if (depth > 1) {
+		render_buf_puts(rb, "_");
+		om_append_sanitized(rb, st->path[depth - 1]);
+	}
+	if (!s->info)
+		render_buf_puts(rb, unit->om_suffix);
+	s->family = rb->data;
+
+	if (depth > 2) {
+		rb = render_buf_alloc(st->ctx, 32);
+		for (i = 1; i < depth - 1; i++) {
+			if (i > 1)
+				render_buf_puts(rb, "/");
+			render_buf_puts(rb, st->path[i]);
+		}
+		s->name = rb->data;
+	}
+}
+
+static void om_walk(struct om_state *st, const struct value_node *node, unsigned int depth)
+{
+	const struct value_node *vn;
+
+	if (depth >= OM_MAX_DEPTH)
+		return;
+
+	llist_for_each_entry(vn, &node->children, list) {
+		st->path[depth] = vn->name;
+		if (vn->value)
+			om_add_sample(st, depth + 1, vn->value);
+		else
+			om_walk(st, vn, depth + 1);
+	}
+}
+
+/* all samples of a family have to be in one block */
+static int om_sample_cmp(const void *_a, const void *_b)
+{
+	const struct om_sample *a = _a, *b = _b;
+	int rc = strcmp(a->family, b->family);
+
+	if (rc)
+		return rc;
+	if (a->info != b->info)
+		return a->info - b->info;
+	return (int)a->seq - (int)b->seq;
+}
+
+static void om_render_sample(struct render_buf *rb, const struct om_sample *s, const char *family)
+{
+	render_buf_puts(rb, family);
+	if (s->info)
+		render_buf_puts(rb, "_info");
+	if (s->name || s->info) {
+		render_buf_puts(rb, "{");
+		if (s->name) {
+			render_buf_puts(rb, "name=\"");
+			om_append_escaped(rb, s->name);
+			render_buf_puts(rb, s->info ? "\"," : "\"");
+		}
+		if (s->info) {
+			render_buf_puts(rb, "value=\"");
+			om_append_escaped(rb, s->value);
+			render_buf_puts(rb, "\"");
+		}
+		render_buf_puts(rb, "}");
+	}
+	render_buf_puts(rb, " ");
+	render_buf_puts(rb, s->info ? "1" : s->value);
+	render_buf_puts(rb, "\n");
+}
+
+/* Render the tree in the OpenMetrics text format, replacing the contents of rb */
+void render_openmetrics(struct render_buf *rb, const struct value_node *root)
+{
+	struct om_state st = {};
+	const struct om_sample *s, *prev = NULL;
+	char *family = NULL;
+	unsigned int i;
+
+	st.ctx = talloc_new(rb);
+	om_walk(&st, root, 0);
+	if (st.num)
+		qsort(st.samples, st.num, sizeof(*st.samples), om_sample_cmp);
+
+	render_buf_reset(rb);
+	for (i = 0; i < st.num; i++) {
+		s = &st.samples[i];
+		if (!prev || strcmp(s->family, prev->family) || s->info != prev->info) {
+			/* a family name can only be used for one type */
+			if (prev && s->info && !prev->info && !strcmp(s->family, prev->family))
+				family = talloc_asprintf(st.ctx, "%s_text", s->family);
+			else
+				family = s->family;
+			render_buf_printf(rb, "# TYPE %s %s\n", family, s->info ? "info" : "gauge");
+		}
+		om_render_sample(rb, s, family);
+		prev = s;
+	}
+	render_buf_puts(rb, "# EOF\n");
+
+	talloc_free(st.ctx);
+}
+
+/***********************************************************************
+ * Compression
+ ***********************************************************************/
+
+/* gzip the contents of in into out. Returns -ENOTSUP without zlib. */
+int render_gzip(struct render_buf *out, const struct render_buf *in)
+{
+#ifdef HAVE_ZLIB
+	z_stream zs = {};
+	int rc;
+
+	/* 16 + MAX_WBITS: gzip header instead of zlib */
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+			 Z_DEFAULT_STRATEGY) != Z_OK)
+		return -ENOMEM;
+
+	render_buf_reset(out);
+	render_buf_reserve(out, deflateBound(&zs, in->len));
+	zs.next_in = (Bytef *)in->data;
+	zs.avail_in = in->len;
+	zs.next_out = (Bytef *)out->data;
+	zs.avail_out = out->size;
+	rc = deflate(&zs, Z_FINISH);
+	out->len = zs.total_out;
+	deflateEnd(&zs);
+
+	return rc == Z_STREAM_END ? 0 : -EIO;
+#else
+	return -ENOTSUP;
+#endif
+}
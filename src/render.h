@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct value_node;
+
+/* An output buffer that is grown as needed and re-used across renderings,
+ * so a steady-state tick doesn't allocate */
+struct render_buf {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+struct render_buf *render_buf_alloc(void *ctx, size_t size);
+void render_buf_reset(struct render_buf *rb);
+void render_buf_reserve(struct render_buf *rb, size_t len);
+void render_buf_append(struct render_buf *rb, const void *data, size_t len);
+void render_buf_puts(struct render_buf *rb, const char *str);
+void render_buf_printf(struct render_buf *rb, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+enum render_format {
+	RENDER_TEXT,
+	RENDER_JSON,
+	RENDER_CBOR,
+};
+
+extern const struct value_string render_format_names[];
+
+void render_tree(struct render_buf *rb, enum render_format fmt, const struct value_node *root);
+void render_openmetrics(struct render_buf *rb, const struct value_node *root);
+int render_gzip(struct render_buf *out, const struct render_buf *in);
@@ -0,0 +1,363 @@
+/* Gorilla-style encoding of the osmo-sysmon time series store */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include <string.h>
+#include <errno.h>
+
+#include <talloc.h>
+#include <osmocom/core/utils.h>
+
+#include "tsdb.h"
+
+/***********************************************************************
+ * Bit I/O, MSB first
+ ***********************************************************************/
+
+struct bitbuf {
+	uint8_t *data;
+	uint32_t size;
+	uint32_t pos;
+	bool overflow;
+};
+
+static void put_bits(struct bitbuf *bb, uint64_t val, unsigned int num)
+{
+	unsigned int bit;
+
+	if (bb->pos + num > bb->size) {
+		bb->overflow = true;
+		return;
+	}
+	while (num) {
+		num--;
+		bit = (val >> num) & 1;
+		if (bit)
+			bb->data[bb->pos / 8] |= 0x80 >> (bb->pos % 8);
+		else
+			bb->data[bb->pos / 8] &= ~(0x80 >> (bb->pos % 8));
+		bb->pos++;
+	}
+}
+
+static uint64_t get_bits(struct bitbuf *bb, unsigned int num)
+{
+	uint64_t val = 0;
+
+	if (bb->pos + num > bb->size) {
+		bb->overflow = true;
+		return 0;
+	}
+	while (num--) {
+		val = (val << 1) | ((bb->data[bb->pos / 8] >> (7 - bb->pos % 8)) & 1);
+		bb->pos++;
+	}
+	return val;
+}
+
+/* exp-Golomb, order 0 */
+static void put_ue(struct bitbuf *bb, uint32_t val)
+{
+	uint64_t v = (uint64_t)val + 1;
+	unsigned int len = 64 - __builtin_clzll(v);
+
+	put_bits(bb, 0, len - 1);
+	put_bits(bb, v, len);
+}
+
+static uint32_t get_ue(struct bitbuf *bb)
+{
+	unsigned int zeros = 0;
+
+	while (!bb->overflow && !get_bits(bb, 1)) {
+		if (++zeros > 32) {
+			bb->overflow = true;
+			return 0;
+		}
+	}
+	return ((1ULL << zeros) | get_bits(bb, zeros)) - 1;
+}
+
+/* zig-zag for signed id differences */
+static uint32_t zz_enc(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t zz_dec(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static int64_t sign_extend(uint64_t v, unsigned int bits)
+{
+	return (int64_t)(v << (64 - bits)) >> (64 - bits);
+}
+
+/***********************************************************************
+ * Codec state
+ ***********************************************************************/
+
+struct tsdb_codec *tsdb_codec_alloc(void *ctx)
+{
+	struct tsdb_codec *codec = talloc_zero(ctx, struct tsdb_codec);
+
+	OSMO_ASSERT(codec);
+	codec->ctx = codec;
+	return codec;
+}
+
+/* start a new block */
+void tsdb_codec_reset(struct tsdb_codec *codec)
+{
+	if (codec->series)
+		memset(codec->series, 0, codec->num_series * sizeof(*codec->series));
+	codec->num_ids = 0;
+	codec->prev_ts = 0;
+	codec->prev_delta = 0;
+	codec->num_ticks = 0;
+}
+
+static int codec_reserve(struct tsdb_codec *codec, uint32_t max_id, uint32_t num_ids)
+{
+	struct tsdb_series_state *series;
+	uint32_t *ids;
+
+	if (max_id >= codec->num_series) {
+		series = talloc_realloc(codec, codec->series, struct tsdb_series_state, max_id + 1);
+		if (!series)
+			return -ENOMEM;
+		memset(series + codec->num_series, 0, (max_id + 1 - codec->num_series) * sizeof(*series));
+		codec->series = series;
+		codec->num_series = max_id + 1;
+	}
+	if (num_ids > codec->alloc_ids) {
+		ids = talloc_realloc(codec, codec->ids, uint32_t, num_ids);
+		if (!ids)
+			return -ENOMEM;
+		codec->ids = ids;
+		codec->alloc_ids = num_ids;
+	}
+	return 0;
+}
+
+/***********************************************************************
+ * Encoder
+ ***********************************************************************/
+
+static void put_ts(struct bitbuf *bb, int64_t dod)
+{
+	if (dod == 0) {
+		put_bits(bb, 0, 1);
+	} else if (dod >= -64 && dod < 64) {
+		put_bits(bb, 0x2, 2);
+		put_bits(bb, dod, 7);
+	} else if (dod >= -256 && dod < 256) {
+		put_bits(bb, 0x6, 3);
+		put_bits(bb, dod, 9);
+	} else if (dod >= -2048 && dod < 2048) {
+		put_bits(bb, 0xe, 4);
+		put_bits(bb, dod, 12);
+	} else {
+		put_bits(bb, 0xf, 4);
+		put_bits(bb, dod, 32);
+	}
+}
+
+static void put_value(struct bitbuf *bb, struct tsdb_series_state *st, double value)
+{
+	uint64_t cur, xor;
+	unsigned int lead, trail, len;
+
+	memcpy(&cur, &value, sizeof(cur));
+	xor = cur ^ st->prev;
+	st->prev = cur;
+
+	if (!xor) {
+		put_bits(bb, 0, 1);
+		st->valid = true;
+		return;
+	}
+
+	lead = __builtin_clzll(xor);
+	trail = __builtin_ctzll(xor);
+	if (lead > 31)
+		lead = 31;
+
+	if (st->valid && st->lead + st->trail && lead >= st->lead && trail >= st->trail) {
+		len = 64 - st->lead - st->trail;
+		put_bits(bb, 0x2, 2);
+		put_bits(bb, xor >> st->trail, len);
+		return;
+	}
+
+	len = 64 - lead - trail;
+	put_bits(bb, 0x3, 2);
+	put_bits(bb, lead, 5);
+	put_bits(bb, len - 1, 6);
+	put_bits(bb, xor >> trail, len);
+	st->lead = lead;
+	st->trail = trail;
+	st->valid = true;
+}
+
+/* Append one tick to the block data, of which *bits are used already.
+ * Returns -ENOSPC (leaving codec and *bits untouched) if it doesn't fit, the
+ * caller has to start a new block then. */
+int tsdb_encode_tick(struct tsdb_codec *codec, uint8_t *data, uint32_t size_bits, uint32_t *bits,
+		     uint64_t ts, const uint32_t *ids, const double *values, uint32_t num)
+{
+	struct bitbuf bb = { .data = data, .size = size_bits, .pos = *bits };
+	struct tsdb_series_state *saved;
+	uint32_t i, max_id = 0, prev_id = 0;
+	int64_t delta = 0, dod;
+	bool same;
+	int rc;
+
+	for (i = 0; i < num; i++)
+		max_id = OSMO_MAX(max_id, ids[i]);
+	rc = codec_reserve(codec, max_id, num);
+	if (rc < 0)
+		return rc;
+
+	if (codec->num_ticks) {
+		delta = ts - codec->prev_ts;
+		dod = delta - codec->prev_delta;
+		if (dod < INT32_MIN || dod > INT32_MAX)
+			return -ENOSPC;
+		put_ts(&bb, dod);
+	}
+
+	same = codec->num_ticks && num == codec->num_ids &&
+	       !memcmp(ids, codec->ids, num * sizeof(*ids));
+	put_bits(&bb, !same, 1);
+	if (!same) {
+		put_ue(&bb, num);
+		for (i = 0; i < num; i++) {
+			put_ue(&bb, zz_enc(ids[i] - prev_id - 1));
+			prev_id = ids[i];
+		}
+	}
+
+	/* the state of the series changes while encoding */
+	saved = talloc_memdup(codec, codec->series, codec->num_series * sizeof(*codec->series));
+	if (!saved)
+		return -ENOMEM;
+	for (i = 0; i < num && !bb.overflow; i++)
+		put_value(&bb, &codec->series[ids[i]], values[i]);
+
+	if (bb.overflow) {
+		memcpy(codec->series, saved, codec->num_series * sizeof(*codec->series));
+		talloc_free(saved);
+		return -ENOSPC;
+	}
+	talloc_free(saved);
+
+	if (!same) {
+		memcpy(codec->ids, ids, num * sizeof(*ids));
+		codec->num_ids = num;
+	}
+	codec->prev_delta = delta;
+	codec->prev_ts = ts;
+	codec->num_ticks++;
+	*bits = bb.pos;
+	return 0;
+}
+
+/***********************************************************************
+ * Decoder
+ ***********************************************************************/
+
+static int64_t get_ts(struct bitbuf *bb)
+{
+	if (!get_bits(bb, 1))
+		return 0;
+	if (!get_bits(bb, 1))
+		return sign_extend(get_bits(bb, 7), 7);
+	if (!get_bits(bb, 1))
+		return sign_extend(get_bits(bb, 9), 9);
+	if (!get_bits(bb, 1))
+		return sign_extend(get_bits(bb, 12), 12);
+	return sign_extend(get_bits(bb, 32), 32);
+}
+
+static double get_value(struct bitbuf *bb, struct tsdb_series_state *st)
+{
+	unsigned int len;
+	uint64_t xor = 0;
+	double value;
+
+	if (get_bits(bb, 1)) {
+		if (!get_bits(bb, 1) && st->valid) {
+			len = 64 - st->lead - st->trail;
+			xor = get_bits(bb, len) << st->trail;
+		} else {
+			st->lead = get_bits(bb, 5);
+			len = get_bits(bb, 6) + 1;
+			if (st->lead + len > 64) {
+				bb->overflow = true;
+				return 0;
+			}
+			st->trail = 64 - st->lead - len;
+			xor = get_bits(bb, len) << st->trail;
+		}
+	}
+	st->prev ^= xor;
+	st->valid = true;
+	memcpy(&value, &st->prev, sizeof(value));
+	return value;
+}
+
+/* Call cb for every sample in the block. Returns -EINVAL for a corrupt block,
+ * after the samples that could be decoded. */
+int tsdb_decode_block(struct tsdb_codec *codec, const struct tsdb_block_hdr *hdr, const uint8_t *data,
+		      uint32_t size_bits, tsdb_sample_cb cb, void *cb_data)
+{
+	struct bitbuf bb = { .data = (uint8_t *)data, .size = OSMO_MIN(size_bits, hdr->bits) };
+	uint64_t ts = hdr->first_ts;
+	uint32_t tick, i, num, id;
+	int64_t delta = 0;
+	double value;
+
+	tsdb_codec_reset(codec);
+	for (tick = 0; tick < hdr->num_ticks; tick++) {
+		if (tick) {
+			delta += get_ts(&bb);
+			ts += delta;
+		}
+		if (get_bits(&bb, 1)) {
+			num = get_ue(&bb);
+			if (bb.overflow || num > bb.size || codec_reserve(codec, 0, num) < 0)
+				return -EINVAL;
+			for (i = 0, id = 0; i < num; i++) {
+				id += zz_dec(get_ue(&bb)) + 1;
+				codec->ids[i] = id;
+			}
+			codec->num_ids = num;
+		}
+		for (i = 0; i < codec->num_ids; i++) {
+			id = codec->ids[i];
+			if (bb.overflow || codec_reserve(codec, id, 0) < 0)
+				return -EINVAL;
+			value = get_value(&bb, &codec->series[id]);
+			if (bb.overflow)
+				return -EINVAL;
+			cb(ts, id, value, cb_data);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+/* On-disk time series of osmo-sysmon ("tsdb PATH"), Gorilla-style encoded.
+ *
+ * The file is a ring of fixed-size blocks, block 0 is the file header. Each
+ * data block holds the samples of all series for a number of ticks and can
+ * be decoded on its own:
+ *
+ *   timestamp  first one in the header, then delta-of-delta in ms:
+ *              '0' | '10' 7 bit | '110' 9 bit | '1110' 12 bit | '1111' 32 bit
+ *   series     '0' same series as in the previous tick, or '1' and their
+ *              count and ids, each as exp-Golomb coded difference
+ *   values     per series, XOR with its previous value in the block:
+ *              '0' same | '10' meaningful bits in the previous window |
+ *              '11' 5 bit leading zeros, 6 bit length - 1, meaningful bits
+ *
+ * Series ids index the lines of the catalog file PATH.series (starting at 1),
+ * which holds the path of each series. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define TSDB_FILE_MAGIC		0x4244544f	/* "OTDB" */
+#define TSDB_BLOCK_MAGIC	0x4b4c4254	/* "TBLK" */
+#define TSDB_VERSION		1
+
+struct tsdb_file_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_size;
+	uint32_t num_blocks;
+};
+
+struct tsdb_block_hdr {
+	uint32_t magic;
+	/* increments with every block, the oldest one is overwritten */
+	uint32_t seq;
+	/* CLOCK_REALTIME in ms */
+	uint64_t first_ts;
+	uint64_t last_ts;
+	uint32_t num_ticks;
+	/* encoded data following the header */
+	uint32_t bits;
+};
+
+/* per series state while encoding or decoding a block */
+struct tsdb_series_state {
+	uint64_t prev;
+	uint8_t lead;
+	uint8_t trail;
+	/* seen in this block */
+	bool valid;
+};
+
+struct tsdb_codec {
+	void *ctx;
+	/* indexed by series id */
+	struct tsdb_series_state *series;
+	uint32_t num_series;
+	/* series of the previous tick */
+	uint32_t *ids;
+	uint32_t num_ids;
+	uint32_t alloc_ids;
+	uint64_t prev_ts;
+	int64_t prev_delta;
+	uint32_t num_ticks;
+};
+
+struct tsdb_codec *tsdb_codec_alloc(void *ctx);
+void tsdb_codec_reset(struct tsdb_codec *codec);
+
+int tsdb_encode_tick(struct tsdb_codec *codec, uint8_t *data, uint32_t size_bits, uint32_t *bits,
+		     uint64_t ts, const uint32_t *ids, const double *values, uint32_t num);
+
+typedef void (*tsdb_sample_cb)(uint64_t ts, uint32_t id, double value, void *data);
+int tsdb_decode_block(struct tsdb_codec *codec, const struct tsdb_block_hdr *hdr, const uint8_t *data,
+		      uint32_t size_bits, tsdb_sample_cb cb, void *cb_data);
@@ -0,0 +1,115 @@
+/* Wire format of the osmo-sysmon uplink */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved.
+ *
+ * SPDX-License-Identifier: GPL-2.0+
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <errno.h>
+
+#include <talloc.h>
+#include <osmocom/core/bit32gen.h>
+#include <osmocom/core/bit64gen.h>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "uplink.h"
+
+void uplink_hdr_encode(uint8_t *buf, const struct uplink_hdr *hdr)
+{
+	buf[0] = hdr->type;
+	buf[1] = hdr->flags;
+	buf[2] = buf[3] = 0;
+	osmo_store32be(hdr->len, buf + 4);
+	osmo_store32be(hdr->raw_len, buf + 8);
+	osmo_store64be(hdr->seq, buf + 12);
+	osmo_store64be(hdr->timestamp, buf + 20);
+}
+
+int uplink_hdr_decode(struct uplink_hdr *hdr, const uint8_t *buf)
+{
+	hdr->type = buf[0];
+	hdr->flags = buf[1];
+	hdr->len = osmo_load32be(buf + 4);
+	hdr->raw_len = osmo_load32be(buf + 8);
+	hdr->seq = osmo_load64be(buf + 12);
+	hdr->timestamp = osmo_load64be(buf + 20);
+	if (hdr->type < UPLINK_HELLO || hdr->type > UPLINK_ACK ||
+	    hdr->len > UPLINK_MAX_LEN || hdr->raw_len > UPLINK_MAX_LEN)
+		return -EINVAL;
+	return 0;
+}
+
+/* Set *raw to the uncompressed payload, allocated from ctx if it was
+ * compressed. Returns its length, -ENOTSUP if compressed and built without
+ * zstd. */
+int uplink_decompress(void *ctx, const struct uplink_hdr *hdr, const uint8_t *payload, uint8_t **raw)
+{
+#ifdef HAVE_ZSTD
+	size_t rc;
+#endif
+
+	if (!(hdr->flags & UPLINK_F_ZSTD)) {
+		*raw = (uint8_t *)payload;
+		return hdr->len;
+	}
+#ifdef HAVE_ZSTD
+	*raw = talloc_size(ctx, hdr->raw_len + 1);
+	if (!*raw)
+		return -ENOMEM;
+	rc = ZSTD_decompress(*raw, hdr->raw_len, payload, hdr->len);
+	if (ZSTD_isError(rc) || rc != hdr->raw_len) {
+		TALLOC_FREE(*raw);
+		return -EINVAL;
+	}
+	return rc;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/* Call cb for every record, with value NULL for removed leaves */
+int uplink_parse_records(const uint8_t *raw, size_t len, uplink_record_cb cb, void *data)
+{
+	const char *p = (const char *)raw, *end = p + len, *path, *value;
+
+	while (p < end) {
+		path = p + 1;
+		value = memchr(path, '\0', end - path);
+		if (!value)
+			return -EINVAL;
+		value++;
+		switch (*p) {
+		case '=':
+			p = memchr(value, '\0', end - value);
+			if (!p)
+				return -EINVAL;
+			p++;
+			cb(path, value, data);
+			break;
+		case '-':
+			p = value;
+			cb(path, NULL, data);
+			break;
+		default:
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+/* Wire format of the osmo-sysmon uplink ("uplink-server HOST PORT"), see
+ * osysmon_uplink.c. Both directions are a stream of frames, each a header
+ * in network byte order followed by len bytes of payload.
+ *
+ * After HELLO (payload: site name), every tick is one KEY or DELTA frame
+ * with consecutive seq. DELTA is relative to the frame of the previous seq,
+ * KEY holds all leaves. The payload, zstd compressed if UPLINK_F_ZSTD, is a
+ * sequence of records:
+ *
+ *   '=' PATH '\0' VALUE '\0'	leaf is new or changed
+ *   '-' PATH '\0'		leaf is gone
+ *
+ * Frames replayed from the spool of the sender have UPLINK_F_SPOOL set.
+ * They form a stream of their own, older than the live frames and
+ * interleaved with them, that starts with a KEY frame. The receiver
+ * acknowledges every frame with an ACK frame of the same seq and
+ * UPLINK_F_SPOOL flag, also one it dropped (osysmon_aggregator.c drops the
+ * spooled ones): the spool is deleted once acknowledged.
+ *
+ * Via UDP ("uplink-server HOST PORT udp", see osysmon_aggregator.c), every
+ * datagram is a HELLO frame followed by KEY or DELTA frames, without
+ * acknowledgement and without spool. */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define UPLINK_HDR_LEN		28
+#define UPLINK_MAX_LEN		(16 * 1024 * 1024)
+
+enum uplink_type {
+	UPLINK_HELLO = 1,
+	UPLINK_KEY,
+	UPLINK_DELTA,
+	UPLINK_ACK,
+};
+
+#define UPLINK_F_ZSTD		0x01
+#define UPLINK_F_SPOOL		0x02
+
+struct uplink_hdr {
+	uint8_t type;
+	uint8_t flags;
+	uint32_t len;
+	/* of the payload once decompressed */
+	uint32_t raw_len;
+	uint64_t seq;
+	/* CLOCK_REALTIME in ms */
+	uint64_t timestamp;
+};
+
+void uplink_hdr_encode(uint8_t *buf, const struct uplink_hdr *hdr);
+int uplink_hdr_decode(struct uplink_hdr *hdr, const uint8_t *buf);
+
+int uplink_decompress(void *ctx, const struct uplink_hdr *hdr, const uint8_t *payload, uint8_t **raw);
+
+typedef void (*uplink_record_cb)(const char *path, const char *value, void *data);
+int uplink_parse_records(const uint8_t *raw, size_t len, uplink_record_cb cb, void *data);
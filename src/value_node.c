@@ -18,6 +18,7 @@
 
 #include <talloc.h>
 #include <string.h>
+#include <stdlib.h>
 #include <osmocom/core/utils.h>
 
 #include "value_node.h"
@@ -91,3 +92,48 @@ void value_node_del(struct value_node *node)
 	/* let talloc do its magic to delete all child nodes */
 	talloc_free(node);
 }
+
+static const struct value_unit value_units[] = {
+	{ "",		1,	"" },
+	{ "%",		1,	"_percent" },
+	{ "B",		1,	"_bytes" },
+	{ "kB",		1024,	"_bytes" },
+	{ "B/s",	1,	"_bytes_per_second" },
+	{ "/s",		1,	"_per_second" },
+	{ "s",		1,	"_seconds" },
+	{ "ms",		1e-3,	"_seconds" },
+	{ "us",		1e-6,	"_seconds" },
+};
+
+/* Is the value a number like "1234", "-3.5%" or "1560 kB"? The whole value
+ * has to be a decimal number, optionally followed by one of the known units,
+ * so that an IP address, a MAC address or a date isn't taken for one.
+ * Returns the unit and sets val (not scaled) and the length of the number,
+ * or returns NULL. */
+const struct value_unit *value_number(const char *str, double *val, size_t *len)
+{
+	const char *end, *u;
+	int i;
+
+	for (end = str; (*end >= '0' && *end <= '9') || *end == '-' || *end == '+' || *end == '.' ||
+			*end == 'e' || *end == 'E'; end++)
+		;
+	if (end == str || !((*str >= '0' && *str <= '9') || *str == '-' || *str == '.'))
+		return NULL;
+	/* strtod() would also take "0x1f", "inf" or leading spaces */
+	*val = strtod(str, (char **)&u);
+	if (u != end)
+		return NULL;
+
+	for (i = 0; i < ARRAY_SIZE(value_units); i++) {
+		u = end;
+		if (*u == ' ' && value_units[i].str[0] && value_units[i].str[0] != '%' &&
+		    value_units[i].str[0] != '/')
+			u++;
+		if (!strcmp(u, value_units[i].str)) {
+			*len = end - str;
+			return &value_units[i];
+		}
+	}
+	return NULL;
+}
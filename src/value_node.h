@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
 #include <osmocom/core/linuxlist.h>
 
 /* a single node in the tree of values */
@@ -22,3 +24,14 @@ struct value_node *value_node_find(struct value_node *parent, const char *name);
 struct value_node *value_node_find_by_idx(struct value_node *parent, int idx);
 struct value_node *value_node_find_or_add(struct value_node *parent, const char *name);
 void value_node_del(struct value_node *node);
+
+/* a unit a numeric value may have, like "kB" in "1560 kB" */
+struct value_unit {
+	const char *str;
+	/* to the base unit */
+	double scale;
+	/* of the OpenMetrics family in the base unit */
+	const char *om_suffix;
+};
+
+const struct value_unit *value_number(const char *str, double *val, size_t *len);